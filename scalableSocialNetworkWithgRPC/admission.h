@@ -0,0 +1,175 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <grpc++/grpc++.h>
+
+#include "stats.h"
+
+// admission control and backpressure for tsd
+// posts: every user has a token bucket refilled at POST_RATE posts per second up to POST_BURST,
+// a post that finds the bucket empty isn't stored and ends its stream with RESOURCE_EXHAUSTED
+// before it takes the store's lock, so the client knows to send it again later
+// slow streams: a user's timeline is the outbound queue of their update stream, it keeps the
+// newest 20 posts and drops older ones (user_store.h); writing it out is registered here and a
+// watchdog cancels a stream whose write has been blocked for SLOW_WRITE_MS, so a client that
+// stops reading can't hold a server thread
+// load shedding: requests in progress are counted and the time posts wait for users_db_mutex is
+// averaged, while either is past its limit new requests get RESOURCE_EXHAUSTED (admit) and a post
+// ends its stream with it
+
+const double POST_RATE = 20;
+const double POST_BURST = 40;
+
+const int64_t SLOW_WRITE_MS = 5000;
+
+// requests in progress and average wait for users_db_mutex (in microseconds) past which
+// requests are shed
+const int64_t MAX_IN_FLIGHT = 256;
+const int64_t MAX_LOCK_WAIT_US = 50000;
+
+struct token_bucket {
+	double tokens = POST_BURST;
+	uint64_t refilled_ns = 0;
+};
+
+struct admission_state {
+	std::mutex admission_mutex;
+	std::unordered_map<std::string, token_bucket> buckets;
+	// streams writing a timeline and when the write started, guarded by admission_mutex
+	std::unordered_map<grpc::ServerContext*, uint64_t> writes;
+	std::atomic<int64_t> in_flight;
+	// average wait, every new sample moves it an eighth of the way, it is ignored once no request
+	// has waited for a second so shedding stops when nothing gets through to sample it
+	std::atomic<int64_t> lock_wait_us;
+	std::atomic<uint64_t> lock_wait_at_ns;
+	std::atomic<uint64_t> shed;
+	std::atomic<uint64_t> throttled;
+	std::atomic<uint64_t> cancelled_writes;
+
+	admission_state() : in_flight(0), lock_wait_us(0), lock_wait_at_ns(0), shed(0), throttled(0), cancelled_writes(0) {}
+};
+
+admission_state admission;
+
+// function that takes a token from a user's bucket, returns false if there is none
+bool take_post_token(const std::string& username){
+	uint64_t now = stats_now_ns();
+	std::lock_guard<std::mutex> lock(admission.admission_mutex);
+	token_bucket& bucket = admission.buckets[username];
+	if(bucket.refilled_ns != 0){
+		bucket.tokens += (now - bucket.refilled_ns) / 1e9 * POST_RATE;
+		if(bucket.tokens > POST_BURST){
+			bucket.tokens = POST_BURST;
+		}
+	}
+	bucket.refilled_ns = now;
+	if(bucket.tokens < 1){
+		admission.throttled++;
+		return false;
+	}
+	bucket.tokens -= 1;
+	return true;
+}
+
+// function that drops the bucket of a deleted user
+void forget_post_tokens(const std::string& username){
+	std::lock_guard<std::mutex> lock(admission.admission_mutex);
+	admission.buckets.erase(username);
+}
+
+// function that adds a sample of how long a request waited for users_db_mutex
+void record_lock_wait(uint64_t wait_ns){
+	int64_t sample = wait_ns / 1000;
+	int64_t average = admission.lock_wait_us.load(std::memory_order_relaxed);
+	admission.lock_wait_us.store(average + (sample - average) / 8, std::memory_order_relaxed);
+	admission.lock_wait_at_ns.store(stats_now_ns(), std::memory_order_relaxed);
+}
+
+// function that returns the average wait for users_db_mutex, 0 if it is out of date
+int64_t recent_lock_wait_us(){
+	if(stats_now_ns() - admission.lock_wait_at_ns.load(std::memory_order_relaxed) > 1000000000ULL){
+		return 0;
+	}
+	return admission.lock_wait_us.load(std::memory_order_relaxed);
+}
+
+// counts a request as in progress for as long as it exists, admitted() is false when the server
+// is overloaded and the request should be answered with overloaded_status()
+class admission_ticket {
+	public:
+		admission_ticket() {
+			int64_t in_flight = ++admission.in_flight;
+			ok = in_flight <= MAX_IN_FLIGHT && recent_lock_wait_us() <= MAX_LOCK_WAIT_US;
+			if(!ok){
+				admission.shed++;
+			}
+		}
+		~admission_ticket() { admission.in_flight--; }
+		bool admitted() const { return ok; }
+	private:
+		bool ok;
+};
+
+grpc::Status overloaded_status(){
+	return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "server overloaded, retry later");
+}
+
+grpc::Status posting_too_fast_status(){
+	return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "posting too fast, retry later");
+}
+
+// function that runs a handler's work while it counts as a request in progress, or answers
+// RESOURCE_EXHAUSTED without running it while the server is overloaded
+template<typename Work>
+grpc::Status admit(Work work){
+	admission_ticket ticket;
+	if(!ticket.admitted()){
+		return overloaded_status();
+	}
+	return work();
+}
+
+// registers a stream's timeline write with the watchdog for as long as it exists
+class watched_write {
+	public:
+		explicit watched_write(grpc::ServerContext* context) : stream(context) {
+			std::lock_guard<std::mutex> lock(admission.admission_mutex);
+			admission.writes[stream] = stats_now_ns();
+		}
+		~watched_write() {
+			std::lock_guard<std::mutex> lock(admission.admission_mutex);
+			admission.writes.erase(stream);
+		}
+	private:
+		grpc::ServerContext* stream;
+};
+
+// watchdog that cancels the streams whose write has been blocked for longer than SLOW_WRITE_MS
+// the blocked Write then fails and the handler returns
+void watch_slow_writes(){
+	while(true){
+		std::this_thread::sleep_for(std::chrono::milliseconds(SLOW_WRITE_MS / 5));
+		uint64_t now = stats_now_ns();
+		std::lock_guard<std::mutex> lock(admission.admission_mutex);
+		for(auto& write : admission.writes){
+			if(write.second < now && now - write.second > (uint64_t)SLOW_WRITE_MS * 1000000){
+				write.first->TryCancel();
+				admission.cancelled_writes++;
+				// counted once, the entry goes when the write returns
+				write.second = now + (uint64_t)3600 * 1000000000;
+			}
+		}
+	}
+}
+
+void start_admission_watchdog(){
+	std::thread(watch_slow_writes).detach();
+}
+
+#endif
@@ -0,0 +1,521 @@
+#ifndef ANTI_ENTROPY_H
+#define ANTI_ENTROPY_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <unordered_set>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <grpc++/grpc++.h>
+
+#include "TNSService.grpc.pb.h"
+#include "user_store.h"
+#include "store_digest.h"
+#include "peer_fanout.h"
+#include "suggest.h"
+#include "admission.h"
+#include "stats.h"
+
+// anti entropy between masters (tsd -o anti_entropy_seconds=N, 10 by default, 0 turns it off)
+// every anti_entropy_seconds a master compares its store with every other online master (the
+// routers list them, see peer_fanout.h) and takes what it is missing; the digest trees of the two
+// stores (store_digest.h) are compared from the root down, asking only for the children of nodes
+// that differ, then for the leaves of the buckets that differ, the records of the users whose
+// leaves differ and, of those users, the posts of the hours whose digests differ
+// the other master takes what it is missing in its own rounds, so a round between stores that match
+// costs one message of SYNC_FANOUT digests, and a few users that differ a few small messages more
+// whatever the size of the stores
+// the newer change wins: a delete or unfollow wins over a registration or follow older than it, one
+// from a log written before changes were logged with their time has none and is older than any with
+// a time, and when neither has a time the user or the follow is kept; posts are added up, a post is
+// never taken away on its own
+// users, follows and posts taken from another master are logged like the server's own, a post that
+// arrives late is ordered with the user's newest (store_post)
+// the store keeps the digests of the hours as posts are stored, so describing a user reads none of
+// their posts, and only the posts stored since the oldest hour that differs are read back to send or
+// take the posts of the hours that differ
+// every user stays a user of the master they registered on: a user registered only on the other
+// master becomes a user of that master known here (user::home, logged as REMOTE_USER), like the
+// users followed from here (peer_fanout.h), so following them goes through their master and their
+// posts are forwarded from there; a round takes only whether such a user was deleted and the leaf
+// their master has for them (store_digest.h), and users known here of a third master are left to
+// the rounds with that master; the records of users registered on both masters (a client that
+// moved to another master and registered there too) are merged, and the follows taken of users of
+// other masters are made through their masters once the round lets go of users_db_mutex
+
+const int SYNC_CALL_MS = 5000;
+const int SYNC_BUCKETS_PER_CALL = 1024;
+const int SYNC_USERS_PER_CALL = 256;
+
+struct anti_entropy_state {
+	// the log of the server, called with users_db_mutex held
+	void (*log)(const std::string& line) = nullptr;
+	// rounds run, bytes sent and received, what was taken from other masters, and the users whose
+	// leaves differed in the last round
+	std::atomic<uint64_t> rounds;
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint64_t> users_taken;
+	std::atomic<uint64_t> deletes_taken;
+	std::atomic<uint64_t> follows_taken;
+	std::atomic<uint64_t> posts_taken;
+	std::atomic<uint64_t> differing_users;
+
+	anti_entropy_state() : rounds(0), bytes(0), users_taken(0), deletes_taken(0), follows_taken(0), posts_taken(0),
+			differing_users(0) {}
+};
+
+anti_entropy_state anti_entropy;
+
+int anti_entropy_latency = register_metric("anti_entropy_round", true);
+
+// function that adds up the digest tree from a copy of the buckets, level n has SYNC_FANOUT^n nodes
+// and level SYNC_LEVELS is the buckets
+std::vector<std::vector<uint64_t>> digest_tree(){
+	std::vector<std::vector<uint64_t>> tree(SYNC_LEVELS + 1);
+	{
+		std::lock_guard<std::mutex> lock(users_db_mutex);
+		tree.at(SYNC_LEVELS).assign(store_digest.buckets, store_digest.buckets + SYNC_BUCKETS);
+	}
+	for(int level = SYNC_LEVELS - 1; level >= 0; level--){
+		tree.at(level).assign(tree.at(level + 1).size() / SYNC_FANOUT, 0);
+		for(int i = 0; i < tree.at(level + 1).size(); i++){
+			tree.at(level).at(i / SYNC_FANOUT) += tree.at(level + 1).at(i);
+		}
+	}
+	return tree;
+}
+
+// function that returns the leaf digest of a user known here, the digest of their tombstone if
+// they were deleted, 0 otherwise; the caller holds users_db_mutex
+uint64_t leaf_digest_of(const std::string& username){
+	auto found = users_db.find(username);
+	if(found != users_db.end()){
+		return found->second->leaf_digest;
+	}
+	uint64_t deleted = user_tombstone(username);
+	return deleted == 0 ? 0 : tombstone_digest(username, deleted);
+}
+
+// helper functions that return the id and the range of a post record
+uint64_t post_id_of(const post_record& post){
+	const std::string& body = post_body(post.field(2), post.lengths[2]);
+	return post_digest_id(post.field(0), post.lengths[0], post.field(1), post.lengths[1], body.data(), body.size());
+}
+
+int64_t post_range_of(const post_record& post){
+	return digest_range(post_time_of(post));
+}
+
+// function that describes a user as this server has them, the caller holds users_db_mutex
+void describe_sync_user(const std::string& username, TNSService::sync_user* record){
+	record->set_username(username);
+	auto found = users_db.find(username);
+	if(found == users_db.end() || found->second->home != ""){
+		record->set_registered(false);
+		record->set_version(user_tombstone(username));
+		return;
+	}
+	user* u = found->second;
+	record->set_registered(true);
+	record->set_version(u->registered_ns);
+	for(int i = 0; i < u->following.size(); i++){
+		const std::string& followee = u->following.at(i);
+		if(followee == username){
+			continue;
+		}
+		auto version = u->follow_versions.find(followee);
+		TNSService::sync_follow* follow = record->add_follows();
+		follow->set_followee(followee);
+		follow->set_version(version == u->follow_versions.end() ? 0 : version->second.first);
+		follow->set_follow(true);
+	}
+	for(auto& version : u->follow_versions){
+		if(!version.second.second){
+			TNSService::sync_follow* unfollow = record->add_follows();
+			unfollow->set_followee(version.first);
+			unfollow->set_version(version.second.first);
+			unfollow->set_follow(false);
+		}
+	}
+	for(auto& entry : u->post_ranges){
+		TNSService::sync_range* range = record->add_ranges();
+		range->set_start(entry.first);
+		range->set_digest(entry.second.first);
+		range->set_posts(entry.second.second);
+	}
+}
+
+// function that answers another master's SyncDigests
+void answer_sync_request(const TNSService::sync_request& request, TNSService::sync_reply* reply){
+	if(request.nodes_size() > 0 && request.level() < SYNC_LEVELS){
+		std::vector<std::vector<uint64_t>> tree = digest_tree();
+		const std::vector<uint64_t>& children = tree.at(request.level() + 1);
+		for(int i = 0; i < request.nodes_size(); i++){
+			uint64_t first = (uint64_t)request.nodes(i) * SYNC_FANOUT;
+			for(int c = 0; c < SYNC_FANOUT; c++){
+				reply->add_digests(first + c < children.size() ? children.at(first + c) : 0);
+			}
+		}
+	}
+	std::lock_guard<std::mutex> lock(users_db_mutex);
+	std::unordered_set<uint32_t> buckets;
+	for(int i = 0; i < request.buckets_size() && request.buckets(i) < SYNC_BUCKETS; i++){
+		buckets.insert(request.buckets(i));
+		const std::vector<user*>& bucket_users = digest_bucket_users[request.buckets(i)];
+		for(int u = 0; u < bucket_users.size(); u++){
+			if(bucket_users.at(u)->home == ""){
+				TNSService::sync_leaf* leaf = reply->add_leaves();
+				leaf->set_username(bucket_users.at(u)->username);
+				leaf->set_digest(bucket_users.at(u)->leaf_digest);
+			}
+		}
+	}
+	if(!buckets.empty()){
+		for(auto& deleted : store_digest.deleted_users){
+			if(buckets.count(digest_bucket(deleted.first)) > 0){
+				TNSService::sync_leaf* leaf = reply->add_leaves();
+				leaf->set_username(deleted.first);
+				leaf->set_digest(tombstone_digest(deleted.first, deleted.second));
+			}
+		}
+	}
+	for(int i = 0; i < request.users_size(); i++){
+		describe_sync_user(request.users(i), reply->add_users());
+	}
+}
+
+// function that answers another master's SyncPosts with the posts in the hours asked for
+void answer_sync_posts(const TNSService::sync_posts_request& request, TNSService::sync_posts_reply* reply){
+	std::lock_guard<std::mutex> lock(users_db_mutex);
+	auto found = users_db.find(request.username());
+	if(found == users_db.end() || found->second->home != ""){
+		return;
+	}
+	if(request.starts_size() == 0){
+		return;
+	}
+	std::unordered_set<int64_t> starts(request.starts().begin(), request.starts().end());
+	std::vector<post_handle> posts = posts_since(request.username(), *std::min_element(starts.begin(), starts.end()));
+	for(int i = posts.size() - 1; i >= 0; i--){
+		if(starts.count(post_range_of(*posts.at(i))) > 0){
+			TNSService::post_info* post = reply->add_posts();
+			post->set_username(request.username());
+			post->mutable_time()->assign(posts.at(i)->field(1), posts.at(i)->lengths[1]);
+			post->set_content(post_body(posts.at(i)->field(2), posts.at(i)->lengths[2]));
+		}
+	}
+}
+
+// a follow or unfollow of a user of another master taken in a round, their master is told once the
+// round lets go of users_db_mutex
+struct taken_remote_follow {
+	std::string follower;
+	std::string followee;
+	std::string home;
+	bool follow;
+};
+
+// helper function that deletes a user another master deleted at time deleted, the caller holds
+// users_db_mutex
+void take_delete(const std::string& username, uint64_t deleted){
+	std::vector<std::string> former_followers;
+	remove_user(username, former_followers);
+	for(int i = 0; i < former_followers.size(); i++){
+		refresh_suggestions_after_follow(former_followers.at(i));
+	}
+	forget_post_tokens(username);
+	set_user_tombstone(username, deleted);
+	anti_entropy.log(delete_log_line(username, deleted));
+	anti_entropy.deletes_taken++;
+}
+
+// function that merges the record of a user the master at address has into the store, leaf is
+// their leaf there, follows of users of other masters taken are added to remote_follows
+// returns the hours whose posts differ, the caller holds users_db_mutex
+std::vector<int64_t> merge_sync_user(const TNSService::sync_user& theirs, const std::string& address, uint64_t leaf,
+		std::vector<taken_remote_follow>& remote_follows){
+	std::vector<int64_t> starts;
+	const std::string& username = theirs.username();
+	auto found = users_db.find(username);
+	// a user of the master at address known here, see the top of the file
+	if(found != users_db.end() && found->second->home != ""){
+		if(found->second->home != address){
+			return starts;
+		}
+		if(theirs.registered()){
+			set_leaf_digest(found->second, leaf);
+		}
+		else if(theirs.version() != 0){
+			take_delete(username, theirs.version());
+		}
+		return starts;
+	}
+	user* mine = found != users_db.end() ? found->second : nullptr;
+	if(!theirs.registered()){
+		if(mine != nullptr && theirs.version() > mine->registered_ns){
+			take_delete(username, theirs.version());
+		}
+		else if(mine == nullptr && theirs.version() > user_tombstone(username)){
+			set_user_tombstone(username, theirs.version());
+			anti_entropy.log(delete_log_line(username, theirs.version()));
+		}
+		return starts;
+	}
+	if(mine == nullptr){
+		// deleted here after they registered there
+		if(user_tombstone(username) > theirs.version()){
+			return starts;
+		}
+		clear_user_tombstone(username);
+		set_leaf_digest(create_remote_user(username, address), leaf);
+		anti_entropy.log("REMOTE_USER " + username + "|" + address);
+		anti_entropy.users_taken++;
+		return starts;
+	}
+	if(theirs.version() > mine->registered_ns){
+		mine->registered_ns = theirs.version();
+		anti_entropy.log(initialize_log_line(mine));
+	}
+	bool follows_changed = false;
+	for(int i = 0; i < theirs.follows_size(); i++){
+		const TNSService::sync_follow& follow = theirs.follows(i);
+		const std::string& followee = follow.followee();
+		if(followee == username){
+			continue;
+		}
+		bool following = std::find(mine->following.begin(), mine->following.end(), followee) != mine->following.end();
+		auto version = mine->follow_versions.find(followee);
+		uint64_t my_time = version == mine->follow_versions.end() ? 0 : version->second.first;
+		bool my_follow = version == mine->follow_versions.end() ? following : version->second.second;
+		// the newer one wins, a follow wins when they are as old
+		if(follow.version() < my_time || (follow.version() == my_time && (my_follow || !follow.follow()))){
+			continue;
+		}
+		// a followee that isn't known here yet comes in a later round
+		auto followed = users_db.find(followee);
+		if(follow.follow() && !following && followed == users_db.end()){
+			continue;
+		}
+		if(follow.version() != 0){
+			mine->follow_versions[followee] = std::make_pair(follow.version(), follow.follow());
+		}
+		if(follow.follow() && !following){
+			mine->following.push_back(followee);
+			followed->second->followers.push_back(username);
+			graph_follow(username, followee);
+			backfill_timeline(username, followee);
+			anti_entropy.follows_taken++;
+		}
+		else if(!follow.follow() && following){
+			remove_name(mine->following, followee);
+			remove_name(users_db.at(followee)->followers, username);
+			graph_unfollow(username, followee);
+			anti_entropy.follows_taken++;
+		}
+		if(follow.follow() != following && users_db.at(followee)->home != ""){
+			taken_remote_follow taken;
+			taken.follower = username;
+			taken.followee = followee;
+			taken.home = users_db.at(followee)->home;
+			taken.follow = follow.follow();
+			remote_follows.push_back(taken);
+		}
+		// the version is logged even when the follow or unfollow was already there
+		anti_entropy.log(follow_log_line(mine, followee, follow.follow()));
+		follows_changed = true;
+	}
+	update_follow_digest(mine);
+	if(follows_changed){
+		refresh_suggestions_after_follow(username);
+	}
+	for(int i = 0; i < theirs.ranges_size(); i++){
+		auto range = mine->post_ranges.find(theirs.ranges(i).start());
+		if(range == mine->post_ranges.end() || range->second.first != theirs.ranges(i).digest()){
+			starts.push_back(theirs.ranges(i).start());
+		}
+	}
+	return starts;
+}
+
+// function that adds the posts of a user this server is missing, oldest first, and gives them to
+// the user's followers, the caller holds users_db_mutex
+void merge_sync_posts(const std::string& username, const TNSService::sync_posts_reply& reply){
+	auto found = users_db.find(username);
+	if(found == users_db.end() || found->second->home != ""){
+		return;
+	}
+	if(reply.posts_size() == 0){
+		return;
+	}
+	// the posts here of the ranges they were sent for
+	int64_t oldest = digest_range(post_time_of(reply.posts(0).time().data(), reply.posts(0).time().size()));
+	for(int i = 1; i < reply.posts_size(); i++){
+		oldest = std::min(oldest, digest_range(post_time_of(reply.posts(i).time().data(), reply.posts(i).time().size())));
+	}
+	std::unordered_set<uint64_t> ids;
+	std::vector<post_handle> posts = posts_since(username, oldest);
+	for(int i = 0; i < posts.size(); i++){
+		ids.insert(post_id_of(*posts.at(i)));
+	}
+	for(int i = 0; i < reply.posts_size(); i++){
+		const TNSService::post_info& post = reply.posts(i);
+		if(!ids.insert(post_digest_id(username, post.time(), post.content())).second){
+			continue;
+		}
+		std::vector<std::string> post_info;
+		post_info.push_back(username);
+		post_info.push_back(post.time());
+		post_info.push_back(post.content());
+		store_post(username, post_info);
+		const std::vector<std::string>& followers = users_db.at(username)->followers;
+		for(int f = 0; f < followers.size(); f++){
+			if(followers.at(f) != username){
+				std::vector<post_handle> stored(1, users_db.at(username)->posts.back());
+				merge_into_timeline(users_db.at(followers.at(f))->timeline, stored);
+			}
+		}
+		anti_entropy.log(post_log_line(post));
+		anti_entropy.posts_taken++;
+	}
+}
+
+// helper function that makes a SyncDigests call to a master, false if it didn't answer
+bool sync_call(TNSService::user_services::Stub* stub, const TNSService::sync_request& request, TNSService::sync_reply& reply){
+	grpc::ClientContext context;
+	context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(SYNC_CALL_MS));
+	bool answered = stub->SyncDigests(&context, request, &reply).ok();
+	anti_entropy.bytes += request.ByteSizeLong() + reply.ByteSizeLong();
+	return answered;
+}
+
+// function that takes what this server is missing from the master at address
+void reconcile_with(const std::string& address){
+	std::shared_ptr<TNSService::user_services::Stub> stub = peer_stub(address);
+	std::vector<std::vector<uint64_t>> tree = digest_tree();
+	// the nodes that differ, level by level from the root down to the buckets
+	std::vector<uint32_t> differing(1, 0);
+	for(int level = 0; level < SYNC_LEVELS && !differing.empty(); level++){
+		TNSService::sync_request request;
+		TNSService::sync_reply reply;
+		request.set_level(level);
+		for(int i = 0; i < differing.size(); i++){
+			request.add_nodes(differing.at(i));
+		}
+		if(!sync_call(stub.get(), request, reply) || reply.digests_size() != differing.size() * SYNC_FANOUT){
+			return;
+		}
+		std::vector<uint32_t> children;
+		for(int i = 0; i < reply.digests_size(); i++){
+			uint32_t child = differing.at(i / SYNC_FANOUT) * SYNC_FANOUT + i % SYNC_FANOUT;
+			if(reply.digests(i) != tree.at(level + 1).at(child)){
+				children.push_back(child);
+			}
+		}
+		std::swap(differing, children);
+	}
+	// the users whose leaves differ in the buckets that differ, with their leaves there
+	std::vector<std::string> users;
+	std::unordered_map<std::string, uint64_t> leaves;
+	for(int first = 0; first < differing.size(); first += SYNC_BUCKETS_PER_CALL){
+		TNSService::sync_request request;
+		TNSService::sync_reply reply;
+		for(int i = first; i < differing.size() && i < first + SYNC_BUCKETS_PER_CALL; i++){
+			request.add_buckets(differing.at(i));
+		}
+		if(!sync_call(stub.get(), request, reply)){
+			return;
+		}
+		std::lock_guard<std::mutex> lock(users_db_mutex);
+		for(int i = 0; i < reply.leaves_size(); i++){
+			// a user known here of a third master is left to the rounds with that master
+			auto known = users_db.find(reply.leaves(i).username());
+			if(known != users_db.end() && known->second->home != "" && known->second->home != address){
+				continue;
+			}
+			if(leaf_digest_of(reply.leaves(i).username()) != reply.leaves(i).digest()){
+				users.push_back(reply.leaves(i).username());
+				leaves[reply.leaves(i).username()] = reply.leaves(i).digest();
+			}
+		}
+	}
+	anti_entropy.differing_users = users.size();
+	// their records, and the posts of the hours that differ
+	for(int first = 0; first < users.size(); first += SYNC_USERS_PER_CALL){
+		TNSService::sync_request request;
+		TNSService::sync_reply reply;
+		for(int i = first; i < users.size() && i < first + SYNC_USERS_PER_CALL; i++){
+			request.add_users(users.at(i));
+		}
+		if(!sync_call(stub.get(), request, reply)){
+			return;
+		}
+		std::vector<TNSService::sync_posts_request> wanted;
+		std::vector<taken_remote_follow> remote_follows;
+		{
+			std::lock_guard<std::mutex> lock(users_db_mutex);
+			for(int i = 0; i < reply.users_size(); i++){
+				auto leaf = leaves.find(reply.users(i).username());
+				std::vector<int64_t> starts = merge_sync_user(reply.users(i), address,
+						leaf == leaves.end() ? 0 : leaf->second, remote_follows);
+				if(!starts.empty()){
+					wanted.push_back(TNSService::sync_posts_request());
+					wanted.back().set_username(reply.users(i).username());
+					for(int s = 0; s < starts.size(); s++){
+						wanted.back().add_starts(starts.at(s));
+					}
+				}
+			}
+		}
+		// their posts come forwarded from their masters from then on
+		for(int i = 0; i < remote_follows.size(); i++){
+			TNSService::remote_follow_reply followed;
+			remote_follow(remote_follows.at(i).follower, remote_follows.at(i).followee, remote_follows.at(i).follow,
+					remote_follows.at(i).home, followed);
+		}
+		for(int i = 0; i < wanted.size(); i++){
+			grpc::ClientContext context;
+			context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(SYNC_CALL_MS));
+			TNSService::sync_posts_reply posts;
+			if(!stub->SyncPosts(&context, wanted.at(i), &posts).ok()){
+				return;
+			}
+			anti_entropy.bytes += wanted.at(i).ByteSizeLong() + posts.ByteSizeLong();
+			std::lock_guard<std::mutex> lock(users_db_mutex);
+			merge_sync_posts(wanted.at(i).username(), posts);
+		}
+	}
+}
+
+// thread that runs a round with every other master every seconds
+void run_anti_entropy(int seconds){
+	while(1){
+		sleep(seconds);
+		std::vector<std::string> masters;
+		{
+			std::lock_guard<std::mutex> lock(peer_fanout.peers_mutex);
+			masters = peer_fanout.masters;
+		}
+		for(int i = 0; i < masters.size(); i++){
+			scoped_latency timer(anti_entropy_latency);
+			reconcile_with(masters.at(i));
+			anti_entropy.rounds++;
+		}
+	}
+}
+
+// function that starts the anti entropy, log is the server's log_line
+void start_anti_entropy(int seconds, void (*log)(const std::string& line)){
+	if(seconds <= 0){
+		return;
+	}
+	anti_entropy.log = log;
+	std::thread(run_anti_entropy, seconds).detach();
+}
+
+#endif
@@ -0,0 +1,726 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+#include <new>
+#include <malloc.h>
+#include <unistd.h>
+
+#include "user_store.h"
+#include "timeline_page.h"
+#include "trending.h"
+#include "suggest.h"
+
+// in process microbenchmarks for the hot paths of tsd
+// every benchmark calls the same store functions the rpc handlers use (user_store.h)
+// without any grpc in between, and reports the time and heap allocations per operation
+
+// every heap allocation in this process goes through these, the harness reads the counter
+// before and after a benchmark to get allocations per operation, heap_bytes is what is allocated
+// right now (as malloc sizes the blocks) for benchmarks that compare memory use
+// they are kept out of line so the compiler doesn't pair the inlined malloc/free with
+// new/delete expressions and warn about mismatched allocation functions
+uint64_t allocation_count = 0;
+int64_t heap_bytes = 0;
+
+__attribute__((noinline)) void* operator new(std::size_t size){
+	allocation_count++;
+	void* p = std::malloc(size == 0 ? 1 : size);
+	if(p == nullptr){
+		throw std::bad_alloc();
+	}
+	heap_bytes += malloc_usable_size(p);
+	return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+	if(p != nullptr){
+		heap_bytes -= malloc_usable_size(p);
+	}
+	std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept {
+	if(p != nullptr){
+		heap_bytes -= malloc_usable_size(p);
+	}
+	std::free(p);
+}
+
+// settings from the command line
+std::string name_filter = "";
+int min_time_ms = 200;
+
+// timing state for the benchmark that is currently running
+// a benchmark can pause the timer around work that shouldn't be measured (setup, cleanup)
+std::chrono::steady_clock::time_point timer_started;
+uint64_t timed_ns = 0;
+uint64_t timed_allocations = 0;
+uint64_t allocations_at_start = 0;
+
+void timer_resume(){
+	allocations_at_start = allocation_count;
+	timer_started = std::chrono::steady_clock::now();
+}
+
+void timer_pause(){
+	timed_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - timer_started).count();
+	timed_allocations += allocation_count - allocations_at_start;
+}
+
+// runs op with a growing iteration count until it has been timed for at least min_time_ms
+// ops_per_call is the number of operations a single call to op performs
+void run_bench(const std::string& name, std::function<void()> op, int ops_per_call = 1){
+	if(name.find(name_filter) == std::string::npos){
+		return;
+	}
+	// one untimed call to warm caches and grow containers to their steady state
+	op();
+	uint64_t iterations = 1;
+	while(true){
+		timed_ns = 0;
+		timed_allocations = 0;
+		timer_resume();
+		for(uint64_t i = 0; i < iterations; i++){
+			op();
+		}
+		timer_pause();
+		if(timed_ns >= (uint64_t)min_time_ms * 1000000 || iterations >= (1ULL << 30)){
+			break;
+		}
+		iterations *= 2;
+	}
+	double ops = (double)iterations * ops_per_call;
+	std::printf("%-44s %12llu %14.1f %12.2f\n", name.c_str(), (unsigned long long)ops,
+			timed_ns / ops, timed_allocations / ops);
+}
+
+// removes every user so the next benchmark starts with an empty store
+// and empty post segments
+void reset_store(){
+	for(auto& entry : users_db){
+		slab_delete(entry.second);
+	}
+	users_db.clear();
+	all_users.clear();
+	for(int i = 0; i < SYNC_BUCKETS; i++){
+		digest_bucket_users[i].clear();
+	}
+	std::fill(store_digest.buckets, store_digest.buckets + SYNC_BUCKETS, 0);
+	store_digest.deleted_users.clear();
+	clear_follow_graph();
+	clear_suggestions();
+	all_post_counters = post_counters();
+	clear_search_index();
+	if(!open_post_segments("/tmp/bench_post_segment")){
+		std::cerr << "could not open post segments in /tmp\n";
+		std::exit(1);
+	}
+}
+
+// creates a user the same way InitializeUser does
+void add_user(const std::string& name){
+	create_user(name);
+}
+
+// adds a follow edge without touching the timeline
+void add_edge(const std::string& follower, const std::string& followee){
+	users_db.at(follower)->following.push_back(followee);
+	users_db.at(followee)->followers.push_back(follower);
+}
+
+// builds a post the way tsc sends it, second is added to the post's time
+std::vector<std::string> make_post(const std::string& username, int size, int second = 0){
+	std::time_t time = 1792404000 + second;
+	std::vector<std::string> post_info;
+	post_info.push_back(username);
+	post_info.push_back(std::asctime(std::gmtime(&time)));
+	post_info.push_back(std::string(size, 'p') + "\n");
+	return post_info;
+}
+
+// writer that stands in for the grpc ServerWriter in ListRequest
+struct counting_writer {
+	uint64_t messages = 0;
+	uint64_t bytes = 0;
+	bool Write(const following_user_message& message){
+		messages++;
+		bytes += message.ByteSizeLong();
+		return true;
+	}
+};
+
+// writer that stands in for the grpc ServerReaderWriter in TimelineRequest
+struct counting_post_writer {
+	uint64_t messages = 0;
+	uint64_t bytes = 0;
+	bool Write(const post_info& message){
+		messages++;
+		bytes += message.ByteSizeLong();
+		return true;
+	}
+};
+
+// TimelineRequest update path: write a full timeline (20 posts) to the stream
+void bench_timeline_update(int post_size){
+	std::queue<post_handle> timeline;
+	for(int i = 0; i < 20; i++){
+		timeline.push(make_post_record(make_post("poster" + std::to_string(i), post_size)));
+	}
+	counting_post_writer writer;
+	run_bench("timeline_update/post_bytes:" + std::to_string(post_size), [&](){
+		timer_pause();
+		std::queue<post_handle> outstanding = timeline;
+		timer_resume();
+		write_timeline(outstanding, "reader", &writer);
+	});
+}
+
+// TimelineRequest post path: build the post like the handler does and fan it out
+void bench_fan_out(int followers, int post_size){
+	reset_store();
+	add_user("poster");
+	for(int i = 0; i < followers; i++){
+		std::string name = "follower" + std::to_string(i);
+		add_user(name);
+		add_edge(name, "poster");
+	}
+	std::string content(post_size, 'p');
+	content += "\n";
+	std::string time = "Mon Oct 19 10:00:00 2026\n";
+	run_bench("fan_out/followers:" + std::to_string(followers) + "/post_bytes:" + std::to_string(post_size), [&](){
+		std::vector<std::string> post_info;
+		post_info.push_back("poster");
+		post_info.push_back(time);
+		post_info.push_back(content);
+		fan_out_post("poster", post_info);
+	});
+}
+
+// FollowRequest backfill: merge the followed user's posts into a full timeline by time
+void bench_follow_backfill(int followee_posts){
+	reset_store();
+	add_user("follower");
+	add_user("followee");
+	add_edge("follower", "followee");
+	// the followee's posts and the posts already in the timeline alternate in time
+	for(int i = 0; i < followee_posts; i++){
+		store_post("followee", make_post("followee", 64, 2 * i));
+	}
+	std::queue<post_handle> timeline;
+	for(int i = 0; i < 20; i++){
+		timeline.push(make_post_record(make_post("other", 64, 2 * (followee_posts - 20 + i) + 1)));
+	}
+	run_bench("follow_backfill/followee_posts:" + std::to_string(followee_posts), [&](){
+		timer_pause();
+		users_db.at("follower")->timeline = timeline;
+		timer_resume();
+		backfill_timeline("follower", "followee");
+	});
+}
+
+// reading a user's newest posts when most of them are in the post segments
+void bench_newest_posts(int count){
+	reset_store();
+	add_user("poster");
+	for(int i = 0; i < 10000; i++){
+		store_post("poster", make_post("poster", 64));
+	}
+	run_bench("newest_posts/count:" + std::to_string(count), [&](){
+		newest_posts("poster", count);
+	});
+}
+
+// TimelinePage: a page of 20 posts from the middle of the followed users' histories
+// every followed user has 200 posts, most of them in the segments
+void bench_timeline_page(int followees){
+	reset_store();
+	add_user("reader");
+	for(int i = 0; i < followees; i++){
+		std::string name = "followee" + std::to_string(i);
+		add_user(name);
+		add_edge("reader", name);
+	}
+	for(int round = 0; round < 200; round++){
+		for(int i = 0; i < followees; i++){
+			store_post("followee" + std::to_string(i), make_post("followee" + std::to_string(i), 64, round * followees + i));
+		}
+	}
+	// halfway back through the history
+	std::vector<std::string> middle = make_post("", 0, 100 * followees);
+	page_cursor cursor;
+	cursor.newest = false;
+	cursor.time = post_time_of(middle);
+	run_bench("timeline_page/followees:" + std::to_string(followees), [&](){
+		std::vector<std::vector<std::string>> page;
+		page_cursor next;
+		timeline_page("reader", cursor, 20, page, next);
+	});
+}
+
+// content for the search benchmarks, 12 words per post drawn from a vocabulary of 5000 where word k
+// is about as frequent as 1 / (k + 1) like natural text (word0 is in most posts, word3000 in about
+// one post in 2000), every fourth post carries one of 25 hashtags
+std::vector<std::string> search_corpus(int posts){
+	std::vector<std::string> corpus;
+	uint64_t state = 88172645463325252ULL;
+	for(int i = 0; i < posts; i++){
+		std::string content;
+		for(int w = 0; w < 12; w++){
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			uint64_t word = (uint64_t)std::pow(5000.0, (state % 1000000) / 1000000.0) - 1;
+			content += "word" + std::to_string(word) + " ";
+		}
+		if(i % 4 == 0){
+			content += "#tag" + std::to_string(i % 100);
+		}
+		corpus.push_back(content + "\n");
+	}
+	return corpus;
+}
+
+// indexing posts as store_post does, reported per post, followed by the memory the index uses
+void bench_search_build(int posts){
+	std::vector<std::string> corpus = search_corpus(posts);
+	run_bench("search_build/posts:" + std::to_string(posts), [&](){
+		timer_pause();
+		clear_search_index();
+		timer_resume();
+		for(int i = 0; i < corpus.size(); i++){
+			index_post("user" + std::to_string(i % 1000), i / 1000, corpus.at(i));
+		}
+	}, posts);
+	if(name_filter.empty() || std::string("search_build").find(name_filter) != std::string::npos){
+		std::printf("%-44s %12s %14.1f bytes/post (posting lists %.1f)\n",
+				("search_memory/posts:" + std::to_string(posts)).c_str(), "",
+				(double)search_index_bytes() / posts, (double)post_search.posting_bytes / posts);
+	}
+}
+
+// SearchPosts: the newest page of 20 matches, the posts are read back from memory and the segments
+void bench_search_query(const std::string& name, const std::string& query){
+	run_bench("search_query/" + name, [&](){
+		std::vector<std::vector<std::string>> page;
+		uint64_t next_before = 0;
+		search_posts(query, 0, 20, page, next_before);
+	});
+}
+
+// compressing post bodies with a dictionary trained on the first posts, and decompressing them
+// as write_timeline does, followed by the heap the bodies take as plain strings, compressed one
+// at a time without a dictionary and compressed with it
+void bench_post_body(int posts){
+	std::vector<std::string> corpus = search_corpus(posts);
+	post_compression.enabled = false;
+	post_compression.dictionary_count = 0;
+	enable_post_compression("");
+	std::vector<std::string> stored;
+	for(int i = 0; i < corpus.size(); i++){
+		stored.push_back(compress_post_body(corpus.at(i)));
+	}
+	int next = 0;
+	run_bench("post_body_compress/posts:" + std::to_string(posts), [&](){
+		compress_post_body(corpus.at(next++ % corpus.size()));
+	});
+	run_bench("post_body_decode/posts:" + std::to_string(posts), [&](){
+		post_body(stored.at(next++ % stored.size()));
+	});
+	if(name_filter.empty() || std::string("post_body").find(name_filter) != std::string::npos){
+		// the first posts came before the dictionary and are stored plain, they are left out
+		std::vector<std::string> plain, alone, compressed;
+		int64_t heap_at_start = heap_bytes;
+		for(int i = DICTIONARY_SAMPLE_POSTS; i < corpus.size(); i++){
+			plain.push_back(corpus.at(i));
+		}
+		int64_t plain_bytes = heap_bytes - heap_at_start;
+		z_stream deflater;
+		std::memset(&deflater, 0, sizeof(deflater));
+		deflateInit2(&deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+		std::string buffer;
+		heap_at_start = heap_bytes;
+		for(int i = DICTIONARY_SAMPLE_POSTS; i < corpus.size(); i++){
+			deflateReset(&deflater);
+			buffer.resize(deflateBound(&deflater, corpus.at(i).size()));
+			deflater.next_in = (Bytef*)corpus.at(i).data();
+			deflater.avail_in = corpus.at(i).size();
+			deflater.next_out = (Bytef*)&buffer[0];
+			deflater.avail_out = buffer.size();
+			deflate(&deflater, Z_FINISH);
+			alone.push_back(buffer.substr(0, deflater.total_out));
+		}
+		int64_t alone_bytes = heap_bytes - heap_at_start;
+		deflateEnd(&deflater);
+		heap_at_start = heap_bytes;
+		for(int i = DICTIONARY_SAMPLE_POSTS; i < corpus.size(); i++){
+			compressed.push_back(stored.at(i));
+		}
+		int64_t compressed_bytes = heap_bytes - heap_at_start;
+		double counted = corpus.size() - DICTIONARY_SAMPLE_POSTS;
+		std::printf("%-44s %12s %14.1f heap bytes/post plain, %.1f alone, %.1f with dictionary\n",
+				("post_body_memory/posts:" + std::to_string(posts)).c_str(), "",
+				plain_bytes / counted, alone_bytes / counted, compressed_bytes / counted);
+	}
+	post_compression.enabled = false;
+}
+
+// users coming and going: every round creates users that follow 10 others and post 40 posts of
+// 20 to 400 bytes, then half of the users alive are deleted; the process rss, the heap and the
+// bytes mapped by the slab pools after every round show whether deleted users' memory is reused
+// instead of the footprint creeping up round after round
+void bench_user_churn(int users_per_round, int rounds){
+	if(!name_filter.empty() && std::string("user_churn").find(name_filter) == std::string::npos){
+		return;
+	}
+	reset_store();
+	std::srand(7);
+	std::vector<std::string> alive;
+	int next_user = 0;
+	int64_t threads = 0;
+	int64_t rss_bytes = 0;
+	for(int round = 0; round < rounds; round++){
+		size_t first_new = alive.size();
+		for(int i = 0; i < users_per_round; i++){
+			alive.push_back("churn" + std::to_string(next_user++));
+			add_user(alive.back());
+		}
+		for(size_t i = first_new; i < alive.size(); i++){
+			for(int f = 0; f < 10; f++){
+				const std::string& followee = alive.at(std::rand() % alive.size());
+				if(followee != alive.at(i) && find_follower(users_db.at(alive.at(i))->following, followee) == -1){
+					users_db.at(alive.at(i))->following.push_back(followee);
+					users_db.at(followee)->followers.push_back(alive.at(i));
+					graph_follow(alive.at(i), followee);
+				}
+			}
+		}
+		for(int p = 0; p < 40; p++){
+			for(size_t i = first_new; i < alive.size(); i++){
+				std::vector<std::string> post_info = make_post(alive.at(i), 20 + std::rand() % 380, p);
+				fan_out_post(alive.at(i), post_info);
+			}
+		}
+		for(size_t i = alive.size(); i > 1; i--){
+			std::swap(alive.at(i - 1), alive.at(std::rand() % i));
+		}
+		std::vector<std::string> former_followers;
+		for(size_t i = alive.size() / 2; i < alive.size(); i++){
+			remove_user(alive.at(i), former_followers);
+		}
+		alive.resize(alive.size() / 2);
+		uint64_t user_blocks = 0, user_records = 0, post_blocks = 0, post_records = 0;
+		slab_usage(user_pool, user_blocks, user_records);
+		post_pool_usage(post_blocks, post_records);
+		read_process_usage(threads, rss_bytes);
+		std::printf("%-44s %12zu %14.1f MB rss, %.1f MB heap, %.1f MB slabs (%llu posts)\n",
+				("user_churn/round:" + std::to_string(round)).c_str(), alive.size(), rss_bytes / 1048576.0,
+				heap_bytes / 1048576.0, (user_blocks + post_blocks) * SLAB_BLOCK_BYTES / 1048576.0,
+				(unsigned long long)post_records);
+	}
+	reset_store();
+}
+
+// counting a post's hashtags and words in the trending sketches, as TimelineRequest does for every
+// post, with the clock moving a second every 10 posts so buckets expire along the way
+void bench_trending(int posts){
+	std::vector<std::string> corpus = search_corpus(posts);
+	reset_trending();
+	int64_t now = 1792404000;
+	run_bench("trending_record/posts:" + std::to_string(posts), [&](){
+		for(int i = 0; i < corpus.size(); i++){
+			record_trending(corpus.at(i), now + i / 10);
+		}
+		now += corpus.size() / 10;
+	}, posts);
+	run_bench("trending_top/count:20", [&](){
+		std::vector<trending_candidate> top;
+		uint64_t total = 0;
+		top_trending("1h", false, 20, now, top, total);
+	});
+}
+
+// counting a post by hour and weekday for its user and the server, as store_post does
+void bench_post_counters(){
+	post_counters counters;
+	post_counters all;
+	int64_t time = 1792404000;
+	run_bench("post_counters", [&](){
+		count_post(counters, time);
+		count_post(all, time);
+		time += 61;
+	});
+}
+
+// a follow graph of synthetic users stored as the followers and following vectors tsd keeps and as
+// the bitmaps of follow_graph.h, compared on memory per edge and on the queries of MutualFollows
+// and CommonFollows, the vectors answer them with the scans they allow
+// every user follows 10 others, user k is followed about as often as 1 / (k + 1) so user1 has a
+// large share of all users as followers
+void bench_follow_graph(int users){
+	std::vector<std::string> names = {"graph_memory", "graph_mutual", "graph_follow_each_other", "graph_common"};
+	bool selected = false;
+	for(int i = 0; i < names.size(); i++){
+		selected = selected || names.at(i).find(name_filter) != std::string::npos || name_filter.find(names.at(i)) != std::string::npos;
+	}
+	if(!selected){
+		return;
+	}
+	reset_store();
+	std::vector<std::pair<uint32_t, uint32_t>> edges;
+	uint64_t state = 88172645463325252ULL;
+	for(uint32_t from = 0; from < users; from++){
+		for(int f = 0; f < 10; f++){
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			uint32_t to = (uint32_t)std::pow((double)users, (state % 1000000) / 1000000.0) - 1;
+			if(to != from){
+				edges.push_back(std::make_pair(from, to));
+			}
+		}
+	}
+	std::vector<std::string> usernames;
+	for(int i = 0; i < users; i++){
+		usernames.push_back("user" + std::to_string(i));
+	}
+
+	int64_t heap_before = heap_bytes;
+	std::vector<std::vector<std::string>> following(users);
+	std::vector<std::vector<std::string>> followers(users);
+	for(int i = 0; i < edges.size(); i++){
+		following.at(edges.at(i).first).push_back(usernames.at(edges.at(i).second));
+		followers.at(edges.at(i).second).push_back(usernames.at(edges.at(i).first));
+	}
+	int64_t vector_bytes = heap_bytes - heap_before;
+	heap_before = heap_bytes;
+	for(int i = 0; i < users; i++){
+		graph_id(usernames.at(i));
+	}
+	int64_t id_bytes = heap_bytes - heap_before;
+	for(int i = 0; i < edges.size(); i++){
+		graph_follow(usernames.at(edges.at(i).first), usernames.at(edges.at(i).second));
+	}
+	int64_t graph_bytes = heap_bytes - heap_before;
+	if(name_filter.empty() || std::string("graph_memory").find(name_filter) != std::string::npos){
+		std::printf("%-44s %12s %14.1f bytes/edge with vectors\n", ("graph_memory/users:" + std::to_string(users)).c_str(),
+				"", (double)vector_bytes / edges.size());
+		std::printf("%-44s %12s %14.1f bytes/edge with bitmaps (%.1f of it for the user ids)\n",
+				("graph_memory/users:" + std::to_string(users)).c_str(), "",
+				(double)graph_bytes / edges.size(), (double)id_bytes / edges.size());
+	}
+
+	// a typical user with a few followers, and the two most followed users
+	std::string typical = usernames.at(users / 2);
+	std::string popular = usernames.at(1);
+	std::string second = usernames.at(2);
+	std::vector<std::pair<std::string, std::string>> cases = {{"typical", typical}, {"popular", popular}};
+	for(int c = 0; c < cases.size(); c++){
+		uint32_t id = graph_id(cases.at(c).second);
+		uint32_t index = id;
+		run_bench("graph_mutual/vectors/" + cases.at(c).first, [&](){
+			std::vector<std::string> mutual;
+			for(int i = 0; i < following.at(index).size(); i++){
+				if(find_follower(followers.at(index), following.at(index).at(i)) != -1){
+					mutual.push_back(following.at(index).at(i));
+				}
+			}
+		});
+		run_bench("graph_mutual/bitmaps/" + cases.at(c).first, [&](){
+			set_intersection(social_graph.following.at(id), social_graph.followers.at(id));
+		});
+	}
+
+	// whether the popular user and a typical user follow each other, the answers are summed so
+	// the lookups can't be optimized away
+	uint32_t popular_id = graph_id(popular);
+	uint64_t answers = 0;
+	run_bench("graph_follow_each_other/vectors", [&](){
+		answers += find_follower(following.at(popular_id), typical) != -1 && find_follower(followers.at(popular_id), typical) != -1;
+	});
+	uint32_t typical_id = graph_id(typical);
+	run_bench("graph_follow_each_other/bitmaps", [&](){
+		answers += set_contains(social_graph.following.at(popular_id), typical_id) && set_contains(social_graph.followers.at(popular_id), typical_id);
+	});
+
+	// followers the two most followed users have in common, the vectors are sorted copies
+	uint32_t second_id = graph_id(second);
+	run_bench("graph_common/vectors/followers", [&](){
+		std::vector<std::string> a = followers.at(popular_id);
+		std::vector<std::string> b = followers.at(second_id);
+		std::sort(a.begin(), a.end());
+		std::sort(b.begin(), b.end());
+		std::vector<std::string> common;
+		std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(common));
+	});
+	run_bench("graph_common/bitmaps/followers", [&](){
+		set_intersection(social_graph.followers.at(popular_id), social_graph.followers.at(second_id));
+	});
+	clear_follow_graph();
+}
+
+// SuggestFollows: users follow 20 others picked the way bench_follow_graph picks them, the
+// measured user follows follows others, computed from the graph and answered from the cache
+void bench_suggest(int users, int follows){
+	std::string prefix = "suggest/follows:" + std::to_string(follows);
+	if(prefix.find(name_filter) == std::string::npos && name_filter.find("suggest") == std::string::npos){
+		return;
+	}
+	reset_store();
+	for(int i = 0; i < users; i++){
+		add_user("user" + std::to_string(i));
+		graph_id("user" + std::to_string(i));
+	}
+	uint64_t state = 88172645463325252ULL;
+	for(int from = 0; from < users; from++){
+		int count = from == 0 ? follows : 20;
+		for(int f = 0; f < count; f++){
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			uint32_t to = (uint32_t)std::pow((double)users, (state % 1000000) / 1000000.0) - 1;
+			if(from == 0){
+				// spread the measured user's follows evenly so they aren't all popular users
+				to = state % users;
+			}
+			graph_follow("user" + std::to_string(from), "user" + std::to_string(to));
+		}
+	}
+	uint64_t found = 0;
+	run_bench(prefix + "/compute", [&](){
+		found += compute_suggestions(0).size();
+	});
+	run_bench(prefix + "/cached", [&](){
+		found += suggest_follows("user0", 10).size();
+	});
+}
+
+// ListRequest: copy the lists under the lock and build every message of the response
+void bench_list(int users){
+	reset_store();
+	for(int i = 0; i < users; i++){
+		add_user("user" + std::to_string(i));
+	}
+	// the requesting user is followed by a tenth of all users
+	for(int i = 1; i < users / 10; i++){
+		add_edge("user" + std::to_string(i), "user0");
+	}
+	counting_writer writer;
+	run_bench("list/users:" + std::to_string(users), [&](){
+		std::vector<std::string> user_followers = users_db.at("user0")->followers;
+		std::vector<std::string> all_users_copy = all_users;
+		write_user_list(user_followers, all_users_copy, &writer);
+	});
+}
+
+// restore_server(): replay a generated log, reported per log line
+void bench_restore(int users){
+	std::vector<std::string> log;
+	for(int i = 0; i < users; i++){
+		log.push_back("INITIALIZE user" + std::to_string(i));
+	}
+	for(int i = 0; i < users; i++){
+		for(int j = 1; j <= 10; j++){
+			log.push_back("FOLLOW user" + std::to_string(i) + "|user" + std::to_string((i + j * 7) % users));
+		}
+	}
+	for(int round = 0; round < 5; round++){
+		for(int i = 0; i < users; i++){
+			log.push_back("POST user" + std::to_string(i) + "|Mon Oct 19 10:00:00 2026|post number " + std::to_string(round));
+		}
+	}
+	run_bench("restore_line/users:" + std::to_string(users), [&](){
+		timer_pause();
+		reset_store();
+		std::vector<std::string> initialized_users;
+		timer_resume();
+		for(int i = 0; i < log.size(); i++){
+			apply_log_line(log.at(i), initialized_users);
+		}
+	}, log.size());
+}
+
+int main(int argc, char** argv){
+	int opt = 0;
+	while((opt = getopt(argc, argv, "f:t:")) != -1){
+		switch(opt){
+			case 'f': name_filter = optarg; break;
+			case 't': min_time_ms = std::atoi(optarg); break;
+			default:
+				std::cerr << "usage: bench [-f name filter] [-t min ms per benchmark]\n";
+				return 1;
+		}
+	}
+	std::printf("%-44s %12s %14s %12s\n", "benchmark", "ops", "ns/op", "allocs/op");
+
+	int follower_counts[] = {1, 10, 100, 1000};
+	int post_sizes[] = {64, 1024};
+	for(int followers : follower_counts){
+		for(int post_size : post_sizes){
+			bench_fan_out(followers, post_size);
+		}
+	}
+	for(int post_size : post_sizes){
+		bench_timeline_update(post_size);
+	}
+	int followee_posts[] = {20, 200, 2000};
+	for(int posts : followee_posts){
+		bench_follow_backfill(posts);
+	}
+	int newest_counts[] = {20, 200, 2000};
+	for(int count : newest_counts){
+		bench_newest_posts(count);
+	}
+	int page_followees[] = {10, 100, 1000};
+	for(int followees : page_followees){
+		bench_timeline_page(followees);
+	}
+	int search_posts_counts[] = {10000, 100000};
+	for(int posts : search_posts_counts){
+		bench_search_build(posts);
+	}
+	bench_trending(10000);
+	bench_post_body(100000);
+	bench_user_churn(4000, 12);
+	bench_post_counters();
+	bench_follow_graph(1000000);
+	int suggest_follows_counts[] = {20, 2000};
+	for(int follows : suggest_follows_counts){
+		bench_suggest(100000, follows);
+	}
+	// 100000 posts from 1000 users, so most of every user's posts are in the segments
+	reset_store();
+	std::vector<std::string> corpus = search_corpus(100000);
+	for(int i = 0; i < 1000; i++){
+		add_user("user" + std::to_string(i));
+	}
+	for(int i = 0; i < corpus.size(); i++){
+		std::vector<std::string> post_info = make_post("user" + std::to_string(i % 1000), 0, i);
+		post_info.at(2) = corpus.at(i);
+		store_post(post_info.at(0), post_info);
+	}
+	bench_search_query("common_word", "word0");
+	bench_search_query("rare_word", "word3000");
+	bench_search_query("hashtag", "#tag8");
+	bench_search_query("two_words", "word5 word50");
+	bench_search_query("no_match", "word3000 word3001 word3002");
+	int user_counts[] = {100, 1000, 10000};
+	for(int users : user_counts){
+		bench_list(users);
+	}
+	int restore_users[] = {1000, 10000};
+	for(int users : restore_users){
+		bench_restore(users);
+	}
+	reset_store();
+	close_post_segments();
+	return 0;
+}
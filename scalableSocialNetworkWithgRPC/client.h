@@ -97,6 +97,9 @@ void IClient::displayTitle() const
     std::cout << " UNFOLLOW <username>\n";
     std::cout << " LIST\n";
     std::cout << " TIMELINE\n";
+    std::cout << " HISTORY (older posts, repeat for the next page)\n";
+    std::cout << " SEARCH <words or #hashtags> (repeat for the next page)\n";
+    std::cout << " SUGGEST (who to follow)\n";
     std::cout << "=====================================\n";
 }
 
@@ -118,7 +121,7 @@ std::string IClient::getCommand() const
 			input = cmd + " " + argument;
 		} else {
 			toUpperCase(input);
-			if (input != "LIST" && input != "TIMELINE") {
+			if (input != "LIST" && input != "TIMELINE" && input != "HISTORY" && input != "SUGGEST") {
 				std::cout << "Invalid Command\n";
 				continue;
 			}
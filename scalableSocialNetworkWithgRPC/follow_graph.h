@@ -0,0 +1,360 @@
+#ifndef FOLLOW_GRAPH_H
+#define FOLLOW_GRAPH_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+
+// the follow graph as compressed bitmaps over dense user ids, kept next to the followers and
+// following vectors of every user (user_store.h) and used by the MutualFollows and CommonFollows
+// rpcs in tsd, which would need a linear scan of the vectors for every user they look at
+// a set of ids is a sorted array while it is small, past SMALL_SET_MAX it is split the way roaring
+// bitmaps are: one container per 65536 ids (the high 16 bits of an id), a container holds the low
+// 16 bits as a sorted array up to ARRAY_CONTAINER_MAX ids and as 65536 bits above that
+// a user's own follow of themselves isn't in the graph
+
+// sets with at most this many ids are a sorted array of ids
+const int SMALL_SET_MAX = 256;
+
+// containers with more ids than this are bitmaps
+const int ARRAY_CONTAINER_MAX = 4096;
+const int CONTAINER_WORDS = 65536 / 64;
+
+// most usernames a MutualFollows or CommonFollows reply lists
+const int MAX_GRAPH_USERS = 1000;
+
+struct id_container {
+	uint16_t key;			// high 16 bits of every id in the container
+	uint32_t count = 0;
+	std::vector<uint16_t> array;	// sorted low bits while count <= ARRAY_CONTAINER_MAX
+	std::vector<uint64_t> bits;		// CONTAINER_WORDS words otherwise
+};
+
+struct id_set {
+	std::vector<uint32_t> small;
+	std::vector<id_container> containers;	// sorted by key, used once the set outgrew small
+	uint32_t count = 0;
+};
+
+struct follow_graph {
+	std::unordered_map<std::string, uint32_t> ids;
+	std::vector<std::string> names;
+	std::vector<id_set> following;
+	std::vector<id_set> followers;
+};
+
+follow_graph social_graph;
+
+// helper function that returns the container of a set with key, nullptr if there is none
+const id_container* find_container(const id_set& set, uint16_t key){
+	auto found = std::lower_bound(set.containers.begin(), set.containers.end(), key,
+			[](const id_container& container, uint16_t k){ return container.key < k; });
+	if(found == set.containers.end() || found->key != key){
+		return nullptr;
+	}
+	return &*found;
+}
+
+bool container_contains(const id_container& container, uint16_t low){
+	if(!container.bits.empty()){
+		return (container.bits[low >> 6] >> (low & 63)) & 1;
+	}
+	return std::binary_search(container.array.begin(), container.array.end(), low);
+}
+
+bool set_contains(const id_set& set, uint32_t id){
+	if(set.containers.empty()){
+		return std::binary_search(set.small.begin(), set.small.end(), id);
+	}
+	const id_container* container = find_container(set, id >> 16);
+	return container != nullptr && container_contains(*container, id & 0xffff);
+}
+
+// helper function that adds the low bits of an id to a container, the id must not be in it
+void container_add(id_container& container, uint16_t low){
+	container.count++;
+	if(!container.bits.empty()){
+		container.bits[low >> 6] |= 1ULL << (low & 63);
+		return;
+	}
+	container.array.insert(std::lower_bound(container.array.begin(), container.array.end(), low), low);
+	if(container.array.size() > ARRAY_CONTAINER_MAX){
+		container.bits.assign(CONTAINER_WORDS, 0);
+		for(int i = 0; i < container.array.size(); i++){
+			container.bits[container.array[i] >> 6] |= 1ULL << (container.array[i] & 63);
+		}
+		std::vector<uint16_t>().swap(container.array);
+	}
+}
+
+// function that adds an id to a set, returns false if it was already in it
+bool set_add(id_set& set, uint32_t id){
+	if(set_contains(set, id)){
+		return false;
+	}
+	set.count++;
+	if(set.containers.empty()){
+		set.small.insert(std::lower_bound(set.small.begin(), set.small.end(), id), id);
+		if(set.small.size() <= SMALL_SET_MAX){
+			return true;
+		}
+		// move the ids to containers, they are sorted so each container is filled in order
+		for(int i = 0; i < set.small.size(); i++){
+			if(set.containers.empty() || set.containers.back().key != set.small[i] >> 16){
+				id_container container;
+				container.key = set.small[i] >> 16;
+				set.containers.push_back(container);
+			}
+			set.containers.back().array.push_back(set.small[i] & 0xffff);
+			set.containers.back().count++;
+		}
+		std::vector<uint32_t>().swap(set.small);
+		return true;
+	}
+	uint16_t key = id >> 16;
+	auto found = std::lower_bound(set.containers.begin(), set.containers.end(), key,
+			[](const id_container& container, uint16_t k){ return container.key < k; });
+	if(found == set.containers.end() || found->key != key){
+		id_container container;
+		container.key = key;
+		found = set.containers.insert(found, container);
+	}
+	container_add(*found, id & 0xffff);
+	return true;
+}
+
+// function that removes an id from a set, returns false if it wasn't in it
+bool set_remove(id_set& set, uint32_t id){
+	if(!set_contains(set, id)){
+		return false;
+	}
+	set.count--;
+	if(set.containers.empty()){
+		set.small.erase(std::lower_bound(set.small.begin(), set.small.end(), id));
+		return true;
+	}
+	uint16_t key = id >> 16;
+	uint16_t low = id & 0xffff;
+	auto found = std::lower_bound(set.containers.begin(), set.containers.end(), key,
+			[](const id_container& container, uint16_t k){ return container.key < k; });
+	id_container& container = *found;
+	container.count--;
+	if(!container.bits.empty()){
+		container.bits[low >> 6] &= ~(1ULL << (low & 63));
+		// back to an array once it fits in one
+		if(container.count <= ARRAY_CONTAINER_MAX){
+			for(int word = 0; word < CONTAINER_WORDS; word++){
+				for(uint64_t bits = container.bits[word]; bits != 0; bits &= bits - 1){
+					container.array.push_back(word * 64 + __builtin_ctzll(bits));
+				}
+			}
+			std::vector<uint64_t>().swap(container.bits);
+		}
+	}
+	else{
+		container.array.erase(std::lower_bound(container.array.begin(), container.array.end(), low));
+	}
+	if(container.count == 0){
+		set.containers.erase(found);
+	}
+	return true;
+}
+
+// helper function that appends the ids of a container to ids
+void container_ids(const id_container& container, std::vector<uint32_t>& ids){
+	uint32_t high = (uint32_t)container.key << 16;
+	if(!container.bits.empty()){
+		for(int word = 0; word < CONTAINER_WORDS; word++){
+			for(uint64_t bits = container.bits[word]; bits != 0; bits &= bits - 1){
+				ids.push_back(high | (word * 64 + __builtin_ctzll(bits)));
+			}
+		}
+		return;
+	}
+	for(int i = 0; i < container.array.size(); i++){
+		ids.push_back(high | container.array[i]);
+	}
+}
+
+// helper function that appends the ids in both containers (with the same key) to ids
+void intersect_containers(const id_container& a, const id_container& b, std::vector<uint32_t>& ids){
+	uint32_t high = (uint32_t)a.key << 16;
+	if(!a.bits.empty() && !b.bits.empty()){
+		// word by word, the compiler vectorizes the and
+		uint64_t both[CONTAINER_WORDS];
+		for(int word = 0; word < CONTAINER_WORDS; word++){
+			both[word] = a.bits[word] & b.bits[word];
+		}
+		for(int word = 0; word < CONTAINER_WORDS; word++){
+			for(uint64_t bits = both[word]; bits != 0; bits &= bits - 1){
+				ids.push_back(high | (word * 64 + __builtin_ctzll(bits)));
+			}
+		}
+	}
+	else if(!a.bits.empty() || !b.bits.empty()){
+		const id_container& array = a.bits.empty() ? a : b;
+		const id_container& bitmap = a.bits.empty() ? b : a;
+		for(int i = 0; i < array.array.size(); i++){
+			uint16_t low = array.array[i];
+			if((bitmap.bits[low >> 6] >> (low & 63)) & 1){
+				ids.push_back(high | low);
+			}
+		}
+	}
+	else{
+		int i = 0;
+		int j = 0;
+		while(i < a.array.size() && j < b.array.size()){
+			if(a.array[i] < b.array[j]){
+				i++;
+			}
+			else if(b.array[j] < a.array[i]){
+				j++;
+			}
+			else{
+				ids.push_back(high | a.array[i]);
+				i++;
+				j++;
+			}
+		}
+	}
+}
+
+// function that calls visit with every id of a set, in order, without copying them out
+template<typename Visitor>
+void for_each_id(const id_set& set, Visitor visit){
+	if(set.containers.empty()){
+		for(int i = 0; i < set.small.size(); i++){
+			visit(set.small[i]);
+		}
+		return;
+	}
+	for(int c = 0; c < set.containers.size(); c++){
+		const id_container& container = set.containers[c];
+		uint32_t high = (uint32_t)container.key << 16;
+		if(!container.bits.empty()){
+			for(int word = 0; word < CONTAINER_WORDS; word++){
+				for(uint64_t bits = container.bits[word]; bits != 0; bits &= bits - 1){
+					visit(high | (word * 64 + __builtin_ctzll(bits)));
+				}
+			}
+		}
+		else{
+			for(int i = 0; i < container.array.size(); i++){
+				visit(high | container.array[i]);
+			}
+		}
+	}
+}
+
+// function that returns every id of a set, sorted
+std::vector<uint32_t> set_ids(const id_set& set){
+	if(set.containers.empty()){
+		return set.small;
+	}
+	std::vector<uint32_t> ids;
+	for(int i = 0; i < set.containers.size(); i++){
+		container_ids(set.containers[i], ids);
+	}
+	return ids;
+}
+
+// function that returns the ids in both sets, sorted
+std::vector<uint32_t> set_intersection(const id_set& a, const id_set& b){
+	std::vector<uint32_t> ids;
+	if(a.containers.empty() || b.containers.empty()){
+		// look every id of the smaller set up in the other one
+		const id_set& smaller = a.count <= b.count ? a : b;
+		const id_set& larger = a.count <= b.count ? b : a;
+		std::vector<uint32_t> candidates = set_ids(smaller);
+		for(int i = 0; i < candidates.size(); i++){
+			if(set_contains(larger, candidates[i])){
+				ids.push_back(candidates[i]);
+			}
+		}
+		return ids;
+	}
+	int i = 0;
+	int j = 0;
+	while(i < a.containers.size() && j < b.containers.size()){
+		if(a.containers[i].key < b.containers[j].key){
+			i++;
+		}
+		else if(b.containers[j].key < a.containers[i].key){
+			j++;
+		}
+		else{
+			intersect_containers(a.containers[i], b.containers[j], ids);
+			i++;
+			j++;
+		}
+	}
+	return ids;
+}
+
+// function that returns the ids in every one of sets, sorted
+// the two smallest sets are intersected first and the result is looked up in the others
+std::vector<uint32_t> sets_intersection(std::vector<const id_set*> sets){
+	if(sets.empty()){
+		return std::vector<uint32_t>();
+	}
+	std::sort(sets.begin(), sets.end(), [](const id_set* a, const id_set* b){ return a->count < b->count; });
+	if(sets.size() == 1){
+		return set_ids(*sets[0]);
+	}
+	std::vector<uint32_t> ids = set_intersection(*sets[0], *sets[1]);
+	for(int s = 2; s < sets.size() && !ids.empty(); s++){
+		std::vector<uint32_t> remaining;
+		for(int i = 0; i < ids.size(); i++){
+			if(set_contains(*sets[s], ids[i])){
+				remaining.push_back(ids[i]);
+			}
+		}
+		ids.swap(remaining);
+	}
+	return ids;
+}
+
+// function that returns the dense id of a user, a user seen for the first time gets the next id
+uint32_t graph_id(const std::string& username){
+	auto found = social_graph.ids.find(username);
+	if(found != social_graph.ids.end()){
+		return found->second;
+	}
+	uint32_t id = social_graph.names.size();
+	social_graph.ids.insert(std::make_pair(username, id));
+	social_graph.names.push_back(username);
+	social_graph.following.push_back(id_set());
+	social_graph.followers.push_back(id_set());
+	return id;
+}
+
+// function that records that follower follows followee, called wherever the vectors change
+void graph_follow(const std::string& follower, const std::string& followee){
+	if(follower == followee){
+		return;
+	}
+	uint32_t from = graph_id(follower);
+	uint32_t to = graph_id(followee);
+	set_add(social_graph.following.at(from), to);
+	set_add(social_graph.followers.at(to), from);
+}
+
+void graph_unfollow(const std::string& follower, const std::string& followee){
+	auto from = social_graph.ids.find(follower);
+	auto to = social_graph.ids.find(followee);
+	if(from == social_graph.ids.end() || to == social_graph.ids.end()){
+		return;
+	}
+	set_remove(social_graph.following.at(from->second), to->second);
+	set_remove(social_graph.followers.at(to->second), from->second);
+}
+
+// function that empties the graph
+void clear_follow_graph(){
+	social_graph = follow_graph();
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <cstdint>
+#include <cstring>
+
+// log-linear (HDR style) histogram used to record latencies in nanoseconds
+// values below 2^SUB_BUCKET_BITS are stored exactly, larger values are grouped
+// into 2^SUB_BUCKET_BITS buckets per power of two, so every recorded value is
+// within ~3% of the value reported for its bucket
+class latency_histogram {
+	public:
+		static const int SUB_BUCKET_BITS = 5;
+		static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+		static const int NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+		latency_histogram() { reset(); }
+
+		void reset() {
+			std::memset(counts, 0, sizeof(counts));
+			total = 0;
+			sum = 0;
+			max_value = 0;
+		}
+
+		// add a single value to the histogram
+		void record(uint64_t value) {
+			counts[index_of(value)]++;
+			total++;
+			sum += value;
+			if(value > max_value){
+				max_value = value;
+			}
+		}
+
+		// add every value from another histogram into this one
+		void merge(const latency_histogram& other) {
+			for(int i = 0; i < NUM_BUCKETS; i++){
+				counts[i] += other.counts[i];
+			}
+			total += other.total;
+			sum += other.sum;
+			if(other.max_value > max_value){
+				max_value = other.max_value;
+			}
+		}
+
+		uint64_t count() const { return total; }
+		uint64_t max() const { return max_value; }
+		uint64_t mean() const { return total == 0 ? 0 : sum / total; }
+
+		// returns the value at the given percentile (0-100)
+		// the upper edge of the bucket is reported so percentiles never under-report
+		uint64_t percentile(double p) const {
+			if(total == 0){
+				return 0;
+			}
+			uint64_t rank = (uint64_t)((p / 100.0) * total + 0.5);
+			if(rank == 0){
+				rank = 1;
+			}
+			if(rank > total){
+				rank = total;
+			}
+			uint64_t seen = 0;
+			for(int i = 0; i < NUM_BUCKETS; i++){
+				seen += counts[i];
+				if(seen >= rank){
+					uint64_t upper = highest_equivalent(i);
+					return upper < max_value ? upper : max_value;
+				}
+			}
+			return max_value;
+		}
+
+		// adds values that were counted somewhere else, used to combine per thread histograms
+		void add_bucket(int index, uint64_t n) {
+			counts[index] += n;
+			total += n;
+		}
+		void add_summary(uint64_t value_sum, uint64_t value_max) {
+			sum += value_sum;
+			if(value_max > max_value){
+				max_value = value_max;
+			}
+		}
+
+		// number of buckets and their contents, used when exporting the histogram
+		uint64_t bucket_count(int index) const { return counts[index]; }
+
+		// the bucket a value is counted in and the largest value counted in a bucket
+		static int index_of(uint64_t value) {
+			if(value < (uint64_t)SUB_BUCKETS){
+				return (int)value;
+			}
+			int exponent = 63 - __builtin_clzll(value);
+			int shift = exponent - SUB_BUCKET_BITS;
+			int sub = (int)(value >> shift) - SUB_BUCKETS;
+			return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+		}
+		static uint64_t highest_equivalent(int index) {
+			if(index < SUB_BUCKETS){
+				return index;
+			}
+			int exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+			uint64_t sub = index % SUB_BUCKETS;
+			int shift = exponent - SUB_BUCKET_BITS;
+			uint64_t low = (SUB_BUCKETS + sub) << shift;
+			return low + ((uint64_t)1 << shift) - 1;
+		}
+
+	private:
+		uint64_t counts[NUM_BUCKETS];
+		uint64_t total;
+		uint64_t sum;
+		uint64_t max_value;
+};
+
+#endif
@@ -0,0 +1,347 @@
+#ifndef PEER_FANOUT_H
+#define PEER_FANOUT_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include <unistd.h>
+#include <grpc++/grpc++.h>
+
+#include "TNSService.grpc.pb.h"
+#include "user_store.h"
+#include "stats.h"
+
+// follows between masters (several tsd masters behind the routers)
+// the routers answer every master's heartbeat with the online masters; following a user that isn't
+// on this server asks the other masters with FindUser which one the user registered on, then tells
+// that master with RemoteFollow, which keeps the follower with the user (user::remote_followers)
+// and answers with the user's newest posts; this server keeps the followed user as a remote user
+// (user::home) holding those posts, so timelines, backfills, HISTORY and SEARCH treat them like any
+// other user
+// a post of a user with followers on other masters is queued once for each of those masters, not
+// once per follower; a thread per master writes its queue into a ForwardPosts stream that stays
+// open, up to PEER_BATCH_POSTS posts per message and without waiting for the receiver between
+// messages, and the receiving master fans every post out to its own followers of the user
+// the posts of a link are numbered so the receiver drops the ones sent again after a stream broke,
+// posts written into a stream that broke before the receiver read them are lost, and while a master
+// can't be reached the oldest posts queued for it are dropped past MAX_PEER_QUEUE
+
+const int PEER_BATCH_POSTS = 256;
+const size_t MAX_PEER_QUEUE = 100000;
+const int PEER_CALL_MS = 1000;
+
+// posts on their way to one master, the first one queued has number first_seq
+struct peer_link {
+	std::string address;
+	std::mutex link_mutex;
+	std::condition_variable queued;
+	std::deque<TNSService::post_info> posts;
+	uint64_t first_seq = 0;
+	// set once a draining server wrote out the queue and the other master read all of it
+	bool flushed = false;
+};
+
+struct peer_fanout_state {
+	// this master as the routers list it (<ip>:<port>)
+	std::string self = "";
+	// tells the links of different runs of this master apart
+	uint64_t link_id = 0;
+	// the other online masters, the stubs of the masters talked to and the links to them
+	std::mutex peers_mutex;
+	std::vector<std::string> masters;
+	std::unordered_map<std::string, std::shared_ptr<TNSService::user_services::Stub>> stubs;
+	std::unordered_map<std::string, peer_link*> links;
+	// the link id and the number of the next post expected from every master that sends posts
+	// here, guarded by users_db_mutex
+	std::unordered_map<std::string, std::pair<uint64_t, uint64_t>> received;
+	// posts queued for other masters, batches written, posts received from other masters, posts
+	// received twice and posts dropped from full queues
+	std::atomic<uint64_t> forwarded;
+	std::atomic<uint64_t> batches;
+	std::atomic<uint64_t> delivered;
+	std::atomic<uint64_t> duplicates;
+	std::atomic<uint64_t> dropped;
+	// set while the server drains, the links close their streams once their queues are empty
+	std::atomic<bool> closing;
+
+	peer_fanout_state() : forwarded(0), batches(0), delivered(0), duplicates(0), dropped(0), closing(false) {
+		link_id = stats_now_ns() ^ ((uint64_t)getpid() << 32) ^ (uint64_t)time(nullptr);
+	}
+};
+
+peer_fanout_state peer_fanout;
+
+int peer_batch_size = register_metric("peer_batch_posts", false);
+
+// function that keeps the masters from a router's answer, all but this one
+void set_peer_masters(const google::protobuf::RepeatedPtrField<std::string>& masters){
+	std::lock_guard<std::mutex> lock(peer_fanout.peers_mutex);
+	peer_fanout.masters.clear();
+	for(int i = 0; i < masters.size(); i++){
+		if(masters.Get(i) != peer_fanout.self){
+			peer_fanout.masters.push_back(masters.Get(i));
+		}
+	}
+}
+
+// function that returns the stub of a master, made the first time it is asked for
+std::shared_ptr<TNSService::user_services::Stub> peer_stub(const std::string& address){
+	std::lock_guard<std::mutex> lock(peer_fanout.peers_mutex);
+	std::shared_ptr<TNSService::user_services::Stub>& stub = peer_fanout.stubs[address];
+	if(stub == nullptr){
+		stub = std::shared_ptr<TNSService::user_services::Stub>(TNSService::user_services::NewStub(
+				grpc::CreateChannel(address, grpc::InsecureChannelCredentials())));
+	}
+	return stub;
+}
+
+// helper function that sets a deadline PEER_CALL_MS from now on a call to another master
+void set_peer_deadline(grpc::ClientContext& context){
+	context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(PEER_CALL_MS));
+}
+
+// function that asks the other masters for the one username registered on
+// returns false when none of them has the user
+bool find_user_home(const std::string& username, std::string& home){
+	std::vector<std::string> masters;
+	{
+		std::lock_guard<std::mutex> lock(peer_fanout.peers_mutex);
+		masters = peer_fanout.masters;
+	}
+	TNSService::current_user request;
+	request.set_username(username);
+	for(int i = 0; i < masters.size(); i++){
+		grpc::ClientContext context;
+		set_peer_deadline(context);
+		TNSService::server_status reply;
+		grpc::Status status = peer_stub(masters.at(i))->FindUser(&context, request, &reply);
+		if(status.ok() && reply.s_status() == TNSService::server_status_IStatus_SUCCESS){
+			home = masters.at(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+// function that follows (or unfollows) a user registered on another master for a user of this one
+// when home is empty the master is looked up first and home is set to it, reply has the
+// followee's newest posts after a follow
+// returns SUCCESS, FAILURE_NOT_EXISTS when no master has the user and FAILURE_UNKNOWN when their
+// master didn't answer
+TNSService::server_status_IStatus remote_follow(const std::string& follower, const std::string& followee, bool follow,
+		std::string& home, TNSService::remote_follow_reply& reply){
+	if(home == "" && !find_user_home(followee, home)){
+		return TNSService::server_status_IStatus_FAILURE_NOT_EXISTS;
+	}
+	TNSService::remote_follow_request request;
+	request.set_follower(follower);
+	request.set_followee(followee);
+	request.set_follower_server(peer_fanout.self);
+	request.set_follow(follow);
+	grpc::ClientContext context;
+	set_peer_deadline(context);
+	grpc::Status status = peer_stub(home)->RemoteFollow(&context, request, &reply);
+	if(!status.ok()){
+		return TNSService::server_status_IStatus_FAILURE_UNKNOWN;
+	}
+	return reply.status().s_status();
+}
+
+// function that tells server, a master with followers of a user registered here, that the user was
+// deleted at time deleted, returns false if it didn't answer
+bool remote_delete(const std::string& username, uint64_t deleted, const std::string& server){
+	TNSService::remote_follow_request request;
+	request.set_followee(username);
+	request.set_follower_server(peer_fanout.self);
+	request.set_deleted(deleted);
+	grpc::ClientContext context;
+	set_peer_deadline(context);
+	TNSService::remote_follow_reply reply;
+	return peer_stub(server)->RemoteFollow(&context, request, &reply).ok();
+}
+
+// thread that writes the posts queued for a master into a ForwardPosts stream, the stream is
+// opened again a second after it breaks
+// while the server drains, a link whose queue is empty closes its stream, the close returns once
+// the other master read every post written, and the thread ends
+void run_peer_link(peer_link* link){
+	std::shared_ptr<TNSService::user_services::Stub> stub = peer_stub(link->address);
+	while(1){
+		grpc::ClientContext context;
+		TNSService::forward_reply reply;
+		std::unique_ptr<grpc::ClientWriter<TNSService::post_batch>> writer(stub->ForwardPosts(&context, &reply));
+		while(1){
+			TNSService::post_batch batch;
+			{
+				std::unique_lock<std::mutex> lock(link->link_mutex);
+				link->queued.wait(lock, [link]() { return !link->posts.empty() || peer_fanout.closing; });
+				if(link->posts.empty()){
+					break;
+				}
+				batch.set_first_seq(link->first_seq);
+				for(int i = 0; i < link->posts.size() && i < PEER_BATCH_POSTS; i++){
+					*batch.add_posts() = link->posts.at(i);
+				}
+			}
+			batch.set_origin(peer_fanout.self);
+			batch.set_link_id(peer_fanout.link_id);
+			if(!writer->Write(batch)){
+				break;
+			}
+			// the posts written leave the queue, unless a full queue dropped them meanwhile
+			{
+				std::lock_guard<std::mutex> lock(link->link_mutex);
+				uint64_t written = batch.first_seq() + batch.posts_size();
+				while(link->first_seq < written && !link->posts.empty()){
+					link->posts.pop_front();
+					link->first_seq++;
+				}
+			}
+			peer_fanout.batches++;
+			record_metric(peer_batch_size, batch.posts_size());
+		}
+		writer->WritesDone();
+		bool finished = writer->Finish().ok();
+		{
+			std::lock_guard<std::mutex> lock(link->link_mutex);
+			if(finished && peer_fanout.closing && link->posts.empty()){
+				link->flushed = true;
+				link->queued.notify_all();
+				return;
+			}
+		}
+		sleep(1);
+	}
+}
+
+// function that returns the link to a master, started the first time a post is queued for it
+peer_link* peer_link_of(const std::string& address){
+	std::lock_guard<std::mutex> lock(peer_fanout.peers_mutex);
+	peer_link*& link = peer_fanout.links[address];
+	if(link == nullptr){
+		// links are never freed, there is one per master
+		link = new peer_link();
+		link->address = address;
+		std::thread(run_peer_link, link).detach();
+	}
+	return link;
+}
+
+// function that queues a post, given as {username, time, content[, trace id]}, once for every
+// other master with followers of the posting user, the caller holds users_db_mutex
+void forward_post(const user* poster, const std::vector<std::string>& post_info){
+	for(auto& entry : poster->remote_followers){
+		peer_link* link = peer_link_of(entry.first);
+		std::lock_guard<std::mutex> lock(link->link_mutex);
+		link->posts.push_back(TNSService::post_info());
+		TNSService::post_info& post = link->posts.back();
+		post.set_username(post_info.at(0));
+		post.set_time(post_info.at(1));
+		post.set_content(post_info.at(2));
+		post.set_trace_id(trace_id_of(post_info));
+		if(link->posts.size() > MAX_PEER_QUEUE){
+			link->posts.pop_front();
+			link->first_seq++;
+			peer_fanout.dropped++;
+		}
+		peer_fanout.forwarded++;
+		link->queued.notify_one();
+	}
+}
+
+// function that returns the log line of a post from another master
+std::string post_log_line(const TNSService::post_info& post){
+	return post_log_line(post.username(), post.time(), post.content());
+}
+
+// function that fans the posts of a batch from another master out to the followers on this server
+// and adds the log line of every post to log_lines, the caller holds users_db_mutex
+// returns the number of timelines the posts were added to
+int deliver_post_batch(const TNSService::post_batch& batch, std::vector<std::string>& log_lines){
+	std::pair<uint64_t, uint64_t>& next = peer_fanout.received[batch.origin()];
+	if(next.first != batch.link_id()){
+		// the sending master started again, its posts are numbered from 0 again
+		next = std::make_pair(batch.link_id(), batch.first_seq());
+	}
+	int delivered = 0;
+	for(int i = 0; i < batch.posts_size(); i++){
+		uint64_t seq = batch.first_seq() + i;
+		if(seq < next.second){
+			peer_fanout.duplicates++;
+			continue;
+		}
+		next.second = seq + 1;
+		const TNSService::post_info& post = batch.posts(i);
+		// posts of users nobody here follows anymore are dropped, a user that registered here as
+		// well (anti_entropy.h) may have the post already
+		auto found = users_db.find(post.username());
+		if(found == users_db.end()){
+			continue;
+		}
+		if(found->second->home == "" && has_recent_post(found->second, post_digest_id(post.username(), post.time(), post.content()))){
+			peer_fanout.duplicates++;
+			continue;
+		}
+		std::vector<std::string> post_info;
+		post_info.push_back(post.username());
+		post_info.push_back(post.time());
+		post_info.push_back(post.content());
+		if(post.trace_id() != 0){
+			post_info.push_back(std::to_string(post.trace_id()));
+		}
+		delivered += fan_out_post(post.username(), post_info);
+		peer_fanout.delivered++;
+		log_lines.push_back(post_log_line(post));
+	}
+	return delivered;
+}
+
+// helper function that returns the links to every master
+std::vector<peer_link*> peer_links(){
+	std::vector<peer_link*> links;
+	std::lock_guard<std::mutex> lock(peer_fanout.peers_mutex);
+	for(auto& entry : peer_fanout.links){
+		links.push_back(entry.second);
+	}
+	return links;
+}
+
+// function that counts the posts waiting in the links to every master
+uint64_t peer_queue_posts(){
+	std::vector<peer_link*> links = peer_links();
+	uint64_t queued = 0;
+	for(int i = 0; i < links.size(); i++){
+		std::lock_guard<std::mutex> lock(links.at(i)->link_mutex);
+		queued += links.at(i)->posts.size();
+	}
+	return queued;
+}
+
+// function called by a draining server once no post is queued anymore, the links write out their
+// queues and close their streams, returns false if not every other master read its posts before
+// deadline_ns (stats_now_ns)
+bool flush_peer_links(uint64_t deadline_ns){
+	peer_fanout.closing = true;
+	std::vector<peer_link*> links = peer_links();
+	for(int i = 0; i < links.size(); i++){
+		std::unique_lock<std::mutex> lock(links.at(i)->link_mutex);
+		links.at(i)->queued.notify_all();
+		while(!links.at(i)->flushed){
+			if(stats_now_ns() >= deadline_ns){
+				return false;
+			}
+			links.at(i)->queued.wait_for(lock, std::chrono::milliseconds(100));
+		}
+	}
+	return true;
+}
+
+#endif
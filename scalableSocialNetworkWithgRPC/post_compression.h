@@ -0,0 +1,324 @@
+#ifndef POST_COMPRESSION_H
+#define POST_COMPRESSION_H
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <unordered_map>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <zlib.h>
+
+#include "stats.h"
+
+// dictionary compression of post bodies (tsd -o compress_posts=1)
+// posts are short and repeat the same words, hashtags and phrases, one at a time they hardly
+// compress, but deflate with a preset dictionary of text common in recent posts finds most of a
+// post in the dictionary; a body is compressed once when it is stored and stays compressed in the
+// user's posts, in every timeline it is fanned out to and in the post segments, it is only
+// decompressed when it is written to a client
+// the first dictionary is trained from the first DICTIONARY_SAMPLE_POSTS posts, a new one every
+// DICTIONARY_RETRAIN_POSTS posts from the newest ones; a body keeps the id of the dictionary it
+// was compressed with, so dictionaries are never freed and training stops after the last id
+// the newest dictionary is written next to the server log and loaded when the server starts, the
+// log replay compresses with it from the first post
+
+// deflate hashes the whole dictionary before every post, so its size is what compressing a post
+// costs, 8KB holds the common text of short posts
+const size_t POST_DICTIONARY_BYTES = 8 * 1024;
+const size_t DICTIONARY_SAMPLE_POSTS = 4000;
+const uint64_t DICTIONARY_RETRAIN_POSTS = 200000;
+const int MAX_POST_DICTIONARIES = 255;
+
+// a stored body starts with BODY_PLAIN followed by the body (when there is no dictionary yet or
+// compressing didn't make it smaller) or with BODY_COMPRESSED, the dictionary id, the length of
+// the body as a varint and the raw deflate stream
+const char BODY_PLAIN = 0;
+const char BODY_COMPRESSED = 1;
+
+struct post_compression_state {
+	bool enabled = false;
+	std::string dictionary_file = "";
+	// published once and never freed, so readers need no lock
+	std::atomic<const std::string*> dictionaries[MAX_POST_DICTIONARIES];
+	std::atomic<int> dictionary_count;
+	// the compressor and the training sample are used under users_db_mutex
+	z_stream deflater;
+	bool deflater_ready = false;
+	std::string scratch;
+	std::vector<std::string> sample;
+	uint64_t posts_since_training = 0;
+	// bodies compressed, and their bytes before and after
+	std::atomic<uint64_t> bodies;
+	std::atomic<uint64_t> raw_bytes;
+	std::atomic<uint64_t> stored_bytes;
+
+	post_compression_state() : dictionary_count(0), bodies(0), raw_bytes(0), stored_bytes(0) {
+		for(int i = 0; i < MAX_POST_DICTIONARIES; i++){
+			dictionaries[i] = nullptr;
+		}
+	}
+};
+
+post_compression_state post_compression;
+
+int post_decode_latency = register_metric("post_decode", true);
+
+// function that builds a dictionary of at most size bytes from sample posts
+// every 8 byte substring of the samples is counted, then the 64 byte pieces of the samples whose
+// substrings occur most often are taken in turn, a substring already taken counts no more; the
+// best pieces go at the end of the dictionary, deflate reaches them with the shortest distances
+std::string train_post_dictionary(const std::vector<std::string>& samples, size_t size){
+	const size_t GRAM = 8;
+	const size_t PIECE = 64;
+	std::unordered_map<uint64_t, uint32_t> counts;
+	for(size_t s = 0; s < samples.size(); s++){
+		const std::string& text = samples.at(s);
+		for(size_t i = 0; i + GRAM <= text.size(); i++){
+			uint64_t gram;
+			std::memcpy(&gram, text.data() + i, GRAM);
+			counts[gram]++;
+		}
+	}
+	// helper that scores a piece by the counts of its substrings, those seen once add nothing
+	auto score_of = [&](size_t s, size_t begin, size_t length){
+		uint64_t score = 0;
+		for(size_t i = begin; i + GRAM <= begin + length; i++){
+			uint64_t gram;
+			std::memcpy(&gram, samples.at(s).data() + i, GRAM);
+			uint32_t count = counts[gram];
+			score += count > 1 ? count : 0;
+		}
+		return score;
+	};
+	// pieces as score, sample and offset, a score only goes down as pieces are taken, so a piece
+	// whose score didn't change since it was pushed is the best one left
+	std::priority_queue<std::pair<uint64_t, std::pair<size_t, size_t>>> pieces;
+	for(size_t s = 0; s < samples.size(); s++){
+		for(size_t begin = 0; begin + GRAM <= samples.at(s).size(); begin += PIECE / 2){
+			size_t length = std::min(PIECE, samples.at(s).size() - begin);
+			pieces.push(std::make_pair(score_of(s, begin, length), std::make_pair(s, begin)));
+		}
+	}
+	std::vector<std::string> taken;
+	size_t taken_bytes = 0;
+	while(!pieces.empty() && taken_bytes < size){
+		std::pair<uint64_t, std::pair<size_t, size_t>> best = pieces.top();
+		pieces.pop();
+		size_t s = best.second.first;
+		size_t begin = best.second.second;
+		size_t length = std::min(PIECE, samples.at(s).size() - begin);
+		uint64_t score = score_of(s, begin, length);
+		if(score == 0){
+			// everything in it is in the dictionary already
+			continue;
+		}
+		if(!pieces.empty() && score < pieces.top().first){
+			pieces.push(std::make_pair(score, best.second));
+			continue;
+		}
+		length = std::min(length, size - taken_bytes);
+		taken.push_back(samples.at(s).substr(begin, length));
+		taken_bytes += length;
+		for(size_t i = begin; i + GRAM <= begin + length; i++){
+			uint64_t gram;
+			std::memcpy(&gram, samples.at(s).data() + i, GRAM);
+			counts[gram] = 0;
+		}
+	}
+	std::string dictionary;
+	dictionary.reserve(taken_bytes);
+	for(size_t i = taken.size(); i > 0; i--){
+		dictionary += taken.at(i - 1);
+	}
+	return dictionary;
+}
+
+// function that makes dictionary the one new bodies are compressed with
+// returns false when every dictionary id is used
+bool add_post_dictionary(const std::string& dictionary){
+	int id = post_compression.dictionary_count;
+	if(id >= MAX_POST_DICTIONARIES || dictionary.empty()){
+		return false;
+	}
+	post_compression.dictionaries[id] = new std::string(dictionary);
+	post_compression.dictionary_count = id + 1;
+	return true;
+}
+
+// function that writes the newest dictionary next to the server log, a file that is written
+// halfway is never read since it only replaces the old one once it is complete
+void save_post_dictionary(){
+	int count = post_compression.dictionary_count;
+	if(post_compression.dictionary_file == "" || count == 0){
+		return;
+	}
+	std::string temporary = post_compression.dictionary_file + ".tmp";
+	std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+	const std::string* dictionary = post_compression.dictionaries[count - 1];
+	file.write(dictionary->data(), dictionary->size());
+	file.close();
+	if(file){
+		std::rename(temporary.c_str(), post_compression.dictionary_file.c_str());
+	}
+}
+
+// function that turns on compression of post bodies, with the dictionary saved by the last run
+// in dictionary_file if there is one
+void enable_post_compression(const std::string& dictionary_file){
+	post_compression.enabled = true;
+	post_compression.dictionary_file = dictionary_file;
+	std::ifstream file(dictionary_file, std::ios::binary);
+	if(file.is_open()){
+		std::stringstream contents;
+		contents << file.rdbuf();
+		add_post_dictionary(contents.str().substr(0, POST_DICTIONARY_BYTES));
+	}
+	if(!post_compression.deflater_ready){
+		std::memset(&post_compression.deflater, 0, sizeof(post_compression.deflater));
+		deflateInit2(&post_compression.deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+		post_compression.deflater_ready = true;
+	}
+}
+
+// helper function that keeps body for the next dictionary and trains it once enough posts came,
+// the caller holds users_db_mutex
+void sample_post_body(const std::string& body){
+	// no dictionary is trained after the last one
+	if(post_compression.dictionary_count >= MAX_POST_DICTIONARIES){
+		return;
+	}
+	uint64_t due = post_compression.dictionary_count == 0 ? DICTIONARY_SAMPLE_POSTS : DICTIONARY_RETRAIN_POSTS;
+	post_compression.posts_since_training++;
+	if(post_compression.posts_since_training + DICTIONARY_SAMPLE_POSTS > due){
+		post_compression.sample.push_back(body);
+	}
+	if(post_compression.posts_since_training >= due){
+		add_post_dictionary(train_post_dictionary(post_compression.sample, POST_DICTIONARY_BYTES));
+		save_post_dictionary();
+		post_compression.sample.clear();
+		post_compression.posts_since_training = 0;
+	}
+}
+
+// function that returns the stored form of a post body, the body itself when compression is off
+// the caller holds users_db_mutex
+std::string compress_post_body(const std::string& body){
+	if(!post_compression.enabled){
+		return body;
+	}
+	sample_post_body(body);
+	int count = post_compression.dictionary_count;
+	// the body is compressed into the scratch buffer so the stored copy is allocated at its size
+	std::string& scratch = post_compression.scratch;
+	scratch.clear();
+	if(count > 0){
+		const std::string* dictionary = post_compression.dictionaries[count - 1];
+		z_stream& deflater = post_compression.deflater;
+		deflateReset(&deflater);
+		deflateSetDictionary(&deflater, (const Bytef*)dictionary->data(), dictionary->size());
+		scratch.push_back(BODY_COMPRESSED);
+		scratch.push_back((char)(count - 1));
+		for(uint64_t length = body.size(); ; length >>= 7){
+			scratch.push_back((char)((length & 0x7f) | (length >= 0x80 ? 0x80 : 0)));
+			if(length < 0x80){
+				break;
+			}
+		}
+		size_t header = scratch.size();
+		scratch.resize(header + deflateBound(&deflater, body.size()));
+		deflater.next_in = (Bytef*)body.data();
+		deflater.avail_in = body.size();
+		deflater.next_out = (Bytef*)&scratch[header];
+		deflater.avail_out = scratch.size() - header;
+		if(deflate(&deflater, Z_FINISH) == Z_STREAM_END && header + deflater.total_out < body.size() + 1){
+			scratch.resize(header + deflater.total_out);
+		}
+		else{
+			scratch.clear();
+		}
+	}
+	std::string stored;
+	if(scratch.empty()){
+		stored.reserve(body.size() + 1);
+		stored.push_back(BODY_PLAIN);
+		stored += body;
+	}
+	else{
+		stored.assign(scratch);
+	}
+	post_compression.bodies++;
+	post_compression.raw_bytes += body.size();
+	post_compression.stored_bytes += stored.size();
+	return stored;
+}
+
+// decompressor of the calling thread
+struct post_inflater {
+	z_stream stream;
+	post_inflater(){
+		std::memset(&stream, 0, sizeof(stream));
+		inflateInit2(&stream, -15);
+	}
+	~post_inflater(){
+		inflateEnd(&stream);
+	}
+};
+
+// function that returns the body of a post from its stored form (size bytes at stored), it stays
+// valid until the calling thread's next call; any thread can call it without a lock
+const std::string& post_body(const char* stored, size_t size){
+	thread_local std::string body;
+	if(!post_compression.enabled){
+		body.assign(stored, size);
+		return body;
+	}
+	if(size == 0){
+		body.clear();
+		return body;
+	}
+	if(stored[0] != BODY_COMPRESSED){
+		body.assign(stored + 1, size - 1);
+		return body;
+	}
+	uint64_t started = stats_now_ns();
+	thread_local post_inflater inflater;
+	const std::string* dictionary = post_compression.dictionaries[(unsigned char)stored[1]];
+	uint64_t length = 0;
+	size_t at = 2;
+	for(int shift = 0; at < size; shift += 7){
+		unsigned char byte = stored[at++];
+		length |= (uint64_t)(byte & 0x7f) << shift;
+		if(!(byte & 0x80)){
+			break;
+		}
+	}
+	body.resize(length);
+	z_stream& stream = inflater.stream;
+	inflateReset(&stream);
+	inflateSetDictionary(&stream, (const Bytef*)dictionary->data(), dictionary->size());
+	stream.next_in = (Bytef*)stored + at;
+	stream.avail_in = size - at;
+	stream.next_out = (Bytef*)&body[0];
+	stream.avail_out = length;
+	if(length > 0 && inflate(&stream, Z_FINISH) != Z_STREAM_END){
+		body.clear();
+	}
+	record_metric(post_decode_latency, stats_now_ns() - started);
+	return body;
+}
+
+// the body of a post stored in a string, the string itself when compression is off
+const std::string& post_body(const std::string& stored){
+	if(!post_compression.enabled){
+		return stored;
+	}
+	return post_body(stored.data(), stored.size());
+}
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef POST_RECORD_H
+#define POST_RECORD_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+
+#include "slab_pool.h"
+
+// posts in memory (user_store.h)
+// a post is one record that holds its fields {username, time, content} and the trace id, if it
+// has one, back to back after a small header, allocated from the slab pool of its size class
+// the user's posts and every timeline it is fanned out to share the record through a post_handle
+// that counts references, the last handle to let go gives the slot back to its pool, from any
+// thread since timelines are written to clients after users_db_mutex is released
+// the rest of the store still passes posts around as vectors of strings (post_info_of)
+
+const int MAX_POST_FIELDS = 4;
+
+struct post_record {
+	std::atomic<uint32_t> references;
+	uint32_t lengths[MAX_POST_FIELDS];
+	uint8_t fields;
+	// index of the pool the record came from, POST_RECORD_HEAP for records too large for any
+	uint8_t size_class;
+
+	const char* text() const {
+		return (const char*)(this + 1);
+	}
+	const char* field(int i) const {
+		const char* at = text();
+		for(int f = 0; f < i; f++){
+			at += lengths[f];
+		}
+		return at;
+	}
+	uint32_t text_bytes() const {
+		uint32_t total = 0;
+		for(int f = 0; f < fields; f++){
+			total += lengths[f];
+		}
+		return total;
+	}
+};
+
+// a record takes the smallest class it fits in, most posts fit in the first few
+const int POST_SIZE_CLASSES = 12;
+const uint8_t POST_RECORD_HEAP = 255;
+
+slab_pool post_pools[POST_SIZE_CLASSES] = {
+	{"post_64", 64}, {"post_96", 96}, {"post_128", 128}, {"post_160", 160}, {"post_192", 192},
+	{"post_256", 256}, {"post_384", 384}, {"post_512", 512}, {"post_768", 768}, {"post_1024", 1024},
+	{"post_1536", 1536}, {"post_2048", 2048}};
+
+std::atomic<uint64_t> heap_post_records(0);
+
+// function that gives a record back when its last reference goes
+void release_post_record(post_record* record){
+	if(record == nullptr || record->references.fetch_sub(1, std::memory_order_acq_rel) != 1){
+		return;
+	}
+	uint8_t size_class = record->size_class;
+	record->~post_record();
+	if(size_class == POST_RECORD_HEAP){
+		heap_post_records--;
+		::operator delete(record);
+	}
+	else{
+		slab_free(record);
+	}
+}
+
+// counted reference to a post record
+class post_handle {
+	public:
+		post_handle() : record(nullptr) {}
+		// takes over the reference the record was made with
+		explicit post_handle(post_record* made) : record(made) {}
+		post_handle(const post_handle& other) : record(other.record) {
+			if(record != nullptr){
+				record->references.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		post_handle(post_handle&& other) noexcept : record(other.record) { other.record = nullptr; }
+		post_handle& operator=(post_handle other) {
+			std::swap(record, other.record);
+			return *this;
+		}
+		~post_handle() { release_post_record(record); }
+		const post_record& operator*() const { return *record; }
+		const post_record* operator->() const { return record; }
+		bool empty() const { return record == nullptr; }
+	private:
+		post_record* record;
+};
+
+// function that makes a record of a post given as {username, time, content[, trace id]},
+// body replaces the content when it is given (the content compressed, see post_compression.h)
+post_handle make_post_record(const std::vector<std::string>& post_info, const std::string* body = nullptr){
+	int fields = post_info.size() < MAX_POST_FIELDS ? post_info.size() : MAX_POST_FIELDS;
+	size_t bytes = sizeof(post_record);
+	for(int f = 0; f < fields; f++){
+		bytes += f == 2 && body != nullptr ? body->size() : post_info.at(f).size();
+	}
+	uint8_t size_class = 0;
+	while(size_class < POST_SIZE_CLASSES && post_pools[size_class].slot_bytes < bytes){
+		size_class++;
+	}
+	void* slot = nullptr;
+	if(size_class == POST_SIZE_CLASSES){
+		size_class = POST_RECORD_HEAP;
+		slot = ::operator new(bytes);
+		heap_post_records++;
+	}
+	else{
+		slot = slab_allocate(post_pools[size_class]);
+	}
+	post_record* record = new (slot) post_record();
+	record->references.store(1, std::memory_order_relaxed);
+	record->fields = fields;
+	record->size_class = size_class;
+	char* at = (char*)(record + 1);
+	for(int f = 0; f < fields; f++){
+		const std::string& value = f == 2 && body != nullptr ? *body : post_info.at(f);
+		record->lengths[f] = value.size();
+		std::memcpy(at, value.data(), value.size());
+		at += value.size();
+	}
+	return post_handle(record);
+}
+
+// function that returns a post as a vector of its fields
+std::vector<std::string> post_info_of(const post_record& record){
+	std::vector<std::string> post_info;
+	post_info.reserve(record.fields);
+	const char* at = record.text();
+	for(int f = 0; f < record.fields; f++){
+		post_info.push_back(std::string(at, record.lengths[f]));
+		at += record.lengths[f];
+	}
+	return post_info;
+}
+
+// function that compares a field of a record with a string
+bool field_equals(const post_record& record, int f, const std::string& value){
+	return f < record.fields && record.lengths[f] == value.size() &&
+			std::memcmp(record.field(f), value.data(), value.size()) == 0;
+}
+
+// function that returns true if two handles hold the same post, the same record or a copy of it
+bool same_post(const post_handle& a, const post_handle& b){
+	if(&*a == &*b){
+		return true;
+	}
+	if(a->fields != b->fields || std::memcmp(a->lengths, b->lengths, sizeof(a->lengths[0]) * a->fields) != 0){
+		return false;
+	}
+	return std::memcmp(a->text(), b->text(), a->text_bytes()) == 0;
+}
+
+// function that adds up the blocks and the records of the post pools
+void post_pool_usage(uint64_t& blocks, uint64_t& records){
+	blocks = 0;
+	records = heap_post_records;
+	for(int i = 0; i < POST_SIZE_CLASSES; i++){
+		uint64_t pool_blocks = 0;
+		uint64_t used = 0;
+		slab_usage(post_pools[i], pool_blocks, used);
+		blocks += pool_blocks;
+		records += used;
+	}
+}
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef POST_SEGMENTS_H
+#define POST_SEGMENTS_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// on disk tier of the post store (see user_store.h)
+// posts that fall out of a user's in memory window are appended to a segment file of the
+// user's shard, every record points back to the same user's previous record so the store only
+// keeps the location of a user's newest record in memory no matter how many posts they have
+// a record is the location of the previous record (8 bytes), the post's time in seconds (8 bytes),
+// the number of fields (4 bytes) and every field of the post as its length (4 bytes) followed by
+// its bytes, the time is in the header so paging can walk records without reading the post
+// segments are read through a read only mapping, reading a record is a copy out of the page
+// cache instead of a system call
+
+// number of shards, every shard appends to its own segment files
+const int POST_SHARDS = 8;
+
+// a shard starts a new segment file when its current one would grow past this size
+const uint64_t SEGMENT_BYTES = 64ULL * 1024 * 1024;
+
+// records are collected in memory and written to the segment in chunks of about this size
+const size_t SEGMENT_BUFFER_BYTES = 64 * 1024;
+
+// the location of a record is its segment number in the high bits and its offset in the segment
+// in the low bits, NO_POST_LOCATION means there is no record
+const int SEGMENT_OFFSET_BITS = 40;
+const uint64_t NO_POST_LOCATION = ~0ULL;
+
+struct post_segment_shard {
+	int fd = -1;			// current segment, open for reading and writing
+	uint32_t segment = 0;	// number of the current segment
+	uint64_t written = 0;	// bytes of the current segment that are in the file
+	std::string buffer;		// records appended after them that are not written yet
+	// mapping of every segment (SEGMENT_BYTES long) and the bytes written to it
+	std::vector<char*> maps;
+	std::vector<uint64_t> sizes;
+};
+
+// segment files are named <prefix>_<shard>_<segment>.seg
+std::string post_segment_prefix = "post_segment";
+post_segment_shard post_shards[POST_SHARDS];
+
+std::string segment_file_name(int shard, uint32_t segment){
+	return post_segment_prefix + "_" + std::to_string(shard) + "_" + std::to_string(segment) + ".seg";
+}
+
+// every record of a user goes to the same shard
+int shard_of(const std::string& username){
+	return std::hash<std::string>()(username) % POST_SHARDS;
+}
+
+// helper function that writes the buffered records of a shard to its current segment
+bool flush_post_shard(post_segment_shard& shard){
+	size_t done = 0;
+	while(done < shard.buffer.size()){
+		ssize_t n = pwrite(shard.fd, shard.buffer.data() + done, shard.buffer.size() - done, shard.written + done);
+		if(n <= 0){
+			return false;
+		}
+		done += n;
+	}
+	shard.written += done;
+	shard.sizes.back() = shard.written;
+	shard.buffer.clear();
+	return true;
+}
+
+// helper function that creates a shard's next segment and maps it
+bool start_segment(int shard_number, uint32_t segment){
+	post_segment_shard& shard = post_shards[shard_number];
+	shard.fd = open(segment_file_name(shard_number, segment).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(shard.fd < 0){
+		return false;
+	}
+	// pages past the end of the file are never read, the mapping covers what the segment can grow to
+	void* map = mmap(nullptr, SEGMENT_BYTES, PROT_READ, MAP_SHARED, shard.fd, 0);
+	if(map == MAP_FAILED){
+		close(shard.fd);
+		shard.fd = -1;
+		return false;
+	}
+	shard.segment = segment;
+	shard.written = 0;
+	shard.maps.push_back((char*)map);
+	shard.sizes.push_back(0);
+	return true;
+}
+
+// function that writes what is buffered and closes every shard
+void close_post_segments(){
+	for(int i = 0; i < POST_SHARDS; i++){
+		post_segment_shard& shard = post_shards[i];
+		if(shard.fd >= 0){
+			flush_post_shard(shard);
+			close(shard.fd);
+		}
+		for(int m = 0; m < shard.maps.size(); m++){
+			munmap(shard.maps.at(m), SEGMENT_BYTES);
+		}
+		shard.fd = -1;
+		shard.segment = 0;
+		shard.written = 0;
+		shard.buffer.clear();
+		shard.maps.clear();
+		shard.sizes.clear();
+	}
+}
+
+// function that starts every shard with an empty segment
+// the server replays its whole log on start so the segments of an earlier run are removed,
+// returns false if a segment file couldn't be created
+bool open_post_segments(const std::string& prefix){
+	close_post_segments();
+	post_segment_prefix = prefix;
+	for(int i = 0; i < POST_SHARDS; i++){
+		for(uint32_t segment = 1; unlink(segment_file_name(i, segment).c_str()) == 0; segment++){
+		}
+		if(!start_segment(i, 0)){
+			return false;
+		}
+	}
+	return true;
+}
+
+// size of a record before its first field
+const uint64_t RECORD_HEADER_BYTES = 20;
+
+// function that appends a post to a shard, the post's fields are given back to back in text with
+// the length of every field
+// previous is the location of the user's last record, returns the location of the new record
+// or NO_POST_LOCATION if it couldn't be written
+uint64_t append_post_record(int shard_number, uint64_t previous, int64_t time, const char* text,
+		const uint32_t* lengths, uint32_t fields){
+	post_segment_shard& shard = post_shards[shard_number];
+	if(shard.fd < 0){
+		return NO_POST_LOCATION;
+	}
+	uint64_t record_size = RECORD_HEADER_BYTES;
+	for(uint32_t i = 0; i < fields; i++){
+		record_size += 4 + lengths[i];
+	}
+	// a record larger than a whole segment can't be stored
+	if(record_size > SEGMENT_BYTES){
+		return NO_POST_LOCATION;
+	}
+	// start the next segment if the record doesn't fit in this one
+	uint64_t end = shard.written + shard.buffer.size();
+	if(end + record_size > SEGMENT_BYTES){
+		if(!flush_post_shard(shard)){
+			return NO_POST_LOCATION;
+		}
+		close(shard.fd);
+		if(!start_segment(shard_number, shard.segment + 1)){
+			return NO_POST_LOCATION;
+		}
+		end = 0;
+	}
+	uint64_t location = ((uint64_t)shard.segment << SEGMENT_OFFSET_BITS) | end;
+	shard.buffer.append((const char*)&previous, 8);
+	shard.buffer.append((const char*)&time, 8);
+	shard.buffer.append((const char*)&fields, 4);
+	for(uint32_t i = 0; i < fields; i++){
+		shard.buffer.append((const char*)&lengths[i], 4);
+		shard.buffer.append(text, lengths[i]);
+		text += lengths[i];
+	}
+	// a failed write leaves the records in the buffer, the next flush tries again
+	if(shard.buffer.size() >= SEGMENT_BUFFER_BYTES){
+		flush_post_shard(shard);
+	}
+	return location;
+}
+
+// helper function that finds the bytes of the record at location
+// sets data and available to the record and the bytes after it in the same segment or buffer,
+// returns false if there is no record at location
+bool find_post_record(int shard_number, uint64_t location, const char*& data, uint64_t& available){
+	post_segment_shard& shard = post_shards[shard_number];
+	uint32_t segment = location >> SEGMENT_OFFSET_BITS;
+	uint64_t offset = location & ((1ULL << SEGMENT_OFFSET_BITS) - 1);
+	if(segment >= shard.maps.size()){
+		return false;
+	}
+	// records are always written whole so a record is either in the file or in the buffer
+	if(segment == shard.segment && offset >= shard.written){
+		if(offset - shard.written >= shard.buffer.size()){
+			return false;
+		}
+		data = shard.buffer.data() + (offset - shard.written);
+		available = shard.buffer.size() - (offset - shard.written);
+	}
+	else{
+		if(offset >= shard.sizes.at(segment)){
+			return false;
+		}
+		data = shard.maps.at(segment) + offset;
+		available = shard.sizes.at(segment) - offset;
+	}
+	return available >= RECORD_HEADER_BYTES;
+}
+
+// function that reads the time and the previous location of the record at location of a shard
+bool read_post_header(int shard_number, uint64_t location, int64_t& time, uint64_t& previous){
+	const char* data = nullptr;
+	uint64_t available = 0;
+	if(!find_post_record(shard_number, location, data, available)){
+		return false;
+	}
+	std::memcpy(&previous, data, 8);
+	std::memcpy(&time, data + 8, 8);
+	return true;
+}
+
+// function that reads the post stored at location of a shard
+// previous is set to the location of the user's record before it, the strings already in post
+// are reused
+bool read_post_record(int shard_number, uint64_t location, std::vector<std::string>& post, uint64_t& previous){
+	const char* data = nullptr;
+	uint64_t available = 0;
+	if(!find_post_record(shard_number, location, data, available)){
+		return false;
+	}
+	uint32_t fields = 0;
+	std::memcpy(&previous, data, 8);
+	std::memcpy(&fields, data + 16, 4);
+	post.resize(fields);
+	uint64_t position = RECORD_HEADER_BYTES;
+	for(uint32_t i = 0; i < fields; i++){
+		uint32_t length = 0;
+		if(position + 4 > available){
+			return false;
+		}
+		std::memcpy(&length, data + position, 4);
+		if(position + 4 + length > available){
+			return false;
+		}
+		post.at(i).assign(data + position + 4, length);
+		position += 4 + length;
+	}
+	return true;
+}
+
+// function that returns how many bytes the segments of every shard hold
+uint64_t post_segment_bytes(){
+	uint64_t total = 0;
+	for(int i = 0; i < POST_SHARDS; i++){
+		for(int m = 0; m < post_shards[i].sizes.size(); m++){
+			total += post_shards[i].sizes.at(m);
+		}
+		total += post_shards[i].buffer.size();
+	}
+	return total;
+}
+
+#endif
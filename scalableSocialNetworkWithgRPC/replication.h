@@ -0,0 +1,229 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <unistd.h>
+#include <grpc++/grpc++.h>
+
+#include "TNSService.grpc.pb.h"
+#include "user_store.h"
+#include "suggest.h"
+#include "trending.h"
+#include "stats.h"
+
+// read replicas (tsd -P <primary ip>:<port>)
+// every line a primary writes to its log gets the next sequence number, line n of
+// new_server_log.txt is number n, and the newest REPLICATION_WINDOW lines are kept in memory
+// a replica streams the log with ReplicateLog: lines it is missing that are no longer in memory
+// are read back from the file, after that new lines are sent in batches as they are logged and an
+// empty batch every REPLICATION_IDLE_MS tells the replica nothing is missing
+// the replica applies the lines to its store the way a restore does, answers reads only while it
+// had every line the primary had no more than MAX_REPLICA_LAG_MS ago and refuses writes
+// a post goes into the timelines of the replica the way it goes into the primary's (fan_out_post),
+// each of them at most 20 posts, but a timeline update takes the posts of the one it is asked, so
+// after a client moves between the two it is given the posts the other one already sent, tsc
+// doesn't show them again
+// a replica that fell behind the window, or whose primary restarted and began a new log, exits and
+// starts over from line 0 when its slave or supervisor restarts it, a new log begins with a
+// snapshot of the primary's whole store (write_store_snapshot in user_store.h)
+
+const size_t REPLICATION_WINDOW = 100000;
+const int REPLICATION_BATCH = 256;
+const int REPLICATION_IDLE_MS = 100;
+const int64_t MAX_REPLICA_LAG_MS = 1000;
+
+struct replication_state {
+	// the primary's log lines, recent is guarded by log_mutex, next_seq is written under both
+	// log_mutex and users_db_mutex so either one is enough to read it
+	std::mutex log_mutex;
+	std::condition_variable appended;
+	std::deque<std::string> recent;
+	uint64_t first_seq = 0;
+	uint64_t next_seq = 0;
+	// tells the logs of different runs of the primary apart
+	uint64_t log_id = 0;
+	std::atomic<int64_t> streams;
+	// set on a replica: its primary, the lines applied and when it last had every line
+	std::string primary = "";
+	std::atomic<uint64_t> applied_seq;
+	std::atomic<uint64_t> caught_up_ns;
+	uint64_t primary_log_id = 0;
+
+	replication_state() : streams(0), applied_seq(0), caught_up_ns(0) {
+		log_id = stats_now_ns() ^ ((uint64_t)getpid() << 32) ^ (uint64_t)time(nullptr);
+	}
+};
+
+replication_state replication;
+
+bool is_replica(){
+	return replication.primary != "";
+}
+
+// function that remembers a line the primary wrote to its log, the caller holds users_db_mutex
+void remember_log_line(const std::string& line){
+	std::lock_guard<std::mutex> lock(replication.log_mutex);
+	replication.recent.push_back(line);
+	replication.next_seq++;
+	if(replication.recent.size() > REPLICATION_WINDOW){
+		replication.recent.pop_front();
+		replication.first_seq++;
+	}
+	replication.appended.notify_all();
+}
+
+// function that returns true when a replica is too far behind its primary to answer reads
+bool replica_stale(){
+	if(!is_replica()){
+		return false;
+	}
+	return stats_now_ns() - replication.caught_up_ns.load() > (uint64_t)MAX_REPLICA_LAG_MS * 1000000;
+}
+
+grpc::Status stale_replica_status(){
+	return grpc::Status(grpc::StatusCode::UNAVAILABLE, "replica behind the primary");
+}
+
+grpc::Status read_only_status(){
+	return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION, "read replica, writes go to the primary");
+}
+
+// function that sends the log from line from on to a replica until it goes away
+// flushed is the number of lines in the log file, taken while the file was flushed under
+// users_db_mutex, lines before the window are read from the file up to it
+template<typename Writer>
+grpc::Status stream_log(grpc::ServerContext* context, uint64_t from, uint64_t flushed, Writer* writer){
+	uint64_t seq = from;
+	uint64_t window_start;
+	{
+		std::lock_guard<std::mutex> lock(replication.log_mutex);
+		window_start = replication.first_seq;
+	}
+	if(seq < window_start && seq < flushed){
+		std::ifstream log_file("new_server_log.txt");
+		std::string line;
+		TNSService::log_batch batch;
+		batch.set_first_seq(seq);
+		batch.set_log_id(replication.log_id);
+		for(uint64_t n = 0; n < flushed && std::getline(log_file, line); n++){
+			if(n < seq){
+				continue;
+			}
+			batch.add_lines(line);
+			if(batch.lines_size() == REPLICATION_BATCH || n + 1 == flushed){
+				batch.set_head_seq(flushed);
+				if(!writer->Write(batch)){
+					return grpc::Status::OK;
+				}
+				batch.Clear();
+				batch.set_first_seq(n + 1);
+				batch.set_log_id(replication.log_id);
+			}
+		}
+		seq = flushed;
+	}
+	while(!context->IsCancelled()){
+		TNSService::log_batch batch;
+		{
+			std::unique_lock<std::mutex> lock(replication.log_mutex);
+			if(replication.next_seq == seq){
+				replication.appended.wait_for(lock, std::chrono::milliseconds(REPLICATION_IDLE_MS));
+			}
+			if(seq < replication.first_seq){
+				return grpc::Status(grpc::StatusCode::ABORTED, "replica behind the replication window");
+			}
+			batch.set_first_seq(seq);
+			for(; seq < replication.next_seq && batch.lines_size() < REPLICATION_BATCH; seq++){
+				batch.add_lines(replication.recent.at(seq - replication.first_seq));
+			}
+			batch.set_head_seq(replication.next_seq);
+		}
+		batch.set_log_id(replication.log_id);
+		if(!writer->Write(batch)){
+			break;
+		}
+	}
+	return grpc::Status::OK;
+}
+
+// function that applies a line of the primary's log to a replica, the caller holds users_db_mutex
+void apply_replicated_line(const std::string& line){
+	std::vector<std::string> initialized_users;
+	std::vector<std::string> former_followers;
+	// "DELETE username|time"
+	std::string deleted = line.substr(0, 6) == "DELETE" ? line.substr(7, line.find('|') - 7) : "";
+	if(deleted != "" && users_db.find(deleted) != users_db.end()){
+		former_followers = users_db.at(deleted)->followers;
+	}
+	apply_log_line(line, initialized_users);
+	if(line.substr(0, 6) == "DELETE"){
+		for(int i = 0; i < former_followers.size(); i++){
+			if(former_followers.at(i) != deleted){
+				refresh_suggestions_after_follow(former_followers.at(i));
+			}
+		}
+	}
+	else if(line.substr(0, 6) == "FOLLOW" || line.substr(0, 8) == "UNFOLLOW"){
+		size_t begin = line.find(' ') + 1;
+		refresh_suggestions_after_follow(line.substr(begin, line.find('|') - begin));
+	}
+	else if(line.substr(0, 4) == "POST"){
+		// the posts a replica receives are new, unlike the ones a restore replays
+		size_t content = line.find('|', line.find('|') + 1);
+		record_trending(line.substr(content + 1), time(nullptr));
+	}
+}
+
+// thread of a replica that applies its primary's log, the stream is opened again when it breaks
+void follow_primary(){
+	std::unique_ptr<TNSService::user_services::Stub> primary_stub(TNSService::user_services::NewStub(
+			grpc::CreateChannel(replication.primary, grpc::InsecureChannelCredentials())));
+	while(1){
+		grpc::ClientContext context;
+		TNSService::replicate_request request;
+		request.set_from_seq(replication.applied_seq);
+		std::unique_ptr<grpc::ClientReader<TNSService::log_batch>> reader(primary_stub->ReplicateLog(&context, request));
+		TNSService::log_batch batch;
+		while(reader->Read(&batch)){
+			if(replication.primary_log_id == 0){
+				replication.primary_log_id = batch.log_id();
+			}
+			if(batch.log_id() != replication.primary_log_id){
+				std::cout<<"primary started a new log, restarting"<<std::endl;
+				_exit(1);
+			}
+			uint64_t seq = replication.applied_seq;
+			if(batch.lines_size() > 0){
+				std::lock_guard<std::mutex> lock(users_db_mutex);
+				for(int i = 0; i < batch.lines_size(); i++){
+					// a batch can start before the last line applied when a stream was reopened
+					if(batch.first_seq() + i == seq){
+						apply_replicated_line(batch.lines(i));
+						seq++;
+					}
+				}
+			}
+			replication.applied_seq = seq;
+			if(seq >= batch.head_seq()){
+				replication.caught_up_ns = stats_now_ns();
+			}
+		}
+		grpc::Status status = reader->Finish();
+		if(status.error_code() == grpc::StatusCode::ABORTED){
+			std::cout<<"replica fell behind its primary, restarting"<<std::endl;
+			_exit(1);
+		}
+		sleep(1);
+	}
+}
+
+#endif
@@ -5,14 +5,19 @@
 #include <stack>
 #include <queue>
 #include <thread>
+#include <mutex>
+#include <chrono>
 #include <unistd.h>
 #include <fstream>
 #include <memory>
+#include <algorithm>
 #include <signal.h>
 #include <cstdio>
 #include <grpc++/grpc++.h>
 
 #include "TNSService.grpc.pb.h"
+#include "stats.h"
+#include "router_channel.h"
 
 using grpc::Server;
 using grpc::ServerBuilder;
@@ -29,11 +34,24 @@ using grpc::ClientWriter;
 using TNSService::user_services;
 using TNSService::available_server;
 using TNSService::client_info;
+using TNSService::stats_request;
+using TNSService::stats_reply;
 
 // variables that represent the current available server and
-// the list of online servers
+// the list of online servers, guarded by router_mutex
+std::mutex router_mutex;
 std::vector<std::string> available_server_info(2);
 std::vector<std::vector<std::string>> online_servers;
+// read replicas (tsd -P) as ip, port and the <ip>:<port> of their primary, they are never elected,
+// clients of their primary are given one of them in turn for reads, see replication.h
+std::vector<std::vector<std::string>> replicas;
+size_t next_replica = 0;
+
+// the routers of the cluster (-R), the same list on every router, and this router's own entry
+// every server sends its heartbeat to all of them so each one knows every online server, the
+// first router of the list that is up makes the election (follow_leader)
+std::vector<std::string> cluster_routers;
+std::string this_router = "";
 
 // helper function to find a server in the list of online servers
 int position_in_online_servers(std::string server_to_find, std::string port){
@@ -45,10 +63,41 @@ int position_in_online_servers(std::string server_to_find, std::string port){
 	return -1;
 }
 
+// helper function to find a replica in the list of replicas
+int position_in_replicas(std::string replica_to_find, std::string port){
+	for(int i = 0; i < replicas.size(); i++){
+		if(replicas.at(i).at(0) == replica_to_find && replicas.at(i).at(1) == port){
+			return i;
+		}
+	}
+	return -1;
+}
+
+// helper function that adds the next replica of the server in the response for reads,
+// the caller holds router_mutex
+void add_read_replica(available_server* response){
+	std::string primary = response->ip_addr() + ":" + response->port();
+	for(size_t tried = 0; tried < replicas.size(); tried++){
+		std::vector<std::string>& replica = replicas.at(next_replica++ % replicas.size());
+		if(replica.at(2) == primary){
+			response->set_read_ip(replica.at(0));
+			response->set_read_port(replica.at(1));
+			return;
+		}
+	}
+}
+
+// ids of the metrics recorded by the router, reported by GetStats
+int request_for_server_latency = register_metric("RequestForServer", true);
+int update_router_latency = register_metric("UpdateRouter_heartbeat", true);
+int stats_latency = register_metric("GetStats", true);
+int elections = register_metric("election_online_servers", false);
+
 // Service class for the router server
 class TNSServiceImpl final : public user_services::Service{
 
 	// election function that will assign a new current available server
+	// the caller holds router_mutex
 	void election(std::string dead_server, std::string port) {
 		// if this election was triggered by the client, remove the server from the list of online servers
 		
@@ -58,6 +107,7 @@ class TNSServiceImpl final : public user_services::Service{
 			online_servers.erase(online_servers.begin() + index);
 		}
 		
+		record_metric(elections, online_servers.size());
 		// simple election algorithm that selects the next online server
 		if(online_servers.size() > 0){
 			available_server_info = online_servers.at(0);
@@ -70,6 +120,8 @@ class TNSServiceImpl final : public user_services::Service{
 
 	// service that provides the client with a new server ip and port
 	Status RequestForServer(ServerContext* context, const client_info* request, available_server* response) override {
+		scoped_latency timer(request_for_server_latency);
+		std::lock_guard<std::mutex> lock(router_mutex);
 		
 		// if the client is not currently connected to the available server
 		if(request->ip_server() != available_server_info.at(0)) {
@@ -84,6 +136,7 @@ class TNSServiceImpl final : public user_services::Service{
 			response->set_ip_addr(available_server_info.at(0));
 			response->set_port(available_server_info.at(1));
 		}
+		add_read_replica(response);
 		
 		return Status::OK;
 	}
@@ -97,14 +150,45 @@ class TNSServiceImpl final : public user_services::Service{
 		available_server current_available_server;
 		std::string server_contacted;
 		std::string port_contacted;
+		bool replica_contacted = false;
+		stream_counter open_stream;
 		
 		while(1){
 			available_server received_info;
 			received_info.set_online(0);
 			stream->Read(&received_info);
+			uint64_t heartbeat_start = stats_now_ns();
+			std::unique_lock<std::mutex> lock(router_mutex);
+			// a replica is only listed for reads while it is up and not draining
+			if(received_info.online() == 1 && received_info.replica_of() != ""){
+				server_contacted = received_info.ip_addr();
+				port_contacted = received_info.port();
+				replica_contacted = true;
+				int index = position_in_replicas(server_contacted, port_contacted);
+				if(received_info.draining() && index != -1){
+					replicas.erase(replicas.begin() + index);
+				}
+				else if(!received_info.draining() && index == -1){
+					replicas.push_back({server_contacted, port_contacted, received_info.replica_of()});
+				}
+			}
+			// a draining server stays connected until it exits but no new clients are sent to it
+			else if(received_info.online() == 1 && received_info.draining()) {
+				server_contacted = received_info.ip_addr();
+				port_contacted = received_info.port();
+				if(server_contacted == available_server_info.at(0) && port_contacted == available_server_info.at(1)){
+					election(server_contacted, port_contacted);
+				}
+				else{
+					int index = position_in_online_servers(server_contacted, port_contacted);
+					if(index != -1){
+						online_servers.erase(online_servers.begin() + index);
+					}
+				}
+			}
 			// make sure that a message was read from the stream from another server
 			// servers will always send an online message of 1
-			if(received_info.online() == 1) {
+			else if(received_info.online() == 1) {
 				server_contacted = received_info.ip_addr();
 				port_contacted = received_info.port();
 				// if this is a never seen before server add it to the list of online servers
@@ -122,6 +206,13 @@ class TNSServiceImpl final : public user_services::Service{
 				
 			}
 			
+			if(received_info.online() != 1 && replica_contacted){
+				int index = position_in_replicas(server_contacted, port_contacted);
+				if(index != -1){
+					replicas.erase(replicas.begin() + index);
+				}
+				break;
+			}
 			// if a message wasn't received from the server elect a new master if this was the master's stream
 			if(received_info.online() != 1){
 				// if this was the master's stream
@@ -146,29 +237,120 @@ class TNSServiceImpl final : public user_services::Service{
 			}
 			// notify the server of the current available server
 			current_available_server.set_ip_addr(available_server_info.at(0));
+			current_available_server.set_port(available_server_info.at(1));
+			// and of every online master, so masters find the users of the others (peer_fanout.h)
+			current_available_server.clear_masters();
+			for(int i = 0; i < online_servers.size(); i++){
+				current_available_server.add_masters(online_servers.at(i).at(0) + ":" + online_servers.at(i).at(1));
+			}
+			lock.unlock();
 			stream->Write(current_available_server);
+			record_metric(update_router_latency, stats_now_ns() - heartbeat_start);
 			sleep(1);
 		}
 		return Status::OK;
 
 	}
+
+	// service that reports the router's rpc latencies and the servers it knows about
+	Status GetStats(ServerContext* context, const stats_request* request, stats_reply* response) override {
+		scoped_latency timer(stats_latency);
+		add_metrics(response);
+		std::unique_lock<std::mutex> lock(router_mutex);
+		add_gauge(response, "online_servers", online_servers.size());
+		add_gauge(response, "replicas", replicas.size());
+		lock.unlock();
+		add_gauge(response, "active_streams", active_streams.load());
+		build_exposition(response, "router");
+		return Status::OK;
+	}
 };
 
-int main() {
+// thread of a router that isn't first in the list of routers: every second the routers before it
+// are asked for their available server and the first that answers is followed, its choice is
+// taken over as long as this router has that server online too so all routers send clients to
+// the same server; while none of them answers this router elects by itself
+void follow_leader(){
+	std::vector<std::unique_ptr<user_services::Stub>> leaders;
+	for(int i = 0; i < cluster_routers.size() && cluster_routers.at(i) != this_router; i++){
+		leaders.push_back(user_services::NewStub(grpc::CreateChannel(cluster_routers.at(i), grpc::InsecureChannelCredentials())));
+	}
+	while(1){
+		sleep(1);
+		for(int i = 0; i < leaders.size(); i++){
+			client_info ask;
+			available_server answer;
+			ClientContext context;
+			context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(500));
+			if(!leaders.at(i)->RequestForServer(&context, ask, &answer).ok()){
+				continue;
+			}
+			std::lock_guard<std::mutex> lock(router_mutex);
+			if(answer.ip_addr() != "ERROR" && position_in_online_servers(answer.ip_addr(), answer.port()) != -1){
+				available_server_info.at(0) = answer.ip_addr();
+				available_server_info.at(1) = answer.port();
+			}
+			break;
+		}
+	}
+}
+
+int main(int argc, char** argv) {
 	// send messages to other servers and get their responses
 	// update available_server_info if need be
 	// make sure that the interval that the router and client check if servers are online are consistent
 	std::string router_port;
 	std::string router_ip;
+	bool ip_exists = 0;
+	bool port_exists = 0;
+	int opt = 0;
+	// the ip and port can be given on the command line so the router can be started by scripts
+	std::string routers = "";
+	while ((opt = getopt(argc, argv, "i:p:R:")) != -1){
+		switch(opt) {
+		    case 'R':{
+			// every router of the cluster, this one included, in the same order on all of them
+			routers = optarg;
+			break;
+		    }
+		    case 'i':{
+			router_ip = optarg;
+			ip_exists = 1;
+			break;
+		    }
+		    case 'p':{
+			router_port = optarg;
+			port_exists = 1;
+			break;
+		    }
+		    default:{
+			std::cerr << "Invalid Command Line Argument\n";
+		    }
+		}
+	}
 	
 	// get the ip address and desired port of the router from the user
-	std::cout << "Please enter the ip address of this machine (the router) in the form ###.###.###.###" << std::endl;
-	std::cin >> router_ip;
-	std::cout << "Please enter the port number you'd like to run the router on" << std::endl;
-	std::cin >> router_port;
+	if(!ip_exists){
+		std::cout << "Please enter the ip address of this machine (the router) in the form ###.###.###.###" << std::endl;
+		std::cin >> router_ip;
+	}
+	if(!port_exists){
+		std::cout << "Please enter the port number you'd like to run the router on" << std::endl;
+		std::cin >> router_port;
+	}
 
 	
 
+	if(routers != ""){
+		cluster_routers = split_routers(routers);
+		this_router = router_ip + ":" + router_port;
+		if(std::find(cluster_routers.begin(), cluster_routers.end(), this_router) == cluster_routers.end()){
+			std::cout << "this router (" << this_router << ") is not in the list of routers" << std::endl;
+			return 1;
+		}
+		std::thread(follow_leader).detach();
+	}
+
 	// now launch the server to give the client the information to connect to the server initially
 	// once the client gets info it will disconnect from this server and go to the available server
 	ServerBuilder builder;
@@ -0,0 +1,89 @@
+#ifndef ROUTER_CHANNEL_H
+#define ROUTER_CHANNEL_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <iostream>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <grpc++/grpc++.h>
+
+// a cluster can run several routers, they are given as one comma separated list
+// (<ip>:<port>,<ip>:<port>,...) to tsd, tsc, tsbench and every router itself
+// clients reach them over a single channel that knows all of them: requests are spread over the
+// routers round robin, a router that is down is skipped and a RequestForServer that fails because
+// its router went away is retried on another one
+
+// function that splits a comma separated list of routers
+std::vector<std::string> split_routers(const std::string& list){
+	std::vector<std::string> routers;
+	size_t begin = 0;
+	while(begin <= list.size()){
+		size_t end = list.find(',', begin);
+		if(end == std::string::npos){
+			end = list.size();
+		}
+		if(end > begin){
+			routers.push_back(list.substr(begin, end - begin));
+		}
+		begin = end + 1;
+	}
+	return routers;
+}
+
+// helper function that resolves host:port to a numeric ipv4 address:port, empty if it can't
+std::string resolve_router(const std::string& router){
+	size_t colon = router.rfind(':');
+	if(colon == std::string::npos){
+		return "";
+	}
+	struct addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo* found = nullptr;
+	if(getaddrinfo(router.substr(0, colon).c_str(), router.substr(colon + 1).c_str(), &hints, &found) != 0){
+		return "";
+	}
+	char address[INET_ADDRSTRLEN];
+	struct sockaddr_in* ipv4 = (struct sockaddr_in*)found->ai_addr;
+	inet_ntop(AF_INET, &ipv4->sin_addr, address, sizeof(address));
+	freeaddrinfo(found);
+	return std::string(address) + router.substr(colon);
+}
+
+// retries of RequestForServer and the balancing policy of a router channel
+const char* ROUTER_SERVICE_CONFIG =
+	"{\"loadBalancingConfig\": [{\"round_robin\": {}}],"
+	" \"methodConfig\": [{\"name\": [{\"service\": \"TNSService.user_services\", \"method\": \"RequestForServer\"}],"
+	" \"retryPolicy\": {\"maxAttempts\": 4, \"initialBackoff\": \"0.05s\", \"maxBackoff\": \"1s\","
+	" \"backoffMultiplier\": 2, \"retryableStatusCodes\": [\"UNAVAILABLE\"]}}]}";
+
+// function that returns a channel to every router of a comma separated list
+// a single router is used as given, a list needs addresses that resolve to ipv4
+std::shared_ptr<grpc::Channel> router_channel(const std::string& list){
+	std::vector<std::string> routers = split_routers(list);
+	if(routers.size() <= 1){
+		return grpc::CreateChannel(list, grpc::InsecureChannelCredentials());
+	}
+	std::string target = "ipv4:";
+	int resolved = 0;
+	for(int i = 0; i < routers.size(); i++){
+		std::string address = resolve_router(routers.at(i));
+		if(address == ""){
+			std::cerr << "could not resolve router " << routers.at(i) << std::endl;
+			continue;
+		}
+		target += (resolved++ > 0 ? "," : "") + address;
+	}
+	if(resolved == 0){
+		return grpc::CreateChannel(routers.at(0), grpc::InsecureChannelCredentials());
+	}
+	grpc::ChannelArguments args;
+	args.SetServiceConfigJSON(ROUTER_SERVICE_CONFIG);
+	return grpc::CreateCustomChannel(target, grpc::InsecureChannelCredentials(), args);
+}
+
+#endif
@@ -0,0 +1,271 @@
+#ifndef SEARCH_INDEX_H
+#define SEARCH_INDEX_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+
+// inverted index over the content of posts, used by SearchPosts in tsd
+// every stored post gets the next post id and every word of its content (and every #hashtag)
+// gets the id appended to its posting list, ids only grow so a posting list is stored as
+// varint encoded differences in blocks of POSTING_BLOCK ids, the first id of every block is
+// kept next to the list so a query can jump to a block and read it without the ones before it
+// the index only knows post ids, it maps an id back to the user that posted it and the number
+// of that user's post (seq) and user_store.h reads the post itself
+
+// ids per block of a posting list
+const int POSTING_BLOCK = 128;
+
+// words longer than this aren't indexed
+const int MAX_TERM_BYTES = 64;
+
+struct posting_list {
+	std::string bytes;					// differences between the ids of each block
+	std::vector<uint64_t> block_first;	// first id of every block
+	std::vector<uint32_t> block_offset;	// where the differences of every block start in bytes
+	uint64_t last = 0;					// last id in the list
+	uint32_t count = 0;
+};
+
+// who posted a post and the number of the post among the user's posts
+struct post_ref {
+	uint32_t user;
+	uint32_t seq;
+};
+
+struct search_index {
+	std::unordered_map<std::string, posting_list> terms;
+	// post id - 1 to the post
+	std::vector<post_ref> posts;
+	// every user that posted gets a number so a post_ref stays small
+	std::vector<std::string> user_names;
+	std::unordered_map<std::string, uint32_t> user_numbers;
+	uint64_t posting_bytes = 0;
+};
+
+search_index post_search;
+
+// helper function that appends a varint
+void append_varint(std::string& bytes, uint64_t value){
+	while(value >= 0x80){
+		bytes.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+	bytes.push_back((char)value);
+}
+
+// helper function that reads a varint at position and moves position past it
+uint64_t read_varint(const std::string& bytes, size_t& position){
+	uint64_t value = 0;
+	int shift = 0;
+	while(position < bytes.size()){
+		uint8_t byte = bytes[position++];
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		if(byte < 0x80){
+			break;
+		}
+		shift += 7;
+	}
+	return value;
+}
+
+// function that splits text into the terms it is indexed under
+// terms are lower case runs of letters, digits and _ (bytes of utf-8 characters count as letters),
+// a run that follows a # is also indexed as #run so hashtags can be searched on their own
+std::vector<std::string> search_terms(const std::string& text){
+	std::vector<std::string> terms;
+	size_t i = 0;
+	while(i < text.size()){
+		unsigned char c = text[i];
+		bool word = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c >= 0x80;
+		if(!word){
+			i++;
+			continue;
+		}
+		size_t start = i;
+		std::string term;
+		while(i < text.size()){
+			c = text[i];
+			if((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_' || c >= 0x80){
+				term.push_back(c);
+			}
+			else if(c >= 'A' && c <= 'Z'){
+				term.push_back(c - 'A' + 'a');
+			}
+			else{
+				break;
+			}
+			i++;
+		}
+		if(term.size() > MAX_TERM_BYTES){
+			continue;
+		}
+		if(start > 0 && text[start - 1] == '#'){
+			terms.push_back("#" + term);
+		}
+		terms.push_back(term);
+	}
+	return terms;
+}
+
+// function that adds a post to the index, returns the post's id
+// seq is the number of the post among the user's posts
+uint64_t index_post(const std::string& username, uint64_t seq, const std::string& content){
+	search_index& index = post_search;
+	auto number = index.user_numbers.find(username);
+	if(number == index.user_numbers.end()){
+		number = index.user_numbers.insert(std::make_pair(username, (uint32_t)index.user_names.size())).first;
+		index.user_names.push_back(username);
+	}
+	post_ref ref;
+	ref.user = number->second;
+	ref.seq = seq;
+	index.posts.push_back(ref);
+	uint64_t id = index.posts.size();
+
+	std::vector<std::string> terms = search_terms(content);
+	for(int i = 0; i < terms.size(); i++){
+		posting_list& list = index.terms[terms.at(i)];
+		// a word that is in the post twice is only added once
+		if(list.count > 0 && list.last == id){
+			continue;
+		}
+		size_t before = list.bytes.size();
+		if(list.count % POSTING_BLOCK == 0){
+			list.block_first.push_back(id);
+			list.block_offset.push_back(list.bytes.size());
+		}
+		else{
+			append_varint(list.bytes, id - list.last);
+		}
+		list.last = id;
+		list.count++;
+		index.posting_bytes += list.bytes.size() - before;
+	}
+	return id;
+}
+
+// function that stops the posts of a removed user from being found, their ids stay in the
+// posting lists but lead to no user, a new user with the same name gets a new number
+void forget_indexed_user(const std::string& username){
+	auto number = post_search.user_numbers.find(username);
+	if(number != post_search.user_numbers.end()){
+		post_search.user_names.at(number->second) = "";
+		post_search.user_numbers.erase(number);
+	}
+}
+
+// helper function that decodes block b of a posting list
+void decode_block(const posting_list& list, int b, std::vector<uint64_t>& ids){
+	ids.clear();
+	int entries = b + 1 < list.block_first.size() ? POSTING_BLOCK : list.count - b * POSTING_BLOCK;
+	uint64_t id = list.block_first.at(b);
+	ids.push_back(id);
+	size_t position = list.block_offset.at(b);
+	for(int i = 1; i < entries; i++){
+		id += read_varint(list.bytes, position);
+		ids.push_back(id);
+	}
+}
+
+// helper function that returns the block of a posting list that could hold id, -1 if none
+int block_of(const posting_list& list, uint64_t id){
+	return std::upper_bound(list.block_first.begin(), list.block_first.end(), id) - list.block_first.begin() - 1;
+}
+
+// a posting list being read during a query and the last block decoded from it
+struct posting_cursor {
+	const posting_list* list;
+	int block = -1;
+	std::vector<uint64_t> ids;
+};
+
+// helper function that checks whether a posting list contains id
+bool posting_contains(posting_cursor& cursor, uint64_t id){
+	int b = block_of(*cursor.list, id);
+	if(b < 0){
+		return false;
+	}
+	if(b != cursor.block){
+		decode_block(*cursor.list, b, cursor.ids);
+		cursor.block = b;
+	}
+	return std::binary_search(cursor.ids.begin(), cursor.ids.end(), id);
+}
+
+// function that returns the ids of up to page_size posts that contain every term of query,
+// newest first, starting below before (0 means the newest post)
+// returns true if there are more matching posts after the page
+bool search_index_query(const std::string& query, uint64_t before, int page_size, std::vector<uint64_t>& ids){
+	std::vector<std::string> terms = search_terms(query);
+	std::sort(terms.begin(), terms.end());
+	terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+	if(terms.empty()){
+		return false;
+	}
+	std::vector<posting_cursor> lists;
+	for(int i = 0; i < terms.size(); i++){
+		auto found = post_search.terms.find(terms.at(i));
+		if(found == post_search.terms.end()){
+			return false;
+		}
+		posting_cursor cursor;
+		cursor.list = &found->second;
+		lists.push_back(cursor);
+	}
+	// the shortest list drives the query, the others are only probed
+	std::sort(lists.begin(), lists.end(), [](const posting_cursor& a, const posting_cursor& b){
+		return a.list->count < b.list->count;
+	});
+
+	const posting_list& driver = *lists.at(0).list;
+	if(before == 0){
+		before = driver.last + 1;
+	}
+	std::vector<uint64_t> block;
+	for(int b = block_of(driver, before - 1); b >= 0; b--){
+		decode_block(driver, b, block);
+		for(int i = block.size() - 1; i >= 0; i--){
+			if(block.at(i) >= before){
+				continue;
+			}
+			bool match = true;
+			for(int l = 1; l < lists.size() && match; l++){
+				match = posting_contains(lists.at(l), block.at(i));
+			}
+			if(match){
+				// one match past the page tells the caller there is more
+				if(ids.size() == page_size){
+					return true;
+				}
+				ids.push_back(block.at(i));
+			}
+		}
+	}
+	return false;
+}
+
+// function that returns about how many bytes the index uses
+uint64_t search_index_bytes(){
+	const search_index& index = post_search;
+	uint64_t total = index.posts.capacity() * sizeof(post_ref);
+	for(auto& entry : index.terms){
+		const posting_list& list = entry.second;
+		total += entry.first.capacity() + sizeof(posting_list) + list.bytes.capacity() +
+				list.block_first.capacity() * sizeof(uint64_t) + list.block_offset.capacity() * sizeof(uint32_t) +
+				2 * sizeof(void*);
+	}
+	for(int i = 0; i < index.user_names.size(); i++){
+		total += 2 * (index.user_names.at(i).capacity() + sizeof(std::string)) + sizeof(uint32_t) + 2 * sizeof(void*);
+	}
+	return total;
+}
+
+// function that empties the index
+void clear_search_index(){
+	post_search = search_index();
+}
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef SERVER_CONFIG_H
+#define SERVER_CONFIG_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdlib>
+#include <cerrno>
+#include <sched.h>
+#include <grpc++/grpc++.h>
+#include <grpcpp/support/server_interceptor.h>
+
+// runtime settings of tsd's grpc servers, read from a file of key = value lines (tsd -c) and from
+// single key=value overrides (tsd -o), # starts a comment
+// a setting left at 0 keeps grpc's default
+// listeners: this many servers listen on the same port with SO_REUSEPORT and the kernel spreads
+// new connections between them, each has its own threads, completion queues and resource quota
+// (the limits below are per listener) and with pin_cores its threads run on one core, listener i
+// on the i-th core this process may use; 0 starts one listener per core
+
+struct server_config {
+	int max_threads = 0;			// resource quota thread limit
+	int memory_mb = 0;			// resource quota memory limit
+	int completion_queues = 0;
+	int min_pollers = 0;
+	int max_pollers = 0;
+	int max_concurrent_streams = 0;		// per connection
+	int keepalive_time_ms = 10000;
+	int keepalive_timeout_ms = 5000;
+	int max_message_bytes = 0;		// sent and received
+	int listeners = 1;
+	int pin_cores = 0;
+	int compress_posts = 0;			// post bodies compressed in memory, see post_compression.h
+	int anti_entropy_seconds = 10;		// between rounds with every other master, see anti_entropy.h
+};
+
+server_config tsd_config;
+
+// function that sets one key of config, returns false with error set if the key or value is bad
+bool set_config_value(server_config& config, const std::string& key, const std::string& value, std::string& error){
+	char* end = nullptr;
+	errno = 0;
+	long number = std::strtol(value.c_str(), &end, 10);
+	if(value.empty() || *end != '\0' || errno != 0 || number < 0 || number > 1000000000){
+		error = "bad value for " + key + ": " + value;
+		return false;
+	}
+	if(key == "max_threads") config.max_threads = number;
+	else if(key == "memory_mb") config.memory_mb = number;
+	else if(key == "completion_queues") config.completion_queues = number;
+	else if(key == "min_pollers") config.min_pollers = number;
+	else if(key == "max_pollers") config.max_pollers = number;
+	else if(key == "max_concurrent_streams") config.max_concurrent_streams = number;
+	else if(key == "keepalive_time_ms") config.keepalive_time_ms = number;
+	else if(key == "keepalive_timeout_ms") config.keepalive_timeout_ms = number;
+	else if(key == "max_message_bytes") config.max_message_bytes = number;
+	else if(key == "listeners") config.listeners = number;
+	else if(key == "pin_cores") config.pin_cores = number;
+	else if(key == "compress_posts") config.compress_posts = number;
+	else if(key == "anti_entropy_seconds") config.anti_entropy_seconds = number;
+	else{
+		error = "unknown setting: " + key;
+		return false;
+	}
+	return true;
+}
+
+// helper function that trims spaces and tabs from both ends of text
+std::string trim_config(const std::string& text){
+	size_t begin = text.find_first_not_of(" \t\r");
+	if(begin == std::string::npos){
+		return "";
+	}
+	size_t end = text.find_last_not_of(" \t\r");
+	return text.substr(begin, end - begin + 1);
+}
+
+// function that applies a key=value override, returns false with error set if it is bad
+bool set_config_line(server_config& config, const std::string& line, std::string& error){
+	size_t equals = line.find('=');
+	if(equals == std::string::npos){
+		error = "expected key = value: " + line;
+		return false;
+	}
+	return set_config_value(config, trim_config(line.substr(0, equals)), trim_config(line.substr(equals + 1)), error);
+}
+
+// function that applies every line of a config file, returns false with error set on the first
+// bad line
+bool load_server_config(const std::string& path, server_config& config, std::string& error){
+	std::ifstream file(path);
+	if(!file.is_open()){
+		error = "could not open config " + path;
+		return false;
+	}
+	std::string line;
+	int number = 0;
+	while(std::getline(file, line)){
+		number++;
+		line = trim_config(line.substr(0, line.find('#')));
+		if(line.empty()){
+			continue;
+		}
+		if(!set_config_line(config, line, error)){
+			error = path + ":" + std::to_string(number) + ": " + error;
+			return false;
+		}
+	}
+	return true;
+}
+
+// function that returns the cores this process may run on (as set by taskset), in order
+std::vector<int> allowed_cores(){
+	std::vector<int> cores;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if(sched_getaffinity(0, sizeof(set), &set) == 0){
+		for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+			if(CPU_ISSET(cpu, &set)){
+				cores.push_back(cpu);
+			}
+		}
+	}
+	if(cores.empty()){
+		cores.push_back(0);
+	}
+	return cores;
+}
+
+// function that returns the number of listeners config starts
+int listener_count(const server_config& config){
+	return config.listeners > 0 ? config.listeners : allowed_cores().size();
+}
+
+// pins the threads of one listener to a core
+// a sync server runs the interceptor factories of a call on the thread that handles it, so every
+// thread of the listener is pinned the first time it takes a call and nothing is intercepted
+class pin_to_core : public grpc::experimental::ServerInterceptorFactoryInterface {
+	public:
+		explicit pin_to_core(int core) : core(core) {}
+		grpc::experimental::Interceptor* CreateServerInterceptor(grpc::experimental::ServerRpcInfo* info) override {
+			thread_local int pinned = -1;
+			if(pinned != core){
+				cpu_set_t set;
+				CPU_ZERO(&set);
+				CPU_SET(core, &set);
+				sched_setaffinity(0, sizeof(set), &set);
+				pinned = core;
+			}
+			return nullptr;
+		}
+	private:
+		int core;
+};
+
+// function that applies config to the builder of listener number listener
+void apply_server_config(grpc::ServerBuilder& builder, const server_config& config, int listener){
+	if(config.max_threads > 0 || config.memory_mb > 0){
+		grpc::ResourceQuota quota("tsd-listener-" + std::to_string(listener));
+		if(config.max_threads > 0){
+			quota.SetMaxThreads(config.max_threads);
+		}
+		if(config.memory_mb > 0){
+			quota.Resize((size_t)config.memory_mb * 1024 * 1024);
+		}
+		builder.SetResourceQuota(quota);
+	}
+	if(config.completion_queues > 0){
+		builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::NUM_CQS, config.completion_queues);
+	}
+	if(config.min_pollers > 0){
+		builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::MIN_POLLERS, config.min_pollers);
+	}
+	if(config.max_pollers > 0){
+		builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::MAX_POLLERS, config.max_pollers);
+	}
+	if(config.max_concurrent_streams > 0){
+		builder.AddChannelArgument(GRPC_ARG_MAX_CONCURRENT_STREAMS, config.max_concurrent_streams);
+	}
+	if(config.max_message_bytes > 0){
+		builder.SetMaxReceiveMessageSize(config.max_message_bytes);
+		builder.SetMaxSendMessageSize(config.max_message_bytes);
+	}
+	// clients that vanish without closing their connection are found by keepalive pings,
+	// their calls are cancelled so the handlers return and give their threads back
+	builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_TIME_MS, config.keepalive_time_ms);
+	builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_TIMEOUT_MS, config.keepalive_timeout_ms);
+	builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+	builder.AddChannelArgument(GRPC_ARG_HTTP2_MAX_PINGS_WITHOUT_DATA, 0);
+	if(listener_count(config) > 1){
+		builder.AddChannelArgument(GRPC_ARG_ALLOW_REUSEPORT, 1);
+	}
+	if(config.pin_cores){
+		std::vector<int> cores = allowed_cores();
+		std::vector<std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface>> pins;
+		pins.push_back(std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface>(
+				new pin_to_core(cores.at(listener % cores.size()))));
+		builder.experimental().SetInterceptorCreators(std::move(pins));
+	}
+}
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef SLAB_POOL_H
+#define SLAB_POOL_H
+
+#include <string>
+#include <mutex>
+#include <new>
+#include <cstdint>
+#include <sys/mman.h>
+
+// slab pools for the records of the store (user_store.h, post_record.h)
+// a pool hands out slots of one size carved from SLAB_BLOCK_BYTES blocks that are mapped from the
+// system aligned to their size, so the block of a slot is found by masking the slot's address;
+// every block keeps a free list of its slots and the pool a list of the blocks with free slots,
+// a freed slot is reused before the pool maps another block, and a block whose slots are all free
+// is unmapped once the pool has another empty block to spare
+// records of one kind stay packed in a few blocks instead of being spread over the heap between
+// strings and vectors of every size, and the memory of deleted users and dropped posts goes back
+// to the system instead of staying in holes of the heap
+
+const size_t SLAB_BLOCK_BYTES = 64 * 1024;
+// the block header is followed by the first slot
+const size_t SLAB_HEADER_BYTES = 64;
+
+struct slab_pool;
+
+struct slab_block {
+	slab_pool* pool;
+	// neighbours in the pool's list of blocks with free slots
+	slab_block* previous;
+	slab_block* next;
+	bool listed;
+	// freed slots, each one holds the next in its first bytes
+	void* free_slots;
+	// slots handed out now, and slots carved from the block so far (the rest were never used)
+	uint32_t used;
+	uint32_t carved;
+};
+
+struct slab_pool {
+	std::string name;
+	size_t slot_bytes;
+	uint32_t slots_per_block;
+	std::mutex pool_mutex;
+	slab_block* available = nullptr;
+	uint64_t blocks = 0;
+	uint64_t empty_blocks = 0;
+	uint64_t used_slots = 0;
+
+	slab_pool(const std::string& pool_name, size_t bytes) : name(pool_name) {
+		// slots are 16 byte aligned and big enough for the free list link
+		slot_bytes = ((bytes < sizeof(void*) ? sizeof(void*) : bytes) + 15) / 16 * 16;
+		slots_per_block = (SLAB_BLOCK_BYTES - SLAB_HEADER_BYTES) / slot_bytes;
+	}
+};
+
+// helper function that maps a new block aligned to SLAB_BLOCK_BYTES, nullptr if it can't
+// twice the size is mapped and the unaligned ends are unmapped again
+slab_block* map_slab_block(slab_pool& pool){
+	void* mapped = mmap(nullptr, 2 * SLAB_BLOCK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(mapped == MAP_FAILED){
+		return nullptr;
+	}
+	uintptr_t start = (uintptr_t)mapped;
+	uintptr_t aligned = (start + SLAB_BLOCK_BYTES - 1) & ~(uintptr_t)(SLAB_BLOCK_BYTES - 1);
+	if(aligned > start){
+		munmap(mapped, aligned - start);
+	}
+	if(aligned + SLAB_BLOCK_BYTES < start + 2 * SLAB_BLOCK_BYTES){
+		munmap((void*)(aligned + SLAB_BLOCK_BYTES), start + 2 * SLAB_BLOCK_BYTES - aligned - SLAB_BLOCK_BYTES);
+	}
+	slab_block* block = (slab_block*)aligned;
+	block->pool = &pool;
+	block->previous = nullptr;
+	block->next = nullptr;
+	block->listed = false;
+	block->free_slots = nullptr;
+	block->used = 0;
+	block->carved = 0;
+	pool.blocks++;
+	pool.empty_blocks++;
+	return block;
+}
+
+// helper functions that add a block to the front of the pool's list of blocks with free slots
+// and take it out again, the caller holds pool_mutex
+void list_slab_block(slab_pool& pool, slab_block* block){
+	block->previous = nullptr;
+	block->next = pool.available;
+	if(pool.available != nullptr){
+		pool.available->previous = block;
+	}
+	pool.available = block;
+	block->listed = true;
+}
+
+void unlist_slab_block(slab_pool& pool, slab_block* block){
+	if(block->previous != nullptr){
+		block->previous->next = block->next;
+	}
+	else{
+		pool.available = block->next;
+	}
+	if(block->next != nullptr){
+		block->next->previous = block->previous;
+	}
+	block->listed = false;
+}
+
+// function that returns a free slot of the pool, throws std::bad_alloc like new when no block can
+// be mapped
+void* slab_allocate(slab_pool& pool){
+	std::lock_guard<std::mutex> lock(pool.pool_mutex);
+	slab_block* block = pool.available;
+	if(block == nullptr){
+		block = map_slab_block(pool);
+		if(block == nullptr){
+			throw std::bad_alloc();
+		}
+		list_slab_block(pool, block);
+	}
+	void* slot = block->free_slots;
+	if(slot != nullptr){
+		block->free_slots = *(void**)slot;
+	}
+	else{
+		slot = (char*)block + SLAB_HEADER_BYTES + (size_t)block->carved * pool.slot_bytes;
+		block->carved++;
+	}
+	if(block->used++ == 0){
+		pool.empty_blocks--;
+	}
+	pool.used_slots++;
+	if(block->free_slots == nullptr && block->carved == pool.slots_per_block){
+		unlist_slab_block(pool, block);
+	}
+	return slot;
+}
+
+// function that gives a slot back to the pool it came from
+void slab_free(void* slot){
+	slab_block* block = (slab_block*)((uintptr_t)slot & ~(uintptr_t)(SLAB_BLOCK_BYTES - 1));
+	slab_pool& pool = *block->pool;
+	std::lock_guard<std::mutex> lock(pool.pool_mutex);
+	*(void**)slot = block->free_slots;
+	block->free_slots = slot;
+	pool.used_slots--;
+	if(!block->listed){
+		list_slab_block(pool, block);
+	}
+	if(--block->used > 0){
+		return;
+	}
+	// keep one empty block so a pool that hovers around a block boundary doesn't map and unmap
+	if(pool.empty_blocks > 0){
+		unlist_slab_block(pool, block);
+		munmap(block, SLAB_BLOCK_BYTES);
+		pool.blocks--;
+	}
+	else{
+		pool.empty_blocks++;
+	}
+}
+
+// functions that construct an object in a slot of a pool and destroy it
+template<typename T>
+T* slab_new(slab_pool& pool){
+	return new (slab_allocate(pool)) T();
+}
+
+template<typename T>
+void slab_delete(T* object){
+	if(object != nullptr){
+		object->~T();
+		slab_free(object);
+	}
+}
+
+// function that reads how many blocks a pool has mapped and how many slots are in use
+void slab_usage(slab_pool& pool, uint64_t& blocks, uint64_t& used_slots){
+	std::lock_guard<std::mutex> lock(pool.pool_mutex);
+	blocks = pool.blocks;
+	used_slots = pool.used_slots;
+}
+
+#endif
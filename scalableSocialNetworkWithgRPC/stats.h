@@ -0,0 +1,235 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <cstdlib>
+#include <iostream>
+
+#include "TNSService.pb.h"
+#include "latency_histogram.h"
+
+using TNSService::stats_reply;
+
+// statistics shared by tsd and the router
+// every thread records into its own histograms so the rpc path never takes a lock,
+// GetStats merges the per thread histograms when somebody asks for them
+
+// most metrics a process can register, register_metric aborts past it
+const int MAX_METRICS = 64;
+
+// histogram owned by one thread, the owning thread is the only writer so relaxed
+// load/store pairs are enough and GetStats can read it at any time
+struct thread_histogram {
+	std::atomic<uint64_t> counts[latency_histogram::NUM_BUCKETS];
+	std::atomic<uint64_t> sum;
+	std::atomic<uint64_t> max_value;
+
+	thread_histogram() : sum(0), max_value(0) {
+		for(int i = 0; i < latency_histogram::NUM_BUCKETS; i++){
+			counts[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	void record(uint64_t value) {
+		std::atomic<uint64_t>& bucket = counts[latency_histogram::index_of(value)];
+		bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		if(value > max_value.load(std::memory_order_relaxed)){
+			max_value.store(value, std::memory_order_relaxed);
+		}
+	}
+
+	void merge_into(latency_histogram& total) const {
+		for(int i = 0; i < latency_histogram::NUM_BUCKETS; i++){
+			uint64_t n = counts[i].load(std::memory_order_relaxed);
+			if(n != 0){
+				total.add_bucket(i, n);
+			}
+		}
+		total.add_summary(sum.load(std::memory_order_relaxed), max_value.load(std::memory_order_relaxed));
+	}
+};
+
+// the histograms of one thread, one per metric it recorded
+struct histogram_set {
+	thread_histogram* by_metric[MAX_METRICS] = {};
+};
+
+// names of the registered metrics and every thread's histogram for each of them
+// histograms are never freed, the set of a thread that exits is handed to the next new thread
+// (which becomes its only writer), so grpc growing and shrinking its pool doesn't leave sets behind
+struct metric_registry {
+	std::mutex registry_mutex;
+	std::vector<std::string> names;
+	std::vector<bool> is_latency;
+	std::vector<std::vector<thread_histogram*>> histograms;
+	std::vector<histogram_set*> free_sets;
+};
+
+metric_registry metrics;
+
+// gives a thread's set back when the thread exits
+struct histogram_owner {
+	histogram_set* set = nullptr;
+	~histogram_owner() {
+		if(set != nullptr){
+			std::lock_guard<std::mutex> lock(metrics.registry_mutex);
+			metrics.free_sets.push_back(set);
+		}
+	}
+};
+
+// each thread's histograms, taken the first time the thread records a metric
+thread_local histogram_owner my_histograms;
+
+// function that registers a metric and returns the id used to record it
+// latency metrics are in nanoseconds and reported per rpc method, other metrics
+// (like the number of followers a post was sent to) are reported as distributions
+int register_metric(const std::string& name, bool is_latency){
+	std::lock_guard<std::mutex> lock(metrics.registry_mutex);
+	if(metrics.names.size() >= MAX_METRICS){
+		// metrics are registered while the process starts, histogram_set has room for MAX_METRICS
+		std::cerr<<"too many metrics, raise MAX_METRICS for "<<name<<std::endl;
+		std::abort();
+	}
+	metrics.names.push_back(name);
+	metrics.is_latency.push_back(is_latency);
+	metrics.histograms.push_back(std::vector<thread_histogram*>());
+	return metrics.names.size() - 1;
+}
+
+// function that records a value for a metric on the calling thread
+void record_metric(int id, uint64_t value){
+	histogram_set* set = my_histograms.set;
+	if(set == nullptr){
+		std::lock_guard<std::mutex> lock(metrics.registry_mutex);
+		if(metrics.free_sets.empty()){
+			set = new histogram_set();
+		}
+		else{
+			set = metrics.free_sets.back();
+			metrics.free_sets.pop_back();
+		}
+		my_histograms.set = set;
+	}
+	thread_histogram* histogram = set->by_metric[id];
+	if(histogram == nullptr){
+		histogram = new thread_histogram();
+		std::lock_guard<std::mutex> lock(metrics.registry_mutex);
+		metrics.histograms.at(id).push_back(histogram);
+		set->by_metric[id] = histogram;
+	}
+	histogram->record(value);
+}
+
+uint64_t stats_now_ns(){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// records the time between its creation and destruction as a latency metric
+class scoped_latency {
+	public:
+		explicit scoped_latency(int metric_id) : id(metric_id), start(stats_now_ns()) {}
+		~scoped_latency() { record_metric(id, stats_now_ns() - start); }
+	private:
+		int id;
+		uint64_t start;
+};
+
+// count of streaming rpcs currently open, kept up to date by stream_counter
+std::atomic<int64_t> active_streams(0);
+
+// counts a streaming rpc as active for as long as the handler runs
+class stream_counter {
+	public:
+		stream_counter() { active_streams++; }
+		~stream_counter() { active_streams--; }
+};
+
+// function that reads the number of threads and the resident memory of this process from /proc
+void read_process_usage(int64_t& threads, int64_t& rss_bytes){
+	threads = 0;
+	rss_bytes = 0;
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while(std::getline(status, line)){
+		if(line.compare(0, 8, "Threads:") == 0){
+			threads = std::atoll(line.c_str() + 8);
+		}
+		else if(line.compare(0, 6, "VmRSS:") == 0){
+			rss_bytes = std::atoll(line.c_str() + 6) * 1024;
+		}
+	}
+}
+
+// function that adds a gauge to a stats reply
+void add_gauge(stats_reply* reply, const std::string& name, double value){
+	TNSService::gauge* g = reply->add_gauges();
+	g->set_name(name);
+	g->set_value(value);
+}
+
+// function that merges every thread's histograms and adds them to a stats reply
+void add_metrics(stats_reply* reply){
+	std::lock_guard<std::mutex> lock(metrics.registry_mutex);
+	for(int id = 0; id < metrics.names.size(); id++){
+		latency_histogram total;
+		for(int i = 0; i < metrics.histograms.at(id).size(); i++){
+			metrics.histograms.at(id).at(i)->merge_into(total);
+		}
+		TNSService::distribution* d = metrics.is_latency.at(id) ? reply->add_latencies() : reply->add_distributions();
+		d->set_name(metrics.names.at(id));
+		d->set_count(total.count());
+		d->set_mean(total.mean());
+		d->set_p50(total.percentile(50));
+		d->set_p99(total.percentile(99));
+		d->set_p999(total.percentile(99.9));
+		d->set_max(total.max());
+	}
+}
+
+// helper function that writes one distribution in the prometheus summary format
+// labels is either empty or a list like method="ListRequest"
+void write_summary(std::ostringstream& out, const std::string& metric, const std::string& labels,
+		const TNSService::distribution& d, double scale){
+	std::string quantile = labels.empty() ? "{quantile=" : "{" + labels + ",quantile=";
+	std::string plain = labels.empty() ? "" : "{" + labels + "}";
+	out << metric << quantile << "\"0.5\"} " << d.p50() * scale << "\n";
+	out << metric << quantile << "\"0.99\"} " << d.p99() * scale << "\n";
+	out << metric << quantile << "\"0.999\"} " << d.p999() * scale << "\n";
+	out << metric << "_sum" << plain << " " << (double)d.mean() * d.count() * scale << "\n";
+	out << metric << "_count" << plain << " " << d.count() << "\n";
+}
+
+// function that renders a stats reply in the prometheus text format into reply->exposition()
+// prefix is the name of the process ("tsd" or "router")
+void build_exposition(stats_reply* reply, const std::string& prefix){
+	std::ostringstream out;
+	out << std::setprecision(9);
+	std::string latency_metric = prefix + "_rpc_latency_seconds";
+	out << "# TYPE " << latency_metric << " summary\n";
+	for(int i = 0; i < reply->latencies_size(); i++){
+		write_summary(out, latency_metric, "method=\"" + reply->latencies(i).name() + "\"", reply->latencies(i), 1e-9);
+	}
+	for(int i = 0; i < reply->distributions_size(); i++){
+		std::string metric = prefix + "_" + reply->distributions(i).name();
+		out << "# TYPE " << metric << " summary\n";
+		write_summary(out, metric, "", reply->distributions(i), 1);
+	}
+	for(int i = 0; i < reply->gauges_size(); i++){
+		std::string metric = prefix + "_" + reply->gauges(i).name();
+		out << "# TYPE " << metric << " gauge\n";
+		out << metric << " " << reply->gauges(i).value() << "\n";
+	}
+	reply->set_exposition(out.str());
+}
+
+#endif
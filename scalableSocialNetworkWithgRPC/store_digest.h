@@ -0,0 +1,130 @@
+#ifndef STORE_DIGEST_H
+#define STORE_DIGEST_H
+
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+
+// digests of the store for the anti entropy between masters (anti_entropy.h)
+// every user registered on this server has a leaf digest made of their name, the users they
+// follow, the follows and unfollows that have a time and the ids of their posts, a deleted user
+// leaves a tombstone with the time of the delete instead
+// a user of another master known here (user::home) carries the leaf their own master has, as the
+// anti entropy last saw it, so the trees of two masters match once they agree on every user
+// leaves go into SYNC_BUCKETS buckets by a hash of the name, a bucket is the sum of its leaves
+// (mod 2^64) and every node of the tree above the buckets the sum of its SYNC_FANOUT children, so a
+// change moves one bucket by the difference of one leaf, and the tree is added up from the buckets
+// when another master asks for it
+// the store (user_store.h) keeps the leaves up to date as users, follows and posts change
+
+const int SYNC_FANOUT = 16;
+const int SYNC_LEVELS = 4;
+const int SYNC_BUCKETS = 65536;
+// posts are compared by the hour of their time
+const int64_t SYNC_RANGE_SECONDS = 3600;
+
+// keep the parts of a leaf from cancelling each other out
+const uint64_t FOLLOW_SALT = 0x6a09e667f3bcc908ULL;
+const uint64_t UNFOLLOW_SALT = 0xbb67ae8584caa73bULL;
+const uint64_t POSTS_SALT = 0x3c6ef372fe94f82bULL;
+const uint64_t TOMBSTONE_SALT = 0xa54ff53a5f1d36f1ULL;
+
+struct store_digest_state {
+	uint64_t buckets[SYNC_BUCKETS] = {};
+	// users deleted and when, a delete from a log written before deletes were logged with their
+	// time has time 1 so it is older than any change with a time and newer than the users replayed
+	// with it
+	std::unordered_map<std::string, uint64_t> deleted_users;
+};
+
+store_digest_state store_digest;
+
+// function that returns the time of a change, in nanoseconds of the wall clock so the times of
+// different masters can be compared
+uint64_t change_time_ns(){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// function that spreads the bits of x (the splitmix64 finalizer)
+uint64_t digest_mix(uint64_t x){
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+// function that hashes size bytes at data, the same on every master
+uint64_t digest_hash(const char* data, size_t size){
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(size_t i = 0; i < size; i++){
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return digest_mix(hash);
+}
+
+uint64_t digest_hash(const std::string& text){
+	return digest_hash(text.data(), text.size());
+}
+
+int digest_bucket(const std::string& username){
+	return digest_hash(username) >> 48;
+}
+
+// function that returns the id of a post, the same on every master whether the post came from a
+// client (its time and content end with a new line) or from a log (they don't)
+uint64_t post_digest_id(const char* username, size_t username_size, const char* time, size_t time_size,
+		const char* content, size_t content_size){
+	if(time_size > 0 && time[time_size - 1] == '\n'){
+		time_size--;
+	}
+	if(content_size > 0 && content[content_size - 1] == '\n'){
+		content_size--;
+	}
+	return digest_mix(digest_hash(username, username_size) + 3 * digest_hash(time, time_size) +
+			5 * digest_hash(content, content_size));
+}
+
+uint64_t post_digest_id(const std::string& username, const std::string& time, const std::string& content){
+	return post_digest_id(username.data(), username.size(), time.data(), time.size(), content.data(), content.size());
+}
+
+// function that returns the start of the range of a post with the given time (see post_time_of)
+int64_t digest_range(int64_t time){
+	return (time >= 0 ? time : time - SYNC_RANGE_SECONDS + 1) / SYNC_RANGE_SECONDS * SYNC_RANGE_SECONDS;
+}
+
+uint64_t tombstone_digest(const std::string& username, uint64_t time){
+	return digest_mix((digest_hash(username) ^ TOMBSTONE_SALT) + time);
+}
+
+// functions that leave and take away the tombstone of a deleted user
+void set_user_tombstone(const std::string& username, uint64_t time){
+	uint64_t& bucket = store_digest.buckets[digest_bucket(username)];
+	auto found = store_digest.deleted_users.find(username);
+	if(found != store_digest.deleted_users.end()){
+		bucket -= tombstone_digest(username, found->second);
+	}
+	store_digest.deleted_users[username] = time;
+	bucket += tombstone_digest(username, time);
+}
+
+void clear_user_tombstone(const std::string& username){
+	auto found = store_digest.deleted_users.find(username);
+	if(found != store_digest.deleted_users.end()){
+		store_digest.buckets[digest_bucket(username)] -= tombstone_digest(username, found->second);
+		store_digest.deleted_users.erase(found);
+	}
+}
+
+// function that returns the time of a user's tombstone, 0 when there is none
+uint64_t user_tombstone(const std::string& username){
+	auto found = store_digest.deleted_users.find(username);
+	return found == store_digest.deleted_users.end() ? 0 : found->second;
+}
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef SUGGEST_H
+#define SUGGEST_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "user_store.h"
+
+// who to follow suggestions (SuggestFollows in tsd)
+// a user's candidates are the users followed by the users they follow, ranked by how many of the
+// users they follow follow the candidate (shared connections), users they already follow are
+// left out; the users two hops away are copied out of the bitmap follow graph (follow_graph.h)
+// under users_db_mutex and counted without it, split between the threads of a pool when the user
+// follows many others
+// suggestions are computed ahead of requests by a background worker: every user once the log is
+// replayed, and again for the follower and the follower's followers after a follow or unfollow,
+// a request is answered from the last result and only computes when there is none yet
+
+// threads a traversal is split between and the number of followed users it takes to split it
+const int SUGGEST_THREADS = 4;
+const int PARALLEL_SUGGEST_MIN = 256;
+
+// suggestions kept per user, SuggestFollows returns at most this many
+const int MAX_SUGGESTIONS = 50;
+
+// a follow or unfollow changes the second hop of the follower's followers as well, this many of
+// them are refreshed
+const int SUGGEST_REFRESH_FOLLOWERS = 1000;
+
+struct suggestion {
+	uint32_t id;
+	uint32_t shared;
+};
+
+struct suggestion_cache {
+	// last suggestions of every user they were computed for, guarded by users_db_mutex
+	std::unordered_map<uint32_t, std::vector<suggestion>> ready;
+	// users the worker computes suggestions for next
+	std::deque<uint32_t> queue;
+	std::unordered_set<uint32_t> queued;
+	std::mutex queue_mutex;
+	std::condition_variable queue_ready;
+};
+
+suggestion_cache suggestions;
+
+// the users a user follows (sorted) and the users each of them follows, copied from the graph
+struct second_hop_snapshot {
+	uint32_t user;
+	std::vector<uint32_t> middle;
+	std::vector<std::vector<uint32_t>> hops;
+};
+
+// threads the traversals of all users share, started the first time a traversal is split
+struct suggest_pool_state {
+	std::mutex pool_mutex;
+	std::condition_variable work_ready;
+	std::condition_variable work_done;
+	std::deque<std::function<void()>> jobs;
+	int unfinished = 0;
+	bool started = false;
+};
+
+suggest_pool_state suggest_pool;
+
+// thread of the pool, runs jobs as they are queued
+void suggest_pool_thread(){
+	while(true){
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(suggest_pool.pool_mutex);
+			suggest_pool.work_ready.wait(lock, [](){ return !suggest_pool.jobs.empty(); });
+			job = std::move(suggest_pool.jobs.front());
+			suggest_pool.jobs.pop_front();
+		}
+		job();
+		std::lock_guard<std::mutex> lock(suggest_pool.pool_mutex);
+		suggest_pool.unfinished--;
+		suggest_pool.work_done.notify_all();
+	}
+}
+
+// function that runs jobs on the pool and the calling thread and returns once all of them ran
+void run_in_suggest_pool(std::vector<std::function<void()>>& jobs){
+	{
+		std::lock_guard<std::mutex> lock(suggest_pool.pool_mutex);
+		if(!suggest_pool.started){
+			for(int t = 1; t < SUGGEST_THREADS; t++){
+				std::thread(suggest_pool_thread).detach();
+			}
+			suggest_pool.started = true;
+		}
+		for(int i = 1; i < jobs.size(); i++){
+			suggest_pool.jobs.push_back(jobs.at(i));
+			suggest_pool.unfinished++;
+		}
+		suggest_pool.work_ready.notify_all();
+	}
+	jobs.at(0)();
+	std::unique_lock<std::mutex> lock(suggest_pool.pool_mutex);
+	// the pool is shared, so wait for every job queued so far, not only these
+	suggest_pool.work_done.wait(lock, [](){ return suggest_pool.unfinished == 0; });
+}
+
+// function that copies what a traversal for user reads from the graph, the caller holds users_db_mutex
+second_hop_snapshot snapshot_second_hop(uint32_t user){
+	second_hop_snapshot snapshot;
+	snapshot.user = user;
+	snapshot.middle = set_ids(social_graph.following.at(user));
+	snapshot.hops.resize(snapshot.middle.size());
+	for(size_t i = 0; i < snapshot.middle.size(); i++){
+		snapshot.hops[i] = set_ids(social_graph.following.at(snapshot.middle[i]));
+	}
+	return snapshot;
+}
+
+// helper function that counts the users followed by middle[begin, end) into counts as
+// (id, number of users in the range that follow it), leaving out user and whom user follows
+void count_second_hop(const second_hop_snapshot& snapshot, size_t begin, size_t end, std::vector<suggestion>& counts){
+	std::vector<uint32_t> hops;
+	for(size_t i = begin; i < end; i++){
+		for(size_t h = 0; h < snapshot.hops[i].size(); h++){
+			if(snapshot.hops[i][h] != snapshot.user){
+				hops.push_back(snapshot.hops[i][h]);
+			}
+		}
+	}
+	std::sort(hops.begin(), hops.end());
+	for(size_t i = 0; i < hops.size();){
+		size_t run = i;
+		while(run < hops.size() && hops[run] == hops[i]){
+			run++;
+		}
+		if(!std::binary_search(snapshot.middle.begin(), snapshot.middle.end(), hops[i])){
+			suggestion counted;
+			counted.id = hops[i];
+			counted.shared = run - i;
+			counts.push_back(counted);
+		}
+		i = run;
+	}
+}
+
+// function that returns the best MAX_SUGGESTIONS candidates of a snapshot, most shared connections
+// first, the graph isn't read so users_db_mutex needn't be held
+std::vector<suggestion> rank_suggestions(const second_hop_snapshot& snapshot){
+	const std::vector<uint32_t>& middle = snapshot.middle;
+	int threads = 1;
+	if(middle.size() >= PARALLEL_SUGGEST_MIN){
+		threads = std::min<int>(SUGGEST_THREADS, std::max<unsigned>(1, std::thread::hardware_concurrency()));
+	}
+	std::vector<std::vector<suggestion>> parts(threads);
+	if(threads == 1){
+		count_second_hop(snapshot, 0, middle.size(), parts.at(0));
+	}
+	else{
+		std::vector<std::function<void()>> jobs;
+		for(int t = 0; t < threads; t++){
+			size_t begin = middle.size() * t / threads;
+			size_t end = middle.size() * (t + 1) / threads;
+			std::vector<suggestion>* part = &parts.at(t);
+			jobs.push_back([&snapshot, begin, end, part](){ count_second_hop(snapshot, begin, end, *part); });
+		}
+		run_in_suggest_pool(jobs);
+	}
+
+	// the same candidate can be counted by several threads
+	std::vector<suggestion> counts;
+	for(int t = 0; t < threads; t++){
+		counts.insert(counts.end(), parts.at(t).begin(), parts.at(t).end());
+	}
+	if(threads > 1){
+		std::sort(counts.begin(), counts.end(), [](const suggestion& a, const suggestion& b){ return a.id < b.id; });
+		size_t merged = 0;
+		for(size_t i = 0; i < counts.size(); i++){
+			if(merged > 0 && counts[merged - 1].id == counts[i].id){
+				counts[merged - 1].shared += counts[i].shared;
+			}
+			else{
+				counts[merged++] = counts[i];
+			}
+		}
+		counts.resize(merged);
+	}
+	auto better = [](const suggestion& a, const suggestion& b){
+		return a.shared > b.shared || (a.shared == b.shared && a.id < b.id);
+	};
+	if(counts.size() > MAX_SUGGESTIONS){
+		std::partial_sort(counts.begin(), counts.begin() + MAX_SUGGESTIONS, counts.end(), better);
+		counts.resize(MAX_SUGGESTIONS);
+	}
+	else{
+		std::sort(counts.begin(), counts.end(), better);
+	}
+	return counts;
+}
+
+// function that returns the best MAX_SUGGESTIONS candidates for user, the caller holds users_db_mutex
+std::vector<suggestion> compute_suggestions(uint32_t user){
+	return rank_suggestions(snapshot_second_hop(user));
+}
+
+// function that asks the worker to compute a user's suggestions again
+void queue_suggestions(uint32_t user){
+	std::lock_guard<std::mutex> lock(suggestions.queue_mutex);
+	if(suggestions.queued.insert(user).second){
+		suggestions.queue.push_back(user);
+		suggestions.queue_ready.notify_one();
+	}
+}
+
+// function called after follower followed or unfollowed someone, the caller holds users_db_mutex
+void refresh_suggestions_after_follow(const std::string& follower){
+	uint32_t id = graph_id(follower);
+	queue_suggestions(id);
+	int refreshed = 0;
+	for_each_id(social_graph.followers.at(id), [&](uint32_t other){
+		if(refreshed++ < SUGGEST_REFRESH_FOLLOWERS){
+			queue_suggestions(other);
+		}
+	});
+}
+
+// background worker that computes the queued users' suggestions, the lock is held only to copy a
+// user's second hop and to keep the result, so requests don't wait for the traversal
+// a follow while the worker counts queues the user again, the next result has it
+void suggestion_worker(){
+	while(true){
+		uint32_t user = 0;
+		{
+			std::unique_lock<std::mutex> lock(suggestions.queue_mutex);
+			while(suggestions.queue.empty()){
+				suggestions.queue_ready.wait(lock);
+			}
+			user = suggestions.queue.front();
+			suggestions.queue.pop_front();
+			suggestions.queued.erase(user);
+		}
+		second_hop_snapshot snapshot;
+		{
+			std::lock_guard<std::mutex> lock(users_db_mutex);
+			snapshot = snapshot_second_hop(user);
+		}
+		std::vector<suggestion> ranked = rank_suggestions(snapshot);
+		std::lock_guard<std::mutex> lock(users_db_mutex);
+		suggestions.ready[user] = std::move(ranked);
+	}
+}
+
+// function that queues every user that follows someone and starts the worker
+// called once the log is replayed
+void start_suggestion_worker(){
+	{
+		std::lock_guard<std::mutex> lock(users_db_mutex);
+		for(uint32_t id = 0; id < social_graph.following.size(); id++){
+			if(social_graph.following.at(id).count > 0){
+				queue_suggestions(id);
+			}
+		}
+	}
+	std::thread(suggestion_worker).detach();
+}
+
+// function that forgets every computed suggestion, the caller holds users_db_mutex
+void clear_suggestions(){
+	suggestions.ready.clear();
+}
+
+// function that returns up to count suggestions for username as (username, shared connections)
+// the caller holds users_db_mutex
+// the last computed suggestions are used, users followed since then are left out
+std::vector<std::pair<std::string, uint32_t>> suggest_follows(const std::string& username, int count){
+	uint32_t id = graph_id(username);
+	auto found = suggestions.ready.find(id);
+	if(found == suggestions.ready.end()){
+		found = suggestions.ready.insert(std::make_pair(id, compute_suggestions(id))).first;
+	}
+	std::vector<std::pair<std::string, uint32_t>> suggested;
+	const std::vector<suggestion>& ranked = found->second;
+	for(int i = 0; i < ranked.size() && suggested.size() < count; i++){
+		if(set_contains(social_graph.following.at(id), ranked.at(i).id)){
+			continue;
+		}
+		const std::string& name = social_graph.names.at(ranked.at(i).id);
+		if(users_db.find(name) == users_db.end()){
+			continue;
+		}
+		suggested.push_back(std::make_pair(name, ranked.at(i).shared));
+	}
+	return suggested;
+}
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <grpc++/grpc++.h>
+
+// supervisor mode of tsd (tsd -s)
+// the supervisor binds the server's port and runs tsd as its child with the listening socket
+// inherited (tsd -L <fd>), it learns of the child's exit right away from a pidfd and starts a new
+// one, right away after a drain and with exponential backoff after a crash; the socket stays open
+// in between so clients connecting meanwhile wait in its backlog until the new tsd has restored
+// its log and accepts them, instead of being refused
+// a supervised tsd runs no slave, SIGINT or SIGTERM to the supervisor drains the child and stops
+
+// a crashed tsd restarts right away, after a second crash in a row it waits the min and the wait
+// doubles for every further crash up to the max
+const int64_t RESTART_BACKOFF_MIN_MS = 100;
+const int64_t RESTART_BACKOFF_MAX_MS = 10000;
+// a tsd that ran this long before crashing restarts right away again
+const int64_t RESTART_STABLE_SECONDS = 30;
+
+std::atomic<bool> supervisor_stopping(false);
+std::atomic<pid_t> supervised_pid(0);
+
+// helper function that returns the argv for exec of args, it points into args
+std::vector<char*> exec_argv(std::vector<std::string>& args){
+	std::vector<char*> argv;
+	for(int i = 0; i < args.size(); i++){
+		argv.push_back(&args[i][0]);
+	}
+	argv.push_back(nullptr);
+	return argv;
+}
+
+// function that binds and listens on host:port, returns the socket or -1 with error set
+// the socket is left open across exec so the supervised tsd inherits it
+int bind_listener(const std::string& host, const std::string& port, std::string& error){
+	struct addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	struct addrinfo* found = nullptr;
+	int failed = getaddrinfo(host.c_str(), port.c_str(), &hints, &found);
+	if(failed != 0){
+		error = "could not resolve " + host + ":" + port + ": " + gai_strerror(failed);
+		return -1;
+	}
+	int fd = -1;
+	error = "could not bind " + host + ":" + port;
+	for(struct addrinfo* address = found; address != nullptr && fd < 0; address = address->ai_next){
+		fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if(fd < 0){
+			continue;
+		}
+		int on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if(bind(fd, address->ai_addr, address->ai_addrlen) != 0 || listen(fd, SOMAXCONN) != 0){
+			error += std::string(": ") + std::strerror(errno);
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(found);
+	return fd;
+}
+
+// function that hands the connections of an inherited listening socket to the acceptors of the
+// listeners, in turn, until stop is set; connections not accepted by then stay in the backlog for
+// the next tsd
+void accept_connections(int listen_fd, std::vector<std::shared_ptr<grpc::experimental::ExternalConnectionAcceptor>> acceptors,
+		const std::atomic<bool>& stop){
+	struct pollfd waiting;
+	waiting.fd = listen_fd;
+	waiting.events = POLLIN;
+	for(size_t next = 0; !stop;){
+		if(poll(&waiting, 1, 100) <= 0){
+			continue;
+		}
+		// grpc expects the non blocking, no delay socket it would have accepted itself
+		int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0){
+			if(errno == EMFILE || errno == ENFILE){
+				// out of descriptors, the connection waits until some are closed
+				usleep(100000);
+			}
+			continue;
+		}
+		int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		grpc::experimental::ExternalConnectionAcceptor::NewConnectionParameters connection;
+		connection.listener_fd = listen_fd;
+		connection.fd = fd;
+		acceptors.at(next++ % acceptors.size())->HandleNewConnection(&connection);
+	}
+}
+
+// helper function that waits for the child to exit and returns its wait status
+// the pidfd wakes the supervisor as soon as the child is gone, a signal to the supervisor
+// interrupts the poll so it can be passed on; kernels without pidfds wait in waitpid instead
+int wait_for_child(pid_t child){
+	int pidfd = syscall(SYS_pidfd_open, child, 0);
+	int status = 0;
+	if(pidfd >= 0){
+		struct pollfd exited;
+		exited.fd = pidfd;
+		exited.events = POLLIN;
+		while(poll(&exited, 1, -1) < 0 && errno == EINTR){
+		}
+		close(pidfd);
+	}
+	while(waitpid(child, &status, 0) < 0 && errno == EINTR){
+	}
+	return status;
+}
+
+// asks the child to drain and the supervisor to stop once it has
+void stop_supervisor(int p){
+	supervisor_stopping = true;
+	pid_t child = supervised_pid;
+	if(child > 0){
+		kill(child, SIGTERM);
+	}
+}
+
+// function that runs tsd with args as a child until the supervisor is stopped, restarting it
+// whenever it exits
+int supervise(std::vector<std::string> args){
+	signal(SIGINT, stop_supervisor);
+	signal(SIGTERM, stop_supervisor);
+	int64_t backoff_ms = 0;
+	while(!supervisor_stopping){
+		std::vector<char*> argv = exec_argv(args);
+		auto started = std::chrono::steady_clock::now();
+		pid_t child = fork();
+		if(child == 0){
+			// a group of its own, Ctrl C in the terminal reaches only the supervisor
+			setpgid(0, 0);
+			execvp(argv[0], argv.data());
+			_exit(127);
+		}
+		if(child < 0){
+			std::cout<<"supervisor could not start tsd: "<<std::strerror(errno)<<std::endl;
+			return 1;
+		}
+		supervised_pid = child;
+		// a signal that came before the child was known is passed on now
+		if(supervisor_stopping){
+			kill(child, SIGTERM);
+		}
+		int status = wait_for_child(child);
+		supervised_pid = 0;
+		if(supervisor_stopping){
+			break;
+		}
+		int64_t ran = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started).count();
+		if(WIFEXITED(status) && WEXITSTATUS(status) == 0){
+			// drained for a restart
+			std::cout<<"supervisor: tsd exited, restarting"<<std::endl;
+			backoff_ms = 0;
+			continue;
+		}
+		if(ran >= RESTART_STABLE_SECONDS){
+			backoff_ms = 0;
+		}
+		if(WIFSIGNALED(status)){
+			std::cout<<"supervisor: tsd killed by signal "<<WTERMSIG(status);
+		}
+		else{
+			std::cout<<"supervisor: tsd exited with status "<<WEXITSTATUS(status);
+		}
+		std::cout<<", restarting in "<<backoff_ms<<"ms"<<std::endl;
+		for(int64_t waited = 0; waited < backoff_ms && !supervisor_stopping; waited += 10){
+			usleep(10000);
+		}
+		backoff_ms = backoff_ms == 0 ? RESTART_BACKOFF_MIN_MS : std::min(backoff_ms * 2, RESTART_BACKOFF_MAX_MS);
+	}
+	std::cout<<"supervisor stopped"<<std::endl;
+	return 0;
+}
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef TIMELINE_PAGE_H
+#define TIMELINE_PAGE_H
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <cstdlib>
+
+#include "user_store.h"
+
+// paging through the history of the users someone follows (TimelinePage in tsd)
+// every followed user's posts are read newest first as one stream and the streams are merged
+// with a heap, so a page costs a seek per followed user plus one heap step per post on the page,
+// the seek uses the user's post index and only reads record headers so it's bounded as well
+// posts are ordered by (time, username, seq), store_post keeps a user's posts in time order
+
+// largest page a request can ask for
+const int MAX_PAGE_SIZE = 100;
+
+// position in the merged history, a page holds the posts that are ordered before it
+// the cursor is sent to the client as "<time>:<seq>:<username>", empty means the newest post
+struct page_cursor {
+	bool newest = true;
+	int64_t time = 0;
+	uint64_t seq = 0;
+	std::string username = "";
+};
+
+// helper function that compares a post's position with a cursor
+bool is_before(int64_t time, const std::string& username, uint64_t seq, const page_cursor& cursor){
+	if(cursor.newest){
+		return true;
+	}
+	if(time != cursor.time){
+		return time < cursor.time;
+	}
+	if(username != cursor.username){
+		return username < cursor.username;
+	}
+	return seq < cursor.seq;
+}
+
+std::string encode_cursor(const page_cursor& cursor){
+	if(cursor.newest){
+		return "";
+	}
+	return std::to_string(cursor.time) + ":" + std::to_string(cursor.seq) + ":" + cursor.username;
+}
+
+// function that reads a cursor sent by a client, returns false if it isn't one
+bool decode_cursor(const std::string& text, page_cursor& cursor){
+	cursor = page_cursor();
+	if(text.empty()){
+		return true;
+	}
+	std::size_t first = text.find(':');
+	std::size_t second = first == std::string::npos ? first : text.find(':', first + 1);
+	if(second == std::string::npos || first == 0 || second == first + 1){
+		return false;
+	}
+	char* end = nullptr;
+	cursor.time = std::strtoll(text.c_str(), &end, 10);
+	if(end != text.c_str() + first){
+		return false;
+	}
+	cursor.seq = std::strtoull(text.c_str() + first + 1, &end, 10);
+	if(end != text.c_str() + second){
+		return false;
+	}
+	cursor.username = text.substr(second + 1);
+	cursor.newest = false;
+	return true;
+}
+
+// one followed user's posts, newest first
+struct history_stream {
+	std::string username;
+	user* poster = nullptr;
+	int shard = 0;
+	// index in poster->posts of the current post, -1 once the stream reads the segments
+	int window_index = -1;
+	// location of the current record and the one before it when the stream reads the segments
+	uint64_t location = NO_POST_LOCATION;
+	uint64_t older_location = NO_POST_LOCATION;
+	bool valid = false;
+	uint64_t seq = 0;
+	int64_t time = 0;
+};
+
+// helper function that makes the post at location the stream's current post
+// only the record's header is read, read_current() reads the post when it goes on a page
+void load_spilled(history_stream& stream, uint64_t location, uint64_t seq){
+	stream.window_index = -1;
+	stream.location = location;
+	stream.valid = location != NO_POST_LOCATION &&
+			read_post_header(stream.shard, location, stream.time, stream.older_location);
+	stream.seq = seq;
+}
+
+// function that returns the stream's current post
+std::vector<std::string> read_current(const history_stream& stream){
+	if(stream.window_index >= 0){
+		return post_info_of(*stream.poster->posts.at(stream.window_index));
+	}
+	std::vector<std::string> post;
+	uint64_t previous = NO_POST_LOCATION;
+	read_post_record(stream.shard, stream.location, post, previous);
+	return post;
+}
+
+// function that moves a stream to the next older post
+void step_older(history_stream& stream){
+	if(stream.window_index > 0){
+		stream.window_index--;
+		stream.seq--;
+		stream.time = stream.poster->post_times.at(stream.window_index);
+	}
+	else if(stream.window_index == 0){
+		load_spilled(stream, stream.poster->spilled_head, stream.seq - 1);
+	}
+	else if(stream.seq > 0){
+		load_spilled(stream, stream.older_location, stream.seq - 1);
+	}
+	else{
+		stream.valid = false;
+	}
+}
+
+// function that moves a stream to the user's newest post before the cursor
+void seek_stream(history_stream& stream, const page_cursor& cursor){
+	user* poster = stream.poster;
+	// the newest posts are in memory, find the first one that isn't before the cursor
+	int low = 0;
+	int high = poster->posts.size();
+	while(low < high){
+		int middle = (low + high) / 2;
+		if(is_before(poster->post_times.at(middle), stream.username, poster->spilled_posts + middle, cursor)){
+			low = middle + 1;
+		}
+		else{
+			high = middle;
+		}
+	}
+	if(low > 0){
+		stream.window_index = low - 1;
+		stream.seq = poster->spilled_posts + low - 1;
+		stream.time = poster->post_times.at(low - 1);
+		stream.valid = true;
+		return;
+	}
+	if(poster->spilled_posts == 0){
+		stream.valid = false;
+		return;
+	}
+	// start at the oldest indexed post that isn't before the cursor and walk back from there,
+	// there are at most POST_INDEX_STRIDE posts between two entries of the index
+	const std::vector<post_mark>& index = poster->post_index;
+	low = 0;
+	high = index.size();
+	while(low < high){
+		int middle = (low + high) / 2;
+		if(is_before(index.at(middle).time, stream.username, index.at(middle).seq, cursor)){
+			low = middle + 1;
+		}
+		else{
+			high = middle;
+		}
+	}
+	if(low < index.size()){
+		load_spilled(stream, index.at(low).location, index.at(low).seq);
+	}
+	else{
+		load_spilled(stream, poster->spilled_head, poster->spilled_posts - 1);
+	}
+	while(stream.valid && !is_before(stream.time, stream.username, stream.seq, cursor)){
+		step_older(stream);
+	}
+}
+
+// orders the heap so the newest current post is on top
+struct newer_post_first {
+	bool operator()(const history_stream* a, const history_stream* b) const {
+		if(a->time != b->time){
+			return a->time < b->time;
+		}
+		if(a->username != b->username){
+			return a->username < b->username;
+		}
+		return a->seq < b->seq;
+	}
+};
+
+// function that returns up to page_size posts (newest first) of the users requesting_user
+// follows that are ordered before the cursor, next is set to the cursor of the following page
+// returns true if there are older posts after the page
+bool timeline_page(const std::string& requesting_user, const page_cursor& cursor, int page_size,
+		std::vector<std::vector<std::string>>& page, page_cursor& next){
+	const std::vector<std::string>& following = users_db.at(requesting_user)->following;
+	// the heap points into streams so it must not grow after the heap is filled
+	std::vector<history_stream> streams(following.size());
+	std::priority_queue<history_stream*, std::vector<history_stream*>, newer_post_first> heap;
+	for(int i = 0; i < following.size(); i++){
+		// a user's own posts aren't part of their timeline, a followed user may have been removed
+		if(following.at(i) == requesting_user || users_db.find(following.at(i)) == users_db.end()){
+			continue;
+		}
+		streams.at(i).username = following.at(i);
+		streams.at(i).poster = users_db.at(following.at(i));
+		streams.at(i).shard = shard_of(following.at(i));
+		seek_stream(streams.at(i), cursor);
+		if(streams.at(i).valid){
+			heap.push(&streams.at(i));
+		}
+	}
+
+	next = cursor;
+	while(!heap.empty() && page.size() < page_size){
+		history_stream* newest = heap.top();
+		heap.pop();
+		page.push_back(read_current(*newest));
+		next.newest = false;
+		next.time = newest->time;
+		next.seq = newest->seq;
+		next.username = newest->username;
+		step_older(*newest);
+		if(newest->valid){
+			heap.push(newest);
+		}
+	}
+	return !heap.empty();
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <unistd.h>
+
+// event tracer for the lifecycle of a post, shared by tsc and tsd
+// every thread writes into its own ring buffer without taking a lock, a post carries
+// the same trace id through the client and the server so the stages line up when the
+// dumps of both processes are loaded into a chrome trace viewer (chrome://tracing, perfetto)
+
+// stages of a post, in the order they normally happen
+enum trace_stage {
+	TRACE_CLIENT_SENT,	// tsc wrote the post to its timeline stream
+	TRACE_RECEIVED,		// tsd read the post from the stream
+	TRACE_FANNED_OUT,	// tsd added the post to every follower's timeline
+	TRACE_LOGGED,		// tsd wrote the post to the server log
+	TRACE_WRITTEN,		// tsd wrote the post to a follower's stream
+	TRACE_DISPLAYED,	// tsc displayed the post to a follower
+	NUM_TRACE_STAGES
+};
+
+const char* trace_stage_names[NUM_TRACE_STAGES] = {
+	"client_sent", "received", "fanned_out", "logged", "written", "displayed"
+};
+
+// events kept per thread, older events are overwritten
+const uint64_t TRACE_RING_SIZE = 16384;
+
+// one recorded event, fields are atomics so a dump can read a slot while its thread writes
+struct trace_slot {
+	std::atomic<uint64_t> trace_id;
+	std::atomic<uint64_t> time_ns;
+	std::atomic<uint32_t> stage;
+};
+
+// ring buffer owned by one thread, head counts every event ever written to it
+struct trace_ring {
+	trace_slot slots[TRACE_RING_SIZE];
+	std::atomic<uint64_t> head;
+	int thread_number;
+	trace_ring(int number) : head(0), thread_number(number) {}
+};
+
+// tracing is off until something turns it on, a disabled trace point is a single relaxed load
+std::atomic<bool> tracing_enabled(false);
+
+// every thread's ring, rings are never freed so a dump can always read them
+// the ring of a thread that exits is handed to the next thread that traces
+std::mutex trace_registry_mutex;
+std::vector<trace_ring*> trace_rings;
+std::vector<trace_ring*> free_trace_rings;
+
+// gives a thread's ring back when the thread exits
+struct trace_ring_owner {
+	trace_ring* ring = nullptr;
+	~trace_ring_owner() {
+		if(ring != nullptr){
+			std::lock_guard<std::mutex> lock(trace_registry_mutex);
+			free_trace_rings.push_back(ring);
+		}
+	}
+};
+
+thread_local trace_ring_owner my_trace_ring;
+
+// function that returns a new random trace id for a post, never 0 (0 means untraced)
+uint64_t new_trace_id(){
+	static thread_local std::mt19937_64 rng(std::random_device{}() ^ ((uint64_t)getpid() << 32));
+	uint64_t id = 0;
+	while(id == 0){
+		id = rng();
+	}
+	return id;
+}
+
+// function that records that a post reached a stage
+void trace_point(trace_stage stage, uint64_t trace_id){
+	if(!tracing_enabled.load(std::memory_order_relaxed) || trace_id == 0){
+		return;
+	}
+	trace_ring* ring = my_trace_ring.ring;
+	if(ring == nullptr){
+		std::lock_guard<std::mutex> lock(trace_registry_mutex);
+		if(free_trace_rings.empty()){
+			ring = new trace_ring(trace_rings.size());
+			trace_rings.push_back(ring);
+		}
+		else{
+			ring = free_trace_rings.back();
+			free_trace_rings.pop_back();
+		}
+		my_trace_ring.ring = ring;
+	}
+	// wall clock time so the dumps of different processes can be merged
+	uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+	trace_slot& slot = ring->slots[head % TRACE_RING_SIZE];
+	slot.trace_id.store(trace_id, std::memory_order_relaxed);
+	slot.time_ns.store(now, std::memory_order_relaxed);
+	slot.stage.store(stage, std::memory_order_relaxed);
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+// function that returns every event still in the rings as chrome trace json
+// events are async instants grouped by trace id, so a viewer shows one track per post
+// process_name labels the events of this process when several dumps are combined
+std::string chrome_trace_json(const std::string& process_name, uint64_t* event_count){
+	std::ostringstream out;
+	int pid = getpid();
+	uint64_t events = 0;
+	out << "{\"traceEvents\":[\n";
+	out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+		<< ",\"args\":{\"name\":\"" << process_name << "\"}}";
+	std::lock_guard<std::mutex> lock(trace_registry_mutex);
+	for(int r = 0; r < trace_rings.size(); r++){
+		trace_ring* ring = trace_rings.at(r);
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+		for(uint64_t i = first; i < head; i++){
+			trace_slot& slot = ring->slots[i % TRACE_RING_SIZE];
+			uint64_t trace_id = slot.trace_id.load(std::memory_order_relaxed);
+			uint64_t time_ns = slot.time_ns.load(std::memory_order_relaxed);
+			uint32_t stage = slot.stage.load(std::memory_order_relaxed);
+			// skip slots the owning thread overwrote while they were being read
+			if(ring->head.load(std::memory_order_acquire) - i >= TRACE_RING_SIZE || stage >= NUM_TRACE_STAGES){
+				continue;
+			}
+			char id[32];
+			std::snprintf(id, sizeof(id), "0x%016llx", (unsigned long long)trace_id);
+			out << ",\n{\"name\":\"" << trace_stage_names[stage] << "\",\"cat\":\"post\",\"ph\":\"n\""
+				<< ",\"id\":\"" << id << "\",\"pid\":" << pid << ",\"tid\":" << ring->thread_number
+				<< ",\"ts\":" << time_ns / 1000 << "." << (time_ns % 1000) / 100
+				<< ",\"args\":{\"trace_id\":\"" << id << "\"}}";
+			events++;
+		}
+	}
+	out << "\n]}\n";
+	if(event_count != nullptr){
+		*event_count = events;
+	}
+	return out.str();
+}
+
+// function that writes the chrome trace json to a file, returns false if it couldn't be written
+bool dump_chrome_trace(const std::string& filename, const std::string& process_name){
+	std::ofstream out(filename.c_str());
+	if(!out.is_open()){
+		return false;
+	}
+	out << chrome_trace_json(process_name, nullptr);
+	return true;
+}
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef TRENDING_H
+#define TRENDING_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+
+#include "search_index.h"
+
+// trending hashtags and words over sliding windows (GetTrending in tsd)
+// every window is split into buckets with a count-min sketch each, plus a sketch holding the sum
+// of the live buckets; when a bucket expires its sketch is subtracted from the sum and cleared,
+// so counts slide with the clock and are never recomputed from the log
+// next to the sketch every window keeps the TRENDING_CANDIDATES terms with the highest estimated
+// count, a term that isn't a candidate replaces the weakest one once its estimate is higher
+// memory is fixed: (buckets + 1) sketches of SKETCH_DEPTH * SKETCH_WIDTH counters per window
+// the counts are estimates, a count-min sketch never undercounts and overcounts by at most
+// about e / SKETCH_WIDTH of the window's total with high probability
+
+const int SKETCH_DEPTH = 4;
+const int SKETCH_WIDTH = 1024;
+
+// terms kept per window, GetTrending returns at most this many
+const int TRENDING_CANDIDATES = 64;
+
+// words shorter than this are too common to be interesting and aren't counted
+const int MIN_TRENDING_WORD = 3;
+
+struct count_min_sketch {
+	uint32_t counts[SKETCH_DEPTH][SKETCH_WIDTH];
+};
+
+struct trending_candidate {
+	std::string term;
+	uint64_t hash;		// hash of term, compared before the term when looking for a candidate
+	uint32_t count;
+};
+
+struct trending_window {
+	std::string name;
+	int64_t bucket_seconds;
+	int buckets;
+	// ring of bucket sketches, bucket number b (time / bucket_seconds) is at b % buckets
+	std::vector<count_min_sketch> bucket_sketches;
+	count_min_sketch total;
+	int64_t newest_bucket = 0;
+	uint64_t terms = 0;		// terms counted in the live buckets
+	std::vector<uint64_t> bucket_terms;
+	std::vector<trending_candidate> candidates;
+	// no candidate has a lower count while the bucket doesn't change (counts only grow), a term
+	// whose estimate isn't above it can't be a candidate and is skipped without a scan
+	uint32_t weakest_count = 0;
+};
+
+// hashtags and words are counted separately so common words don't push every hashtag out
+struct trending_kind {
+	std::vector<trending_window> windows;
+};
+
+// helper function that sets up a window of buckets * bucket_seconds seconds
+trending_window make_window(const std::string& name, int64_t bucket_seconds, int buckets){
+	trending_window window;
+	window.name = name;
+	window.bucket_seconds = bucket_seconds;
+	window.buckets = buckets;
+	window.bucket_sketches.resize(buckets);
+	std::memset(window.bucket_sketches.data(), 0, sizeof(count_min_sketch) * buckets);
+	std::memset(&window.total, 0, sizeof(count_min_sketch));
+	window.bucket_terms.assign(buckets, 0);
+	return window;
+}
+
+// the windows, 5 minutes in 30 second buckets, an hour in 5 minute buckets and a day in hours
+void init_trending_kind(trending_kind& kind){
+	kind.windows.clear();
+	kind.windows.push_back(make_window("5m", 30, 10));
+	kind.windows.push_back(make_window("1h", 300, 12));
+	kind.windows.push_back(make_window("24h", 3600, 24));
+}
+
+struct trending_state {
+	trending_kind hashtags;
+	trending_kind words;
+	std::mutex trending_mutex;
+
+	trending_state(){
+		init_trending_kind(hashtags);
+		init_trending_kind(words);
+	}
+};
+
+trending_state trending;
+
+void reset_trending(){
+	std::lock_guard<std::mutex> lock(trending.trending_mutex);
+	init_trending_kind(trending.hashtags);
+	init_trending_kind(trending.words);
+}
+
+// helper function that returns the counter of a term with the given hash in each row of a sketch
+// the rows use h1 + row * h2 from one 64 bit hash instead of a hash function each
+void sketch_slots(uint64_t hash, uint32_t slots[SKETCH_DEPTH]){
+	// std::hash of a string is already mixed, the upper half gives the second hash
+	uint32_t h1 = hash;
+	uint32_t h2 = (hash >> 32) | 1;
+	for(int row = 0; row < SKETCH_DEPTH; row++){
+		slots[row] = (h1 + row * h2) % SKETCH_WIDTH;
+	}
+}
+
+uint32_t sketch_estimate(const count_min_sketch& sketch, const uint32_t slots[SKETCH_DEPTH]){
+	uint32_t estimate = sketch.counts[0][slots[0]];
+	for(int row = 1; row < SKETCH_DEPTH; row++){
+		if(sketch.counts[row][slots[row]] < estimate){
+			estimate = sketch.counts[row][slots[row]];
+		}
+	}
+	return estimate;
+}
+
+// helper function that moves a window forward to the bucket of now, expiring the buckets
+// that fall out of it, and updates the candidates' counts
+void advance_window(trending_window& window, int64_t now){
+	int64_t bucket = now / window.bucket_seconds;
+	if(bucket <= window.newest_bucket){
+		return;
+	}
+	int64_t first = window.newest_bucket + 1;
+	if(bucket - first >= window.buckets){
+		first = bucket - window.buckets + 1;
+	}
+	for(int64_t b = first; b <= bucket; b++){
+		count_min_sketch& expired = window.bucket_sketches.at(b % window.buckets);
+		for(int row = 0; row < SKETCH_DEPTH; row++){
+			for(int column = 0; column < SKETCH_WIDTH; column++){
+				window.total.counts[row][column] -= expired.counts[row][column];
+			}
+		}
+		std::memset(&expired, 0, sizeof(count_min_sketch));
+		window.terms -= window.bucket_terms.at(b % window.buckets);
+		window.bucket_terms.at(b % window.buckets) = 0;
+	}
+	window.newest_bucket = bucket;
+
+	// the candidates' counts only went down, drop the ones that left the window
+	uint32_t slots[SKETCH_DEPTH];
+	std::vector<trending_candidate> remaining;
+	for(int i = 0; i < window.candidates.size(); i++){
+		sketch_slots(window.candidates.at(i).hash, slots);
+		window.candidates.at(i).count = sketch_estimate(window.total, slots);
+		if(window.candidates.at(i).count > 0){
+			remaining.push_back(window.candidates.at(i));
+		}
+	}
+	window.candidates.swap(remaining);
+	window.weakest_count = 0;
+}
+
+// helper function that counts one term in a window
+void count_term(trending_window& window, const std::string& term, uint64_t hash, const uint32_t slots[SKETCH_DEPTH]){
+	count_min_sketch& bucket = window.bucket_sketches.at(window.newest_bucket % window.buckets);
+	for(int row = 0; row < SKETCH_DEPTH; row++){
+		bucket.counts[row][slots[row]]++;
+		window.total.counts[row][slots[row]]++;
+	}
+	window.terms++;
+	window.bucket_terms.at(window.newest_bucket % window.buckets)++;
+	uint32_t estimate = sketch_estimate(window.total, slots);
+	// a candidate's count is its estimate from when it was last counted, one less than now at most
+	if(estimate <= window.weakest_count){
+		return;
+	}
+
+	int weakest = -1;
+	for(int i = 0; i < window.candidates.size(); i++){
+		if(window.candidates.at(i).hash == hash && window.candidates.at(i).term == term){
+			window.candidates.at(i).count = estimate;
+			return;
+		}
+		if(weakest < 0 || window.candidates.at(i).count < window.candidates.at(weakest).count){
+			weakest = i;
+		}
+	}
+	if(window.candidates.size() < TRENDING_CANDIDATES){
+		trending_candidate candidate;
+		candidate.term = term;
+		candidate.hash = hash;
+		candidate.count = estimate;
+		window.candidates.push_back(candidate);
+	}
+	else{
+		window.weakest_count = window.candidates.at(weakest).count;
+		if(estimate > window.weakest_count){
+			window.candidates.at(weakest).term = term;
+			window.candidates.at(weakest).hash = hash;
+			window.candidates.at(weakest).count = estimate;
+		}
+	}
+}
+
+// function that counts the hashtags and words of a post's content at time now (in seconds)
+void record_trending(const std::string& content, int64_t now){
+	std::vector<std::string> terms = search_terms(content);
+	std::lock_guard<std::mutex> lock(trending.trending_mutex);
+	for(int w = 0; w < trending.hashtags.windows.size(); w++){
+		advance_window(trending.hashtags.windows.at(w), now);
+		advance_window(trending.words.windows.at(w), now);
+	}
+	uint32_t slots[SKETCH_DEPTH];
+	for(int i = 0; i < terms.size(); i++){
+		const std::string& term = terms.at(i);
+		bool hashtag = term.at(0) == '#';
+		// search_terms returns #tag followed by tag, the tag is only counted as a hashtag
+		bool tag_of_hashtag = !hashtag && i > 0 && terms.at(i - 1).at(0) == '#' &&
+				terms.at(i - 1).compare(1, std::string::npos, term) == 0;
+		if(tag_of_hashtag || (!hashtag && term.size() < MIN_TRENDING_WORD)){
+			continue;
+		}
+		trending_kind& kind = hashtag ? trending.hashtags : trending.words;
+		uint64_t hash = std::hash<std::string>()(term);
+		sketch_slots(hash, slots);
+		for(int w = 0; w < kind.windows.size(); w++){
+			count_term(kind.windows.at(w), term, hash, slots);
+		}
+	}
+}
+
+// function that returns the count terms with the highest counts in the named window at time now,
+// highest first, total is set to the number of terms counted in the window
+// returns false if there is no window with that name
+bool top_trending(const std::string& window_name, bool hashtags, int count, int64_t now,
+		std::vector<trending_candidate>& top, uint64_t& total){
+	std::lock_guard<std::mutex> lock(trending.trending_mutex);
+	trending_kind& kind = hashtags ? trending.hashtags : trending.words;
+	for(int w = 0; w < kind.windows.size(); w++){
+		trending_window& window = kind.windows.at(w);
+		if(window.name != window_name){
+			continue;
+		}
+		advance_window(window, now);
+		top = window.candidates;
+		std::sort(top.begin(), top.end(), [](const trending_candidate& a, const trending_candidate& b){
+			return a.count > b.count || (a.count == b.count && a.term < b.term);
+		});
+		if(top.size() > count){
+			top.resize(count);
+		}
+		total = window.terms;
+		return true;
+	}
+	return false;
+}
+
+#endif
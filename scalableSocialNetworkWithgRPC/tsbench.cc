@@ -0,0 +1,577 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <memory>
+#include <unistd.h>
+#include <grpc++/grpc++.h>
+
+#include "TNSService.grpc.pb.h"
+#include "latency_histogram.h"
+#include "trace.h"
+#include "router_channel.h"
+
+using grpc::Channel;
+using grpc::ClientContext;
+using grpc::ClientReader;
+using grpc::ClientReaderWriter;
+using grpc::Status;
+using TNSService::user_services;
+using TNSService::command_info;
+using TNSService::server_status;
+using TNSService::current_user;
+using TNSService::following_user_message;
+using TNSService::post_info;
+using TNSService::client_info;
+using TNSService::available_server;
+
+// load generator for the social network
+// simulates a set of users with a zipfian follow graph that post, list and follow
+// through the real TNSService rpcs and measures how long posts take to reach followers
+
+// benchmark settings, set from the command line in main
+std::string server_name = "";
+std::string router_name = "";
+// read replicas (comma separated) the receivers and LIST requests use instead of the server
+std::string read_servers = "";
+std::string user_prefix = "";
+int num_users = 50;
+int follows_per_user = 10;
+double zipf_exponent = 1.0;
+int duration_sec = 10;
+int num_workers = 4;
+int num_receivers = 4;
+double post_rate = 200.0;
+bool open_loop = false;
+bool routers_only = false;
+double list_fraction = 0.05;
+double follow_fraction = 0.05;
+int poll_interval_ms = 100;
+int post_size = 64;
+
+// every post sent by the benchmark starts with this tag so receivers can find the send time
+const std::string POST_TAG = "tsbench";
+
+// the follow graph as the benchmark believes it to be on the server
+// follow_since holds the time an edge was created so that posts backfilled by a follow
+// are not counted as deliveries
+std::vector<std::vector<int>> followers_of;
+std::vector<std::unordered_map<int, uint64_t>> follow_since;
+std::mutex graph_mutex;
+
+// results shared between threads, each thread merges its own histograms when it finishes
+std::mutex results_mutex;
+latency_histogram delivery_latency;
+latency_histogram post_latency;
+latency_histogram list_latency;
+latency_histogram follow_latency;
+std::atomic<uint64_t> expected_deliveries(0);
+std::atomic<uint64_t> observed_deliveries(0);
+std::atomic<uint64_t> backfilled_deliveries(0);
+std::atomic<uint64_t> failed_ops(0);
+std::atomic<bool> workers_running(true);
+std::atomic<bool> receivers_running(true);
+
+// helper function that returns a monotonic timestamp in nanoseconds
+uint64_t now_ns(){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// helper function that sleeps until the given monotonic timestamp
+void sleep_until_ns(uint64_t when){
+	uint64_t now = now_ns();
+	if(when > now){
+		std::this_thread::sleep_for(std::chrono::nanoseconds(when - now));
+	}
+}
+
+std::string username_of(int index){
+	return user_prefix + std::to_string(index);
+}
+
+// returns the index of a benchmark user or -1 if the name wasn't created by this run
+int index_of(const std::string& username){
+	if(username.compare(0, user_prefix.size(), user_prefix) != 0){
+		return -1;
+	}
+	return std::atoi(username.c_str() + user_prefix.size());
+}
+
+// samples ranks 0..n-1 where rank k is chosen with probability proportional to 1/(k+1)^s
+class zipf_sampler {
+	public:
+		zipf_sampler(int n, double s) : cdf(n) {
+			double total = 0;
+			for(int i = 0; i < n; i++){
+				total += 1.0 / std::pow(i + 1, s);
+				cdf[i] = total;
+			}
+			for(int i = 0; i < n; i++){
+				cdf[i] /= total;
+			}
+		}
+		int sample(std::mt19937_64& rng) const {
+			double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+			int rank = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+			return rank < (int)cdf.size() ? rank : (int)cdf.size() - 1;
+		}
+	private:
+		std::vector<double> cdf;
+};
+
+// helper function that asks the router which server the benchmark should use
+std::string resolve_server(){
+	std::unique_ptr<user_services::Stub> router_stub(user_services::NewStub(router_channel(router_name)));
+	client_info info_to_send;
+	available_server returned_server;
+	ClientContext context;
+	Status status = router_stub->RequestForServer(&context, info_to_send, &returned_server);
+	if(!status.ok() || returned_server.ip_addr() == "ERROR"){
+		return "";
+	}
+	// reads go to the server's replica if the router knows one and none was given
+	if(read_servers == "" && returned_server.read_ip() != ""){
+		read_servers = returned_server.read_ip() + ":" + returned_server.read_port();
+	}
+	return returned_server.ip_addr() + ":" + returned_server.port();
+}
+
+// sends a follow request and records the edge locally once the server accepts it
+bool follow(user_services::Stub* stub, int follower, int followee){
+	command_info info_to_send;
+	info_to_send.set_username(username_of(follower));
+	info_to_send.set_username_other_user(username_of(followee));
+	server_status returned_status;
+	ClientContext context;
+	Status status = stub->FollowRequest(&context, info_to_send, &returned_status);
+	if(!status.ok() || returned_status.s_status() != TNSService::server_status_IStatus_SUCCESS){
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(graph_mutex);
+	followers_of[followee].push_back(follower);
+	follow_since[follower][followee] = now_ns();
+	return true;
+}
+
+// creates every user and builds the zipfian follow graph before the measured run
+bool setup_users(user_services::Stub* stub){
+	for(int i = 0; i < num_users; i++){
+		current_user user_to_send;
+		user_to_send.set_username(username_of(i));
+		server_status returned_status;
+		ClientContext context;
+		Status status = stub->InitializeUser(&context, user_to_send, &returned_status);
+		if(!status.ok()){
+			std::cout << "could not initialize user: " << status.error_message() << std::endl;
+			return false;
+		}
+	}
+
+	std::mt19937_64 rng(42);
+	zipf_sampler popularity(num_users, zipf_exponent);
+	int edges = 0;
+	for(int i = 0; i < num_users; i++){
+		int wanted = std::min(follows_per_user, num_users - 1);
+		int attempts = 0;
+		while(wanted > 0 && attempts < 50 * follows_per_user){
+			attempts++;
+			int followee = popularity.sample(rng);
+			if(followee == i || follow_since[i].count(followee) != 0){
+				continue;
+			}
+			if(follow(stub, i, followee)){
+				edges++;
+				wanted--;
+			}
+		}
+	}
+	// posts made before the run are not part of the measurement
+	for(int i = 0; i < num_users; i++){
+		for(auto& edge : follow_since[i]){
+			edge.second = 0;
+		}
+	}
+	std::cout << "created " << num_users << " users and " << edges << " follow edges" << std::endl;
+	return true;
+}
+
+// waits until a read replica answers LIST for the last user created, so it has every user
+bool wait_for_replica(std::shared_ptr<Channel> channel){
+	std::unique_ptr<user_services::Stub> stub(user_services::NewStub(channel));
+	for(int tries = 0; tries < 100; tries++){
+		current_user user_to_send;
+		user_to_send.set_username(username_of(num_users - 1));
+		ClientContext context;
+		std::unique_ptr<ClientReader<following_user_message>> reader(stub->ListRequest(&context, user_to_send));
+		following_user_message message;
+		while(reader->Read(&message)){}
+		if(reader->Finish().ok()){
+			return true;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	return false;
+}
+
+// thread that makes requests as random users, either as fast as the server answers
+// (closed loop) or at a fixed schedule (open loop)
+void worker(int id, std::shared_ptr<Channel> channel, std::shared_ptr<Channel> read_channel, uint64_t start, uint64_t end){
+	std::unique_ptr<user_services::Stub> stub(user_services::NewStub(channel));
+	std::unique_ptr<user_services::Stub> read_stub(user_services::NewStub(read_channel));
+	std::mt19937_64 rng(1000 + id);
+	std::uniform_int_distribution<int> any_user(0, num_users - 1);
+	std::uniform_real_distribution<double> coin(0.0, 1.0);
+	latency_histogram my_post, my_list, my_follow;
+
+	std::unique_ptr<ClientContext> context(new ClientContext());
+	std::unique_ptr<ClientReaderWriter<post_info, post_info>> stream(stub->TimelineRequest(context.get()));
+
+	// in open loop mode each worker owns an equal share of the post rate
+	uint64_t interval = (uint64_t)(1e9 * num_workers / post_rate);
+	// stagger the workers so their requests don't all arrive at the same instant
+	uint64_t scheduled = start + interval * id / num_workers;
+	std::string padding(post_size > 0 ? post_size : 0, 'x');
+
+	while(workers_running){
+		uint64_t intended = now_ns();
+		if(open_loop){
+			scheduled += interval;
+			if(scheduled >= end){
+				break;
+			}
+			sleep_until_ns(scheduled);
+			// latency is measured from when the request should have been sent
+			// so a stalled server is charged for the requests queued behind it
+			intended = scheduled;
+		}
+		else if(intended >= end){
+			break;
+		}
+
+		int me = any_user(rng);
+		double choice = coin(rng);
+		if(choice < list_fraction){
+			current_user user_to_send;
+			user_to_send.set_username(username_of(me));
+			ClientContext list_context;
+			std::unique_ptr<ClientReader<following_user_message>> reader(
+					read_stub->ListRequest(&list_context, user_to_send));
+			following_user_message message;
+			while(reader->Read(&message)){}
+			if(!reader->Finish().ok()){
+				failed_ops++;
+			}
+			my_list.record(now_ns() - intended);
+		}
+		else if(choice < list_fraction + follow_fraction){
+			// pick someone this user doesn't follow yet, the server would accept a duplicate
+			int followee = -1;
+			{
+				std::lock_guard<std::mutex> lock(graph_mutex);
+				for(int tries = 0; tries < 8 && followee == -1; tries++){
+					int candidate = any_user(rng);
+					if(candidate != me && follow_since[me].count(candidate) == 0){
+						followee = candidate;
+					}
+				}
+			}
+			if(followee == -1){
+				continue;
+			}
+			if(!follow(stub.get(), me, followee)){
+				failed_ops++;
+			}
+			my_follow.record(now_ns() - intended);
+		}
+		else{
+			// the content carries the send time, receivers use it to measure delivery latency
+			// the server strips the last character of the time and content when logging
+			std::time_t wall = std::time(nullptr);
+			post_info info_to_send;
+			info_to_send.set_username(username_of(me));
+			info_to_send.set_time(std::ctime(&wall));
+			info_to_send.set_content(POST_TAG + " " + std::to_string(intended) + " " + padding + "\n");
+			info_to_send.set_requesting_update(0);
+			// every post carries a trace id so a server with tracing on records its stages
+			info_to_send.set_trace_id(new_trace_id());
+			{
+				std::lock_guard<std::mutex> lock(graph_mutex);
+				expected_deliveries += followers_of[me].size();
+			}
+			if(!stream->Write(info_to_send)){
+				// the server ends the stream at a post it didn't store (admission.h), the next post
+				// goes on a new stream
+				failed_ops++;
+				stream->WritesDone();
+				stream->Finish();
+				context.reset(new ClientContext());
+				stream = stub->TimelineRequest(context.get());
+				continue;
+			}
+			my_post.record(now_ns() - intended);
+		}
+	}
+	stream->WritesDone();
+	stream->Finish();
+
+	std::lock_guard<std::mutex> lock(results_mutex);
+	post_latency.merge(my_post);
+	list_latency.merge(my_list);
+	follow_latency.merge(my_follow);
+}
+
+// thread that polls the timelines of a slice of the users the same way tsc does
+// every user keeps one timeline stream open for the whole run
+void receiver(int id, std::shared_ptr<Channel> channel){
+	std::unique_ptr<user_services::Stub> stub(user_services::NewStub(channel));
+	std::vector<int> mine;
+	for(int i = id; i < num_users; i += num_receivers){
+		mine.push_back(i);
+	}
+	std::vector<std::unique_ptr<ClientContext>> contexts;
+	std::vector<std::unique_ptr<ClientReaderWriter<post_info, post_info>>> streams;
+	for(int i = 0; i < (int)mine.size(); i++){
+		contexts.push_back(std::unique_ptr<ClientContext>(new ClientContext()));
+		streams.push_back(stub->TimelineRequest(contexts.back().get()));
+	}
+
+	latency_histogram my_delivery;
+	post_info update_info;
+	update_info.set_requesting_update(1);
+	post_info received;
+	while(receivers_running){
+		uint64_t round_start = now_ns();
+		for(int i = 0; i < (int)mine.size(); i++){
+			update_info.set_username(username_of(mine.at(i)));
+			if(!streams.at(i)->Write(update_info)){
+				failed_ops++;
+				continue;
+			}
+			while(streams.at(i)->Read(&received) && received.username() != "END"){
+				uint64_t arrived = now_ns();
+				const std::string& content = received.content();
+				if(content.compare(0, POST_TAG.size(), POST_TAG) != 0){
+					continue;
+				}
+				uint64_t sent = std::strtoull(content.c_str() + POST_TAG.size() + 1, nullptr, 10);
+				int poster = index_of(received.username());
+				uint64_t since = 0;
+				{
+					std::lock_guard<std::mutex> lock(graph_mutex);
+					auto edge = follow_since[mine.at(i)].find(poster);
+					if(edge != follow_since[mine.at(i)].end()){
+						since = edge->second;
+					}
+				}
+				// posts written before the follow happened arrived through the follow backfill
+				if(poster < 0 || sent < since){
+					backfilled_deliveries++;
+					continue;
+				}
+				my_delivery.record(arrived > sent ? arrived - sent : 0);
+				observed_deliveries++;
+			}
+		}
+		sleep_until_ns(round_start + (uint64_t)poll_interval_ms * 1000000);
+	}
+	for(int i = 0; i < (int)streams.size(); i++){
+		streams.at(i)->WritesDone();
+		streams.at(i)->Finish();
+	}
+	std::lock_guard<std::mutex> lock(results_mutex);
+	delivery_latency.merge(my_delivery);
+}
+
+// helper function that prints one line of latency percentiles in milliseconds
+void print_latency(const std::string& name, const latency_histogram& h){
+	std::printf("%-10s count=%-9llu p50=%9.3fms p99=%9.3fms p999=%9.3fms max=%9.3fms\n",
+			name.c_str(), (unsigned long long)h.count(),
+			h.percentile(50) / 1e6, h.percentile(99) / 1e6,
+			h.percentile(99.9) / 1e6, h.max() / 1e6);
+}
+
+// router benchmark (-q): every worker asks the routers for a server in a closed loop, there is
+// one channel to all of them so the requests are spread like tsc's
+int bench_routers(){
+	std::shared_ptr<Channel> channel = router_channel(router_name);
+	latency_histogram request_latency;
+	std::atomic<uint64_t> failed(0);
+	uint64_t start = now_ns();
+	uint64_t end = start + (uint64_t)duration_sec * 1000000000ULL;
+	std::vector<std::thread> workers;
+	for(int i = 0; i < num_workers; i++){
+		workers.push_back(std::thread([&](){
+			std::unique_ptr<user_services::Stub> stub(user_services::NewStub(channel));
+			latency_histogram mine;
+			while(now_ns() < end){
+				client_info info_to_send;
+				available_server returned_server;
+				ClientContext context;
+				uint64_t sent = now_ns();
+				Status status = stub->RequestForServer(&context, info_to_send, &returned_server);
+				if(!status.ok()){
+					failed++;
+					continue;
+				}
+				mine.record(now_ns() - sent);
+			}
+			std::lock_guard<std::mutex> lock(results_mutex);
+			request_latency.merge(mine);
+		}));
+	}
+	for(int i = 0; i < (int)workers.size(); i++){
+		workers.at(i).join();
+	}
+	double elapsed = (now_ns() - start) / 1e9;
+	std::printf("duration   %.2fs, %llu requests, %.1f req/s, %llu failed\n", elapsed,
+			(unsigned long long)request_latency.count(), request_latency.count() / elapsed,
+			(unsigned long long)failed.load());
+	print_latency("ROUTER", request_latency);
+	return 0;
+}
+
+void usage(){
+	std::cerr << "usage: tsbench (-s <ip>:<port> | -r <router ip>:<port>) [options]\n"
+		<< "  -n users            number of simulated users (50)\n"
+		<< "  -f follows          follows per user, targets drawn from a zipf distribution (10)\n"
+		<< "  -z exponent         zipf exponent of the follow graph (1.0)\n"
+		<< "  -d seconds          length of the measured run (10)\n"
+		<< "  -c workers          number of request threads (4)\n"
+		<< "  -g receivers        number of timeline polling threads (4)\n"
+		<< "  -R posts/sec        total request rate in open loop mode (200)\n"
+		<< "  -o                  open loop: send at a fixed rate and correct for coordinated omission\n"
+		<< "  -l fraction         fraction of requests that are LIST (0.05)\n"
+		<< "  -F fraction         fraction of requests that are FOLLOW (0.05)\n"
+		<< "  -u ms               timeline poll interval per user (100)\n"
+		<< "  -b bytes            padding added to every post (64)\n"
+		<< "  -P prefix           username prefix, defaults to one unique to this run\n"
+		<< "  -q                  only ask the routers (-r, comma separated) for a server, -c workers\n"
+		<< "  -e <ip>:<port>,...  read replicas the timeline polls and LIST go to, one per receiver in turn\n";
+}
+
+int main(int argc, char** argv){
+	int opt = 0;
+	while((opt = getopt(argc, argv, "s:r:n:f:z:d:c:g:R:ol:F:u:b:P:qe:")) != -1){
+		switch(opt){
+			case 's': server_name = optarg; break;
+			case 'r': router_name = optarg; break;
+			case 'n': num_users = std::atoi(optarg); break;
+			case 'f': follows_per_user = std::atoi(optarg); break;
+			case 'z': zipf_exponent = std::atof(optarg); break;
+			case 'd': duration_sec = std::atoi(optarg); break;
+			case 'c': num_workers = std::atoi(optarg); break;
+			case 'g': num_receivers = std::atoi(optarg); break;
+			case 'R': post_rate = std::atof(optarg); break;
+			case 'o': open_loop = true; break;
+			case 'l': list_fraction = std::atof(optarg); break;
+			case 'F': follow_fraction = std::atof(optarg); break;
+			case 'u': poll_interval_ms = std::atoi(optarg); break;
+			case 'b': post_size = std::atoi(optarg); break;
+			case 'P': user_prefix = optarg; break;
+			case 'q': routers_only = true; break;
+			case 'e': read_servers = optarg; break;
+			default: usage(); return 1;
+		}
+	}
+	if(num_users < 2 || num_workers < 1 || num_receivers < 1 || post_rate <= 0){
+		usage();
+		return 1;
+	}
+	if(server_name == "" && router_name == ""){
+		usage();
+		return 1;
+	}
+	if(routers_only){
+		if(router_name == ""){
+			usage();
+			return 1;
+		}
+		return bench_routers();
+	}
+	if(server_name == ""){
+		server_name = resolve_server();
+		if(server_name == ""){
+			std::cout << "router did not return an available server" << std::endl;
+			return 1;
+		}
+	}
+	// usernames must not collide with earlier runs, the server keeps users forever
+	if(user_prefix == ""){
+		user_prefix = "bench" + std::to_string(getpid()) + "_" + std::to_string(std::time(nullptr) % 100000) + "_";
+	}
+	std::cout << "benchmarking " << server_name << (open_loop ? " (open loop)" : " (closed loop)") << std::endl;
+
+	std::shared_ptr<Channel> channel = grpc::CreateChannel(server_name, grpc::InsecureChannelCredentials());
+	std::unique_ptr<user_services::Stub> stub(user_services::NewStub(channel));
+	followers_of.resize(num_users);
+	follow_since.resize(num_users);
+	if(!setup_users(stub.get())){
+		return 1;
+	}
+	// without read replicas everything goes to the server
+	std::vector<std::shared_ptr<Channel>> read_channels;
+	std::vector<std::string> replicas = split_routers(read_servers);
+	for(int i = 0; i < (int)replicas.size(); i++){
+		read_channels.push_back(grpc::CreateChannel(replicas.at(i), grpc::InsecureChannelCredentials()));
+		if(!wait_for_replica(read_channels.back())){
+			std::cout << "read replica " << replicas.at(i) << " did not catch up" << std::endl;
+			return 1;
+		}
+	}
+	if(read_channels.empty()){
+		read_channels.push_back(channel);
+	}
+	else{
+		std::cout << "reading from " << read_servers << std::endl;
+	}
+
+	std::vector<std::thread> receivers;
+	for(int i = 0; i < num_receivers; i++){
+		receivers.push_back(std::thread(receiver, i, read_channels.at(i % read_channels.size())));
+	}
+	uint64_t start = now_ns();
+	uint64_t end = start + (uint64_t)duration_sec * 1000000000ULL;
+	std::vector<std::thread> workers;
+	for(int i = 0; i < num_workers; i++){
+		workers.push_back(std::thread(worker, i, channel, read_channels.at(i % read_channels.size()), start, end));
+	}
+	for(int i = 0; i < (int)workers.size(); i++){
+		workers.at(i).join();
+	}
+	uint64_t finished = now_ns();
+
+	// give the receivers a few poll rounds to pick up the last posts
+	std::this_thread::sleep_for(std::chrono::milliseconds(3 * poll_interval_ms + 1000));
+	receivers_running = false;
+	for(int i = 0; i < (int)receivers.size(); i++){
+		receivers.at(i).join();
+	}
+
+	double elapsed = (finished - start) / 1e9;
+	uint64_t ops = post_latency.count() + list_latency.count() + follow_latency.count();
+	std::printf("\nduration   %.2fs, %llu requests, %.1f req/s, %.1f posts/s, %llu failed\n",
+			elapsed, (unsigned long long)ops, ops / elapsed, post_latency.count() / elapsed,
+			(unsigned long long)failed_ops.load());
+	std::printf("deliveries %llu of %llu expected (%.1f%%), %llu from follow backfill\n",
+			(unsigned long long)observed_deliveries.load(), (unsigned long long)expected_deliveries.load(),
+			expected_deliveries == 0 ? 0.0 : 100.0 * observed_deliveries / expected_deliveries,
+			(unsigned long long)backfilled_deliveries.load());
+	std::printf("%s\n", open_loop ? "request latency (from intended send time)" : "request latency");
+	print_latency("POST", post_latency);
+	print_latency("LIST", list_latency);
+	print_latency("FOLLOW", follow_latency);
+	std::printf("post-to-delivery latency (includes the %dms poll interval)\n", poll_interval_ms);
+	print_latency("DELIVERY", delivery_latency);
+	return 0;
+}
@@ -3,12 +3,20 @@
 #include <thread>
 #include <vector>
 #include <string>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <algorithm>
+#include <unordered_set>
 #include <unistd.h>
+#include <signal.h>
 #include <grpc++/grpc++.h>
 #include "client.h"
 #include <ctime>
 #include <chrono>
 #include "TNSService.grpc.pb.h"
+#include "trace.h"
+#include "router_channel.h"
 
 using grpc::Channel;
 using grpc::ClientContext;
@@ -25,6 +33,12 @@ using TNSService::user_services;
 using TNSService::client_info;
 using TNSService::available_server;
 using TNSService::available_status;
+using TNSService::page_request;
+using TNSService::page_reply;
+using TNSService::search_request;
+using TNSService::search_reply;
+using TNSService::suggest_request;
+using TNSService::suggest_reply;
 
 // globals that represent the connected server's ip and the router information
 std::string connected_server_ip = "";
@@ -32,6 +46,34 @@ std::string connected_server_port = "";
 std::string router_name = "";
 std::unique_ptr<user_services::Stub> router_stub;
 
+// file the post trace is written to when the client is closed, tracing is off when empty
+std::string trace_file = "";
+
+// set by ctrl C when tracing, a thread started in main writes the trace and exits
+std::atomic<bool> close_requested(false);
+
+// function that will catch ctrl C when tracing, a second one exits without the trace
+// only async signal safe calls are made here
+void handle_client_close(int p){
+	if(!close_requested){
+		close_requested = true;
+		return;
+	}
+	_exit(0);
+}
+
+// a read replica that failed a read isn't used again for this many seconds
+const int READ_FALLBACK_SECONDS = 10;
+// the timeline updates of a server and of its read replica are taken separately, so this many of
+// the posts shown last, twice the 20 a timeline holds, are remembered and not shown again
+const int SHOWN_POSTS = 40;
+
+// helper function that returns a stub of the server at ip and port
+std::shared_ptr<user_services::Stub> new_stub(const std::string& ip, const std::string& port_no){
+	return std::shared_ptr<user_services::Stub>(user_services::NewStub(grpc::CreateChannel(ip + ":" + port_no,
+			grpc::InsecureChannelCredentials())));
+}
+
 // helper function that will contact the router and get a new available server
 std::vector<std::string> get_new_server(){
 	client_info info_to_send;
@@ -48,10 +90,12 @@ std::vector<std::string> get_new_server(){
 		return empty_vector;
 	}
 	else{
-		// return the new server's ip and port 
+		// return the new server's ip and port, and the read replica's (empty when it has none)
 		std::vector<std::string> return_info;
 		return_info.push_back(returned_server.ip_addr());
 		return_info.push_back(returned_server.port());
+		return_info.push_back(returned_server.read_ip());
+		return_info.push_back(returned_server.read_port());
 		
 		return return_info;
 	}
@@ -66,13 +110,15 @@ class Client : public IClient
 		       const std::string& uname,
 		       const std::string& p);
 		void connection_check();
+		void switch_server(const std::string& ip, const std::string& port_no,
+				const std::string& read_ip = "", const std::string& read_port = "");
+		void set_read_server(const std::string& ip, const std::string& port_no);
 		// this function will create a stub for the Client class so
 		// it can interface with TNSService
 		void create_stub() {
-			std::string connection_name = hostname + ":" + port;
-					stub_ = std::unique_ptr<user_services::Stub>(
-									user_services::NewStub(grpc::CreateChannel(connection_name, 
-									grpc::InsecureChannelCredentials())));
+			std::shared_ptr<user_services::Stub> server = new_stub(hostname, port);
+			std::lock_guard<std::mutex> lock(stubs_mutex);
+			stub_ = server;
 	}
 	protected:
 		virtual int connectTo();
@@ -81,15 +127,32 @@ class Client : public IClient
 		IReply follow_user(std::string user_to_follow);
 		IReply unfollow_user(std::string user_to_unfollow);
 		IReply list_followers();
+		IReply timeline_history();
+		IReply search_posts(std::string query);
+		IReply suggest_follows();
+		std::shared_ptr<user_services::Stub> server_stub();
+		std::shared_ptr<user_services::Stub> read_stub();
+		bool read_failed(const Status& status, const std::shared_ptr<user_services::Stub>& used);
 	private:
 		std::string hostname;
 		std::string username;
 		std::string port;
 		int server_switched = 0; // variable will allow all threads to update stub when server changes
+		std::string history_cursor = ""; // where the next HISTORY page starts, empty for the newest posts
+		std::string search_query = ""; // last SEARCH query and where its next page starts, 0 for the newest posts
+		uint64_t search_cursor = 0;
 
 		// You can have an instance of the client stub
 		// as a member variable.
-		std::unique_ptr<user_services::Stub> stub_;
+		// the stubs are replaced by the connection_check thread when the client moves to another
+		// server, every call takes a copy of the one it uses under stubs_mutex and keeps it until
+		// the call or stream is done
+		std::mutex stubs_mutex;
+		std::shared_ptr<user_services::Stub> stub_;
+		// stub of the server's read replica, LIST, HISTORY, SEARCH, SUGGEST and timeline updates
+		// go there, or to the server while there is none or it failed not long ago
+		std::shared_ptr<user_services::Stub> read_stub_;
+		std::atomic<time_t> read_fallback_until{0};
 };
 
 int main(int argc, char** argv) {
@@ -98,7 +161,7 @@ int main(int argc, char** argv) {
 	std::string username = "default";
 	std::string port = "3010";
 	int opt = 0;
-	while ((opt = getopt(argc, argv, "h:u:p:r:")) != -1){
+	while ((opt = getopt(argc, argv, "h:u:p:r:t:")) != -1){
 		switch(opt) {
 		    case 'h':
 			hostname = optarg;break;
@@ -108,16 +171,32 @@ int main(int argc, char** argv) {
 			port = optarg;break;
 		    case 'r':
 			router_name = optarg;break;
+		    case 't':
+			trace_file = optarg;break;
 		    default:
 			std::cerr << "Invalid Command Line Argument\n";
 		}
 	}
 	// if no command line argument for the router were provided, ask the user for the router information
 	if(router_name == ""){
-		std::cout << "Please enter the router ip address and port number in the form <ip>:<port> (ie. ###.###.###.###:####)" << std::endl;
+		std::cout << "Please enter the router ip address and port number in the form <ip>:<port> (ie. ###.###.###.###:####), several routers separated by commas" << std::endl;
 		std::cin >> router_name;
-		// create the stub for client to router connection
-		router_stub = std::unique_ptr<user_services::Stub>(user_services::NewStub(grpc::CreateChannel(router_name, grpc::InsecureChannelCredentials())));
+	}
+	// create the stub for client to router connection, it spreads requests over every router given
+	router_stub = std::unique_ptr<user_services::Stub>(user_services::NewStub(router_channel(router_name)));
+	// trace every post this client sends or displays and write the trace on ctrl C
+	if(trace_file != ""){
+		tracing_enabled = true;
+		signal(SIGINT, handle_client_close);
+		std::thread close_watch([]() {
+			while(!close_requested){
+				usleep(100000);
+			}
+			dump_chrome_trace(trace_file, "tsc");
+			std::cout.flush();
+			_exit(0);
+		});
+		close_watch.detach();
 	}
 	// END is used by the client and server, having a username would mess up logic
 	if(username == "END"){
@@ -131,6 +210,7 @@ int main(int argc, char** argv) {
 		exit(0);
 	}
 	Client myc(initial_server.at(0), username, initial_server.at(1));
+	myc.set_read_server(initial_server.at(2), initial_server.at(3));
 	// thread that will run the main client logic
 	// You MUST invoke "run_client" function to start business logic
 	std::thread client_main([&myc](){
@@ -154,13 +234,78 @@ Client::Client(const std::string& hname, const std::string& uname,
     	
 }
 
+// this function sets the read replica the client reads from, none when ip is empty
+void Client::set_read_server(const std::string& ip, const std::string& port_no){
+	std::shared_ptr<user_services::Stub> replica = ip == "" ? nullptr : new_stub(ip, port_no);
+	std::lock_guard<std::mutex> lock(stubs_mutex);
+	read_stub_ = replica;
+	read_fallback_until = 0;
+}
+
+// helper function that returns the stub writes are sent to
+std::shared_ptr<user_services::Stub> Client::server_stub(){
+	std::lock_guard<std::mutex> lock(stubs_mutex);
+	return stub_;
+}
+
+// helper function that returns the stub reads are sent to
+std::shared_ptr<user_services::Stub> Client::read_stub(){
+	std::lock_guard<std::mutex> lock(stubs_mutex);
+	if(read_stub_ == nullptr || time(nullptr) < read_fallback_until){
+		return stub_;
+	}
+	return read_stub_;
+}
+
+// helper function that returns true when a read failed on the read replica and has to be sent to
+// the server again, the replica isn't used for a while after that
+bool Client::read_failed(const Status& status, const std::shared_ptr<user_services::Stub>& used){
+	if(status.ok()){
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(stubs_mutex);
+	if(used != read_stub_){
+		return false;
+	}
+	read_fallback_until = time(nullptr) + READ_FALLBACK_SECONDS;
+	return true;
+}
+
+// this function moves the client to another server, every thread reopens its streams on it
+void Client::switch_server(const std::string& ip, const std::string& port_no,
+		const std::string& read_ip, const std::string& read_port){
+	// tell the user that a reconnection is happening
+	displayReConnectionMessage(ip, port_no);
+	// update the client stubs, the server's and its replica's together
+	std::shared_ptr<user_services::Stub> server = new_stub(ip, port_no);
+	std::shared_ptr<user_services::Stub> replica = read_ip == "" ? nullptr : new_stub(read_ip, read_port);
+	{
+		std::lock_guard<std::mutex> lock(stubs_mutex);
+		stub_ = server;
+		read_stub_ = replica;
+		read_fallback_until = 0;
+	}
+	// update the current connected server
+	connected_server_ip = ip;
+	connected_server_port = port_no;
+	// initialize the server switched variable
+	server_switched = 1;
+	current_user username_to_send;
+	username_to_send.set_username(username);
+	server_status returned_status;
+	ClientContext newContext;
+	// update the server that a new client has connected
+	Status status = server->InitializeUser(&newContext, username_to_send, &returned_status);
+}
+
 // this function will keep sending requests to the server to see if it's still on
 // if it isn't change the stub connection to connect to the router and then connect to the server
 void Client::connection_check(){
 		
+		std::shared_ptr<user_services::Stub> server = server_stub();
 		ClientContext context;
 		std::shared_ptr<ClientReaderWriter<available_status, available_status>> stream(
-            stub_->Ping(&context));
+            server->Ping(&context));
 		available_status on;
 		on.set_available(1);
 		bool servers_online = 1;
@@ -173,29 +318,24 @@ void Client::connection_check(){
 			available_status received;
 			received.set_available(0);
 			stream->Read(&received);
+			// a draining server says where to go, the router is asked again for the server's read
+			// replica (and may have a newer server by now), the hint is taken when it doesn't answer
+			if(received.available() == 1 && received.move_to_ip() != ""){
+				std::vector<std::string> new_server = get_new_server();
+				if(new_server.size() != 0 && new_server.at(0) != "ERROR"){
+					switch_server(new_server.at(0), new_server.at(1), new_server.at(2), new_server.at(3));
+				}
+				else{
+					switch_server(received.move_to_ip(), received.move_to_port());
+				}
+				break;
+			}
 			// if no message from the server was received reconnect to another one
 			if(received.available() != 1){
 				// get a new available server from the router
 				std::vector<std::string> new_server = get_new_server();
 				if(new_server.size() != 0 && new_server.at(0) != "ERROR"){
-					// tell the user that a reconnection is happening
-					displayReConnectionMessage(new_server.at(0), new_server.at(1));
-					std::string connection_name = new_server.at(0) + ":" + new_server.at(1);
-					// update the client stub;
-					stub_ = std::unique_ptr<user_services::Stub>(
-									user_services::NewStub(grpc::CreateChannel(connection_name, 
-									grpc::InsecureChannelCredentials())));
-					// update the current connected server
-					connected_server_ip = new_server.at(0);
-					connected_server_port = new_server.at(1);
-					// initialize the server switched variable
-					server_switched = 1;
-					current_user username_to_send;
-					username_to_send.set_username(username);
-					server_status returned_status;
-					ClientContext newContext;
-					// update the server that a new client has connected
-					Status status = stub_->InitializeUser(&newContext, username_to_send, &returned_status);
+					switch_server(new_server.at(0), new_server.at(1), new_server.at(2), new_server.at(3));
 					break;
 				}
 				else { // if there are no available servers, tell the user
@@ -220,7 +360,7 @@ IReply Client::follow_user(std::string user_to_follow){
 	// Use the stub to send a follow request to the server
 	// get the IStatus of the return struct
 	ClientContext context;
-	Status status = stub_->FollowRequest(&context, info_to_send, &returned_status);
+	Status status = server_stub()->FollowRequest(&context, info_to_send, &returned_status);
 	IStatus status_to_return;
 	status_to_return = (IStatus)returned_status.s_status();
 	
@@ -249,7 +389,7 @@ IReply Client::unfollow_user(std::string user_to_unfollow){
 	ClientContext context;
 	
 	// Use the stub to make an unfollow request to the server
-	Status status = stub_->UnfollowRequest(&context, info_to_send, &returned_status);
+	Status status = server_stub()->UnfollowRequest(&context, info_to_send, &returned_status);
 	IStatus status_to_return;
 	status_to_return = (IStatus)returned_status.s_status();
 
@@ -282,8 +422,9 @@ IReply Client::list_followers(){
 	this_user.set_username(this->username);
 	IStatus status_to_return;
 
-	// Stub will make the list request to the server
-	std::unique_ptr<ClientReader<following_user_message>> reader (stub_->ListRequest(&context, this_user));
+	// Stub will make the list request to the server, or its read replica
+	std::shared_ptr<user_services::Stub> reads = read_stub();
+	std::unique_ptr<ClientReader<following_user_message>> reader (reads->ListRequest(&context, this_user));
 
 	// read in from the stream until the server stops sending messages
 	// END represents that the end of the all users list or follower list has been reached
@@ -300,6 +441,9 @@ IReply Client::list_followers(){
 	// return the reply structure built from data from the server
 	IReply ire;
 	Status status = reader->Finish();
+	if(read_failed(status, reads)){
+		return list_followers();
+	}
 	ire.grpc_status = status;
 	ire.comm_status = status_to_return;
 	ire.all_users = list_all_users;
@@ -307,6 +451,115 @@ IReply Client::list_followers(){
 	return ire;
 }
 
+// this function will display the next page of older posts from followed users
+// every HISTORY command continues where the last one stopped, after the oldest post it starts over
+IReply Client::timeline_history(){
+	page_request request;
+	page_reply reply;
+	ClientContext context;
+	request.set_username(this->username);
+	request.set_before(history_cursor);
+	request.set_page_size(10);
+	std::shared_ptr<user_services::Stub> reads = read_stub();
+	Status status = reads->TimelinePage(&context, request, &reply);
+	if(read_failed(status, reads)){
+		return timeline_history();
+	}
+
+	IReply ire;
+	ire.grpc_status = status;
+	ire.comm_status = SUCCESS;
+	if(!status.ok()){
+		history_cursor = "";
+		return ire;
+	}
+	for(int i = 0; i < reply.posts_size(); i++){
+		struct tm tm = {};
+		strptime(reply.posts(i).time().c_str(), "%a %b %d %T %Y", &tm);
+		time_t post_time = mktime(&tm);
+		displayPostMessage(reply.posts(i).username(), reply.posts(i).content(), post_time);
+	}
+	if(reply.more()){
+		history_cursor = reply.next_before();
+	}
+	else{
+		std::cout << "No older posts" << std::endl;
+		history_cursor = "";
+	}
+	return ire;
+}
+
+// this function will display the next page of posts containing every word of a query
+// repeating the same SEARCH continues where the last one stopped, a new query starts from the newest post
+IReply Client::search_posts(std::string query){
+	if(query != search_query){
+		search_query = query;
+		search_cursor = 0;
+	}
+	search_request request;
+	search_reply reply;
+	ClientContext context;
+	request.set_query(query);
+	request.set_before(search_cursor);
+	request.set_page_size(10);
+	std::shared_ptr<user_services::Stub> reads = read_stub();
+	Status status = reads->SearchPosts(&context, request, &reply);
+	if(read_failed(status, reads)){
+		return search_posts(query);
+	}
+
+	IReply ire;
+	ire.grpc_status = status;
+	ire.comm_status = SUCCESS;
+	if(!status.ok()){
+		search_cursor = 0;
+		return ire;
+	}
+	for(int i = 0; i < reply.posts_size(); i++){
+		struct tm tm = {};
+		strptime(reply.posts(i).time().c_str(), "%a %b %d %T %Y", &tm);
+		time_t post_time = mktime(&tm);
+		displayPostMessage(reply.posts(i).username(), reply.posts(i).content(), post_time);
+	}
+	if(reply.more()){
+		search_cursor = reply.next_before();
+	}
+	else{
+		std::cout << "No more matching posts" << std::endl;
+		search_cursor = 0;
+	}
+	return ire;
+}
+
+// this function will display who the user could follow, with the number of followed users following each
+IReply Client::suggest_follows(){
+	suggest_request request;
+	suggest_reply reply;
+	ClientContext context;
+	request.set_username(this->username);
+	request.set_count(10);
+	std::shared_ptr<user_services::Stub> reads = read_stub();
+	Status status = reads->SuggestFollows(&context, request, &reply);
+	if(read_failed(status, reads)){
+		return suggest_follows();
+	}
+
+	IReply ire;
+	ire.grpc_status = status;
+	ire.comm_status = SUCCESS;
+	if(!status.ok()){
+		return ire;
+	}
+	for(int i = 0; i < reply.suggestions_size(); i++){
+		std::cout << reply.suggestions(i).username() << " (followed by " << reply.suggestions(i).shared()
+				<< " you follow)" << std::endl;
+	}
+	if(reply.suggestions_size() == 0){
+		std::cout << "No suggestions" << std::endl;
+	}
+	return ire;
+}
+
 // function that will establish connection to the server
 int Client::connectTo()
 {
@@ -332,7 +585,7 @@ int Client::connectTo()
 	server_status returned_status;
 	ClientContext context;
 	
-	Status status = stub_->InitializeUser(&context, username_to_send, &returned_status);
+	Status status = server_stub()->InitializeUser(&context, username_to_send, &returned_status);
 	
 	// if the username already exists
 	if((IStatus)returned_status.s_status() == FAILURE_ALREADY_EXISTS){
@@ -364,6 +617,9 @@ IReply Client::processCommand(std::string& input)
 	// UNFOLLOW <username>
 	// LIST
 	// TIMELINE
+	// HISTORY
+	// SEARCH <words>
+	// SUGGEST
 	//
 	// - JOIN/LEAVE and "<username>" are separated by one space.
 	// ------------------------------------------------------------
@@ -388,6 +644,24 @@ IReply Client::processCommand(std::string& input)
 		ire = list_followers();
 		return ire;
 	}
+	else if(input.substr(0,7) == "HISTORY"){
+
+		// show the next page of older posts from followed users
+		ire = timeline_history();
+		return ire;
+	}
+	else if(input.substr(0,7) == "SEARCH "){
+
+		// show the next page of posts matching the query
+		ire = search_posts(input.substr(7));
+		return ire;
+	}
+	else if(input.substr(0,7) == "SUGGEST"){
+
+		// show users followed by the users this user follows
+		ire = suggest_follows();
+		return ire;
+	}
 	else if(input.substr(0, 8) == "TIMELINE"){ // timeline mode command
 
 		// Create IReply that will be used to enter timeline mode
@@ -460,11 +734,30 @@ void Client::processTimeline()
 	std::string current_user = this->username; 
 	std::thread writer([this]() {
 		std::string msg;
+		// a post whose stream was gone (the server drained or limited this client), it is sent
+		// again on the next stream
+		post_info unsent;
+		int unsent_attempts = 0;
 		// infinite loop, client won't be able to exit timeline mode
 		while(1) {
+			std::shared_ptr<user_services::Stub> server = server_stub();
 			ClientContext context;
 			std::shared_ptr<ClientReaderWriter<post_info, post_info>> stream(
-            stub_->TimelineRequest(&context));
+            server->TimelineRequest(&context));
+			if(unsent_attempts > 0){
+				if(stream->Write(unsent)){
+					trace_point(TRACE_CLIENT_SENT, unsent.trace_id());
+					unsent_attempts = 0;
+				}
+				else if(++unsent_attempts > 3){
+					std::cout << "Post not sent, the server is not taking posts" << std::endl;
+					unsent_attempts = 0;
+				}
+				else{
+					sleep(1);
+					continue;
+				}
+			}
 			while (1) {
 				// if the server has been switched increment the server_switched variable and sleep for 2 seconds
 				// once server_switched reaches 4, then all threads have been update of the switch
@@ -493,7 +786,22 @@ void Client::processTimeline()
 				info_to_send.set_time(std::ctime(&time_of_post));
 				info_to_send.set_content(msg);
 				info_to_send.set_requesting_update(0);
-				stream->Write(info_to_send);
+				if(tracing_enabled){
+					info_to_send.set_trace_id(new_trace_id());
+				}
+				if(!stream->Write(info_to_send)){
+					unsent = info_to_send;
+					unsent_attempts = 1;
+					// a server that is overloaded or limits this user ends the stream at the post
+					// it didn't store, that post was sent before this one and is lost
+					stream->WritesDone();
+					Status ended = stream->Finish();
+					if(ended.error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED){
+						std::cout << "An earlier post was not stored: " << ended.error_message() << std::endl;
+					}
+					break;
+				}
+				trace_point(TRACE_CLIENT_SENT, info_to_send.trace_id());
 			
 			}
 			
@@ -503,15 +811,24 @@ void Client::processTimeline()
 	
 	// this thread will continually send update requests to the server 
 	// this will get any new posts from followers
+	// the server answers on the stream the request was sent on, so this thread reads the
+	// posts back from the same stream until the server sends END
+	// updates come from the read replica when there is one, a stream that ends before END is
+	// opened again, on the server if it was the replica's
 	std::thread update([this]() {
 		
 		post_info update_info;
 		update_info.set_username(this->username);
 		update_info.set_requesting_update(1);
+		post_info info_to_read;
+		// the posts shown last, oldest first, see SHOWN_POSTS
+		std::deque<std::string> shown;
+		std::unordered_set<std::string> shown_posts;
 		while(1){
+			std::shared_ptr<user_services::Stub> reads = read_stub();
 			ClientContext context;
 			std::shared_ptr<ClientReaderWriter<post_info, post_info>> stream(
-            stub_->TimelineRequest(&context));
+            reads->TimelineRequest(&context));
 			while(1){
 				// if the server has been switched increment the server_switched variable and sleep for 2 seconds
 				// once server_switched reaches 4, then all threads have been update of the switch
@@ -526,57 +843,48 @@ void Client::processTimeline()
 					break;
 				}
 				stream->Write(update_info);
-				// only make a request every 1 sec
-				sleep(1);
-			}
-		}
-	});
-
-	// thread that will read from the stream whenever data becomes available
-	std::thread reader([this]() {
-		post_info info_to_read;
-		// when ther is data in the stream
-		while(1){
-			ClientContext context;
-			std::shared_ptr<ClientReaderWriter<post_info, post_info>> stream(
-		    stub_->TimelineRequest(&context));
-			while(stream->Read(&info_to_read)){
-				std::string post_user = info_to_read.username();
-				// make sure the post isn't a message indicating the end of a timeline
-				if(post_user != "END"){
+				bool ended = false;
+				while(stream->Read(&info_to_read)){
+					std::string post_user = info_to_read.username();
+					// END marks the end of the posts for this update
+					if(post_user == "END"){
+						ended = true;
+						break;
+					}
 					// convert the time string to a time_t and display the message to the user
 					std::string post_time = info_to_read.time();
 					std::string post_content = info_to_read.content();
+					// the replica has the post from the primary's log, without the new lines
+					std::string post = post_user + "|" + post_time + "|" + post_content;
+					post.erase(std::remove(post.begin(), post.end(), '\n'), post.end());
+					if(!shown_posts.insert(post).second){
+						continue;
+					}
+					shown.push_back(post);
+					if(shown.size() > SHOWN_POSTS){
+						shown_posts.erase(shown.front());
+						shown.pop_front();
+					}
 					//stackoverflow.com/questions/11213326/
 					struct tm tm;
 					strptime(post_time.c_str(), "%a %b %d %T %Y", &tm);	
 					time_t post_time_time_t = mktime(&tm);
 					displayPostMessage(post_user, post_content, post_time_time_t);
+					trace_point(TRACE_DISPLAYED, info_to_read.trace_id());
 				}
-				// if the server has been switched increment the server_switched variable and sleep for 2 seconds
-				// once server_switched reaches 4, then all threads have been update of the switch
-				if(server_switched > 0){
-					if(server_switched < 4){
-						server_switched++;
-					}
-					else{
-						server_switched = 0;
-					}
-					sleep(2);
+				if(!ended){
+					stream->WritesDone();
+					read_failed(stream->Finish(), reads);
+					sleep(1);
 					break;
 				}
+				// only make a request every 1 sec
+				sleep(1);
 			}
 		}
-		
 	});
 
 	// join all threads when they are done executing
 	update.join();
 	writer.join();
-	reader.join();
-
-
-
-
-
 }
@@ -5,13 +5,31 @@
 #include <stack>
 #include <queue>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <algorithm>
 #include <unistd.h>
 #include <fstream>
 #include <signal.h>
+#include <sys/wait.h>
 #include <sys/prctl.h>
 #include <grpc++/grpc++.h>
 
 #include "TNSService.grpc.pb.h"
+#include "user_store.h"
+#include "timeline_page.h"
+#include "trending.h"
+#include "suggest.h"
+#include "admission.h"
+#include "server_config.h"
+#include "supervisor.h"
+#include "router_channel.h"
+#include "replication.h"
+#include "peer_fanout.h"
+#include "anti_entropy.h"
+#include "stats.h"
+#include "trace.h"
 
 using grpc::Server;
 using grpc::ServerBuilder;
@@ -33,105 +51,234 @@ using TNSService::following_user_message;
 using TNSService::post_info;
 using TNSService::available_server;
 using TNSService::available_status;
-
-// user struct that contains essential information for each user
-struct user {
-	
-	std::string username = "";
-	std::vector<std::string> followers;
-	std::vector<std::string> following;
-	std::queue<std::vector<std::string>> timeline;
-	std::vector<std::vector<std::string>> posts;
-};
+using TNSService::stats_request;
+using TNSService::stats_reply;
+using TNSService::trace_request;
+using TNSService::trace_reply;
+using TNSService::page_request;
+using TNSService::page_reply;
+using TNSService::search_request;
+using TNSService::search_reply;
+using TNSService::trending_request;
+using TNSService::trending_reply;
+using TNSService::trending_term;
+using TNSService::post_counts_reply;
+using TNSService::graph_request;
+using TNSService::graph_reply;
+using TNSService::suggest_request;
+using TNSService::suggest_reply;
+using TNSService::follow_suggestion;
+using TNSService::replicate_request;
+using TNSService::log_batch;
+using TNSService::remote_follow_request;
+using TNSService::remote_follow_reply;
+using TNSService::post_batch;
+using TNSService::forward_reply;
+using TNSService::sync_request;
+using TNSService::sync_reply;
+using TNSService::sync_posts_request;
+using TNSService::sync_posts_reply;
 
 // globals for this process' ip and port and the router machine
 std::string port = "3010";
 std::string ipAddr = "localhost";
 std::string router = "localhost:3000";
+// the -c, -o and -P arguments tsd was started with, passed on to the tsd a slave execs
+std::vector<std::string> config_args;
+// listening socket inherited from the supervisor (-L), -1 when tsd binds its port itself
+int inherited_listener = -1;
 
-// helper function that will create a new slave process when one is killed
-int new_slave(){
-	// create a new slave process
-	if(fork() == 0){
-		signal(SIGINT, SIG_IGN);
-		std::string connection_name= ipAddr + ":" + port;
-		
-		std::unique_ptr<user_services::Stub> slave_stub(user_services::NewStub(grpc::CreateChannel(connection_name, grpc::InsecureChannelCredentials())));
-		
-		ClientContext context;
-		// re-establish the ping rpc with the master process
-		std::shared_ptr<ClientReaderWriter<available_status, available_status>> stream(
-            slave_stub->Ping(&context));
-		// set slave's status to on
-		available_status on;
-		on.set_available(1);
-		
-		while(1){
-			// write to the master process every two seconds
-			stream->Write(on);
-			sleep(2);
-			available_status received;
-			received.set_available(0);
-			stream->Read(&received);
-			// if nothing was read from the master process restart the server completely
-			// exec will place a new tsd process in place of the slave process 
-			if(received.available() != 1){
-				kill(getppid(), SIGKILL);
-				sleep(2);
-				execlp("./tsd","./tsd", "-i", ipAddr.c_str(), "-p", port.c_str(),"-r", router.c_str(), (char*) NULL);
+// slaves add this to the metadata of their Ping so the master can tell them from tsc clients,
+// which ping the server too
+const std::string SLAVE_METADATA = "tsd-slave";
+
+// set by the Ping handler when the slave's heartbeat stops, watch_slave starts a new slave
+std::mutex slave_mutex;
+std::condition_variable slave_lost;
+bool slave_missing = false;
+
+// helper function that returns the arguments of a new tsd on this port with the same config, a
+// slave if slave is set
+std::vector<std::string> tsd_arguments(bool slave){
+	std::vector<std::string> args = {"./tsd", "-i", ipAddr, "-p", port, "-r", router};
+	args.insert(args.end(), config_args.begin(), config_args.end());
+	if(slave){
+		args.push_back("-S");
+	}
+	return args;
+}
+
+// function that runs the slave: it pings the master every two seconds and when the master stops
+// answering, replaces itself with a new tsd that takes the master's place
+// a slave started to replace a lost one (kill_master) kills the master first, the first slave
+// starts while the master is still restoring its log and doesn't
+void run_slave(bool kill_master){
+	signal(SIGINT, SIG_IGN);
+	// a master that is gone leaves the slave with another parent, which mustn't be killed
+	pid_t master_pid = getppid();
+	std::string connection_name= ipAddr + ":" + port;
+	
+	std::unique_ptr<user_services::Stub> slave_stub(user_services::NewStub(grpc::CreateChannel(connection_name, grpc::InsecureChannelCredentials())));
+	
+	ClientContext context;
+	context.AddMetadata(SLAVE_METADATA, "1");
+	// the master may still be restoring its log, the first ping waits until it listens
+	context.set_wait_for_ready(true);
+	// set up a Ping connection with the master process
+	std::shared_ptr<ClientReaderWriter<available_status, available_status>> stream(
+		slave_stub->Ping(&context));
+	available_status on;
+	on.set_available(1);
+	
+	while(1){
+		// write to the master process every two seconds
+		stream->Write(on);
+		sleep(2);
+		available_status received;
+		received.set_available(0);
+		stream->Read(&received);
+		// if nothing was read from the master process restart the server completely
+		// exec will place a new tsd process in place of the slave process 
+		if(received.available() != 1){
+			if(kill_master && getppid() == master_pid){
+				kill(master_pid, SIGKILL);
 			}
+			sleep(2);
+			std::vector<std::string> args = tsd_arguments(false);
+			std::vector<char*> argv = exec_argv(args);
+			execvp(argv[0], argv.data());
+			std::exit(1);
 		}
 	}
-	else{ // parent process
-		return 1;
+}
+
+// helper function that will create a new slave process when one is killed
+// the child execs a fresh tsd in slave mode (-S) right away, a forked copy of the master's grpc
+// threads and locks isn't safe to keep running
+int new_slave(){
+	// the arguments are built before forking, the child only calls exec
+	std::vector<std::string> args = tsd_arguments(true);
+	std::vector<char*> argv = exec_argv(args);
+	pid_t child = fork();
+	if(child == 0){
+		execvp(argv[0], argv.data());
+		_exit(1);
 	}
+	return child > 0;
 }
-// function that will find the index of a username within a vector
-int find_follower(std::vector<std::string> v, std::string u){
-	for(int i = 0; i < v.size(); i++){
-		if(v.at(i) == u){
-			return i;
+
+// thread of the master process that starts a new slave whenever the Ping handler reports the
+// slave lost, so no grpc thread ever forks
+void watch_slave(){
+	while(1){
+		std::unique_lock<std::mutex> lock(slave_mutex);
+		while(!slave_missing){
+			slave_lost.wait(lock);
+		}
+		slave_missing = false;
+		lock.unlock();
+		new_slave();
+		// reap the slave that was lost
+		while(waitpid(-1, nullptr, WNOHANG) > 0){
 		}
 	}
-	return -1;
 }
 
-// Hash map that will be used to store all user objects
-std::unordered_map<std::string, user*> users_db;
+// helper function that waits up to ms milliseconds, it returns false as soon as the call is
+// cancelled (the client went away or its deadline passed) so the handler can give its thread back
+bool wait_for_call(ServerContext* context, int64_t ms){
+	for(int64_t waited = 0; waited < ms; waited += 100){
+		if(context->IsCancelled()){
+			return false;
+		}
+		usleep(std::min<int64_t>(100, ms - waited) * 1000);
+	}
+	return !context->IsCancelled();
+}
 
-// vector to contain the usernames of all users that have ever connected to the server
-std::vector<std::string> all_users;
+// drain: SIGINT or SIGTERM sets drain_requested and drain_server() takes it from there, the router
+// is told to stop sending clients here, connected clients are told where to move, new streams are
+// refused and the process exits once no client is left or after DRAIN_SECONDS
+const int DRAIN_SECONDS = 30;
+std::atomic<bool> drain_requested(false);
+std::atomic<bool> draining(false);
+// the server the router currently sends new clients to, read from the UpdateRouter stream
+std::mutex router_answer_mutex;
+std::string router_available_ip = "";
+std::string router_available_port = "";
+// Ping streams of the slave, they don't keep a draining server up
+std::atomic<int64_t> slave_pings(0);
+// the servers of every listener, see run_server
+std::mutex servers_mutex;
+std::vector<Server*> running_servers;
 
 // file streams that will be used to read and write to the server log
 std::ifstream old_log_file;
 std::ofstream new_log_file;
 
+// helper function that writes a line to the server log and keeps it for the replicas,
+// the caller holds users_db_mutex
+void log_line(const std::string& line){
+	new_log_file << line + "\n";
+	remember_log_line(line);
+}
+
+// ids of the metrics recorded by the server, reported by GetStats
+int initialize_latency = register_metric("InitializeUser", true);
+int follow_latency = register_metric("FollowRequest", true);
+int unfollow_latency = register_metric("UnfollowRequest", true);
+int delete_latency = register_metric("DeleteUser", true);
+int list_latency = register_metric("ListRequest", true);
+int post_latency = register_metric("TimelineRequest_post", true);
+int update_latency = register_metric("TimelineRequest_update", true);
+int stats_latency = register_metric("GetStats", true);
+int page_latency = register_metric("TimelinePage", true);
+int search_latency = register_metric("SearchPosts", true);
+int trending_latency = register_metric("GetTrending", true);
+int counts_latency = register_metric("GetPostCounts", true);
+int mutual_latency = register_metric("MutualFollows", true);
+int common_latency = register_metric("CommonFollows", true);
+int suggest_latency = register_metric("SuggestFollows", true);
+int remote_follow_latency = register_metric("RemoteFollow", true);
+int fan_out_size = register_metric("fan_out_followers", false);
+
 // server implementation of TNSService
 class TNSServiceImpl final : public user_services::Service{
 	
 	// this function will log new users that connect into the database and all users list
 	Status InitializeUser(ServerContext* context, const current_user* request, server_status* response) override {
 		
+		scoped_latency timer(initialize_latency);
+		// a replica only serves reads, see replication.h
+		if(is_replica()){
+			return read_only_status();
+		}
 		// make sure the username doesn't already exist
 		std::string requesting_user = request->username();
+		std::lock_guard<std::mutex> lock(users_db_mutex);
 		
-		if(users_db.find(requesting_user) != users_db.end()){
+		if(users_db.find(requesting_user) != users_db.end() && users_db.at(requesting_user)->home != ""){
+			// a user known from another master registered here after all, see peer_fanout.h
+			claim_remote_user(users_db.at(requesting_user));
+			log_line(initialize_log_line(users_db.at(requesting_user)));
+		}
+		else if(users_db.find(requesting_user) != users_db.end()){
 			
 			response->set_s_status(TNSService::server_status_IStatus_FAILURE_ALREADY_EXISTS);
 		}
 		else{
-			// create a new user object set it's name and enter into the database and all users
-			user* user_to_insert = new user();
-			user_to_insert->username = requesting_user;
-			users_db.insert(std::pair<std::string, user*>(requesting_user, user_to_insert));
-			all_users.push_back(requesting_user);
-
+			// create a new user and enter them into the database and all users,
 			// by default the user will follow themselves
-			users_db.at(requesting_user)->followers.push_back(requesting_user);
-			users_db.at(requesting_user)->following.push_back(requesting_user);
+			user* created = create_user(requesting_user);
+			// a user registered again after a delete is newer than the delete, see store_digest.h
+			if(user_tombstone(requesting_user) != 0){
+				created->registered_ns = change_time_ns();
+				clear_user_tombstone(requesting_user);
+				update_follow_digest(created);
+			}
 			
 			// write an initialize command to the log file
-			new_log_file << "INITIALIZE " + requesting_user +"\n";
+			log_line(initialize_log_line(created));
 			
 		}
 		
@@ -144,248 +291,706 @@ class TNSServiceImpl final : public user_services::Service{
 	// This function will handle when a user requests to follow another user
 	Status FollowRequest(ServerContext* context, const command_info* request, server_status* response) override {
 		
-		// get the user requesting a follow and the user that wants to be followed
-		std::string requesting_user = request->username();
-		std::string user_to_follow = request->username_other_user();
+		scoped_latency timer(follow_latency);
+		if(is_replica()){
+			return read_only_status();
+		}
+		return admit([&]() -> Status {
+			// get the user requesting a follow and the user that wants to be followed
+			std::string requesting_user = request->username();
+			std::string user_to_follow = request->username_other_user();
+			std::unique_lock<std::mutex> lock(users_db_mutex);
+
+			// a follow that already exists is refused, the lists and the follow graph hold it once
+			if(users_db.find(requesting_user) != users_db.end() &&
+					find_follower(users_db.at(requesting_user)->following, user_to_follow) != -1){
+				response->set_s_status(TNSService::server_status_IStatus_FAILURE_ALREADY_EXISTS);
+				return Status::OK;
+			}
+
+			// a user that registered on another master is followed through that master, the lock
+			// isn't held while it is asked, see peer_fanout.h
+			auto followed = users_db.find(user_to_follow);
+			if(users_db.find(requesting_user) != users_db.end() && user_to_follow != requesting_user &&
+					(followed == users_db.end() || followed->second->home != "")){
+				std::string home = followed == users_db.end() ? "" : followed->second->home;
+				lock.unlock();
+				remote_follow_reply reply;
+				TNSService::server_status_IStatus status = remote_follow(requesting_user, user_to_follow, true, home, reply);
+				lock.lock();
+				if(status != TNSService::server_status_IStatus_SUCCESS){
+					response->set_s_status(status);
+					return Status::OK;
+				}
+				// the requesting user may have been deleted meanwhile, the user's master forgets the
+				// follow again so it doesn't send their posts here for nobody
+				if(users_db.find(requesting_user) == users_db.end()){
+					lock.unlock();
+					remote_follow_reply undone;
+					remote_follow(requesting_user, user_to_follow, false, home, undone);
+					response->set_s_status(TNSService::server_status_IStatus_FAILURE_NOT_EXISTS);
+					return Status::OK;
+				}
+				// the first follow of the user brings their newest posts, oldest first in the store
+				if(create_remote_user(user_to_follow, home) != nullptr){
+					log_line("REMOTE_USER " + user_to_follow + "|" + home);
+					for(int i = reply.posts_size() - 1; i >= 0; i--){
+						std::vector<std::string> post_info;
+						post_info.push_back(user_to_follow);
+						post_info.push_back(reply.posts(i).time());
+						post_info.push_back(reply.posts(i).content());
+						store_post(user_to_follow, post_info);
+						log_line(post_log_line(reply.posts(i)));
+					}
+				}
+			}
 		
-		// make sure the requested user exists
-		if(users_db.find(user_to_follow) == users_db.end()){
+			// make sure both users exist, the requesting user may have been deleted
+			if(users_db.find(user_to_follow) == users_db.end() || users_db.find(requesting_user) == users_db.end()){
 			
-			response->set_s_status(TNSService::server_status_IStatus_FAILURE_NOT_EXISTS);
-		}
+				response->set_s_status(TNSService::server_status_IStatus_FAILURE_NOT_EXISTS);
+			}
 
-		// make sure the user isn't requesting to follow themselves
-		else if(user_to_follow == requesting_user){
+			// make sure the user isn't requesting to follow themselves
+			else if(user_to_follow == requesting_user){
 			
-			response->set_s_status(TNSService::server_status_IStatus_FAILURE_INVALID);
-		}
+				response->set_s_status(TNSService::server_status_IStatus_FAILURE_INVALID);
+			}
+
+			// the same follow may have been made while the lock was let go for another master
+			else if(find_follower(users_db.at(requesting_user)->following, user_to_follow) != -1){
+				response->set_s_status(TNSService::server_status_IStatus_FAILURE_ALREADY_EXISTS);
+			}
 		
-		else{
-			// add the requested user to follow to the requesting user's following list
-			// and add the requesting user to the requested user's followers list
-			users_db.at(requesting_user)->following.push_back(user_to_follow);
-			users_db.at(user_to_follow)->followers.push_back(requesting_user);
-			response->set_s_status(TNSService::server_status_IStatus_SUCCESS);
-			
-			// update the user's timeline when they follow
-			if(!users_db.at(user_to_follow)->posts.empty()){
-				int i = 0;
-				int num_posts = users_db.at(user_to_follow)->posts.size();
-				while(i != num_posts){
-					// the max size of a timeline is 20 posts
-					if(users_db.at(requesting_user)->timeline.size() == 20){
-						users_db.at(requesting_user)->timeline.pop();
-					}
-					// add posts to the timeline starting with the earliests first
-					// this means when the timeline is popped the latest post is removed
-					users_db.at(requesting_user)->timeline.push(
-							users_db.at(user_to_follow)->posts.at(i));
-					i++;				
+			else{
+				// add the requested user to follow to the requesting user's following list
+				// and add the requesting user to the requested user's followers list
+				users_db.at(requesting_user)->following.push_back(user_to_follow);
+				users_db.at(user_to_follow)->followers.push_back(requesting_user);
+				graph_follow(requesting_user, user_to_follow);
+				// a follow again after an unfollow is newer than the unfollow, see store_digest.h
+				auto version = users_db.at(requesting_user)->follow_versions.find(user_to_follow);
+				if(version != users_db.at(requesting_user)->follow_versions.end()){
+					version->second = std::make_pair(change_time_ns(), true);
 				}
+				update_follow_digest(users_db.at(requesting_user));
+				refresh_suggestions_after_follow(requesting_user);
+				response->set_s_status(TNSService::server_status_IStatus_SUCCESS);
+			
+				// update the user's timeline when they follow
+				backfill_timeline(requesting_user, user_to_follow);
+				// write the follow request to the log file
+				log_line(follow_log_line(users_db.at(requesting_user), user_to_follow, true));
 			}
-			// write the follow request to the log file
-			new_log_file << ("FOLLOW " + requesting_user + "|" + user_to_follow + "\n");
-		}
 
-		// return an OK grpc status
-		return Status::OK;
+			// return an OK grpc status
+			return Status::OK;
+		});
 	}
 	
 	// this function will handle when a user requests to unfollow anothe user
 	Status UnfollowRequest(ServerContext* context, const command_info* request, server_status* response) override {
 		
-		// get the user requesting a follow and the user that wants to be followed
-		std::string requesting_user = request->username();
-		std::string user_to_unfollow = request->username_other_user();
-
-		// make sure the requested user exists
-		if(users_db.find(user_to_unfollow) == users_db.end()){
-			response->set_s_status(TNSService::server_status_IStatus_FAILURE_NOT_EXISTS);
+		scoped_latency timer(unfollow_latency);
+		if(is_replica()){
+			return read_only_status();
 		}
+		return admit([&]() -> Status {
+			// get the user requesting a follow and the user that wants to be followed
+			std::string requesting_user = request->username();
+			std::string user_to_unfollow = request->username_other_user();
+			std::unique_lock<std::mutex> lock(users_db_mutex);
 
-		// make sure the user isn't requesting to unfollow themselves
-		else if(user_to_unfollow == requesting_user){
+			// make sure both users exist, the requesting user may have been deleted
+			if(users_db.find(user_to_unfollow) == users_db.end() || users_db.find(requesting_user) == users_db.end()){
+				response->set_s_status(TNSService::server_status_IStatus_FAILURE_NOT_EXISTS);
+			}
+
+			// make sure the user isn't requesting to unfollow themselves
+			else if(user_to_unfollow == requesting_user){
 			
-			response->set_s_status(TNSService::server_status_IStatus_FAILURE_INVALID);
-		}
+				response->set_s_status(TNSService::server_status_IStatus_FAILURE_INVALID);
+			}
 		
-		else{
-			// remove the requested user from the requesting user's following list
-			// and remove the requesting user to the requested user's followers list
-			int position_to_remove1 = find_follower(users_db.at(requesting_user)->following, user_to_unfollow);
-			int position_to_remove2 = find_follower(users_db.at(user_to_unfollow)->followers, requesting_user);
-			// make sure the user is actually in the followers list
-			if(position_to_remove1 != -1 && position_to_remove2 != -1){
-				users_db.at(requesting_user)->following.erase(users_db.at(requesting_user)->
-									following.begin() + position_to_remove1);
+			else{
+				// remove the requested user from the requesting user's following list
+				// and remove the requesting user to the requested user's followers list
+				int position_to_remove1 = find_follower(users_db.at(requesting_user)->following, user_to_unfollow);
+				int position_to_remove2 = find_follower(users_db.at(user_to_unfollow)->followers, requesting_user);
+				// make sure the user is actually in the followers list
+				if(position_to_remove1 != -1 && position_to_remove2 != -1){
+					users_db.at(requesting_user)->following.erase(users_db.at(requesting_user)->
+										following.begin() + position_to_remove1);
 			
-				users_db.at(user_to_unfollow)->followers.erase(users_db.at(user_to_unfollow)->
-									followers.begin() + position_to_remove2);
+					users_db.at(user_to_unfollow)->followers.erase(users_db.at(user_to_unfollow)->
+										followers.begin() + position_to_remove2);
+					graph_unfollow(requesting_user, user_to_unfollow);
+					users_db.at(requesting_user)->follow_versions[user_to_unfollow] = std::make_pair(change_time_ns(), false);
+					update_follow_digest(users_db.at(requesting_user));
+					refresh_suggestions_after_follow(requesting_user);
 			
-				response->set_s_status(TNSService::server_status_IStatus_SUCCESS);
-				new_log_file << ("UNFOLLOW " + requesting_user + "|" + user_to_unfollow + "\n");
+					response->set_s_status(TNSService::server_status_IStatus_SUCCESS);
+					log_line(follow_log_line(users_db.at(requesting_user), user_to_unfollow, false));
+					// the master of a remote user stops sending their posts for this follower, if it
+					// can't be told the posts keep coming and reach nobody
+					std::string home = users_db.at(user_to_unfollow)->home;
+					if(home != ""){
+						lock.unlock();
+						remote_follow_reply reply;
+						remote_follow(requesting_user, user_to_unfollow, false, home, reply);
+					}
+				}
+				else{
+					response->set_s_status(TNSService::server_status_IStatus_FAILURE_INVALID);
+				}
 			}
-			else{
-				response->set_s_status(TNSService::server_status_IStatus_FAILURE_INVALID);
+			return Status::OK;
+		});
+	}
+
+	// this function deletes a user and gives the memory of their record and posts back, see
+	// remove_user in user_store.h
+	Status DeleteUser(ServerContext* context, const current_user* request, server_status* response) override {
+		scoped_latency timer(delete_latency);
+		if(is_replica()){
+			return read_only_status();
+		}
+		std::string username = request->username();
+		std::vector<std::string> former_followers;
+		// users of other masters the user followed, with their masters, and the masters with followers
+		// of the user
+		std::vector<std::pair<std::string, std::string>> remote_following;
+		std::vector<std::string> follower_masters;
+		uint64_t deleted = 0;
+		{
+			std::lock_guard<std::mutex> lock(users_db_mutex);
+			if(users_db.find(username) != users_db.end()){
+				const std::vector<std::string>& following = users_db.at(username)->following;
+				for(int i = 0; i < following.size(); i++){
+					if(users_db.at(following.at(i))->home != ""){
+						remote_following.push_back(std::make_pair(following.at(i), users_db.at(following.at(i))->home));
+					}
+				}
+				for(auto& entry : users_db.at(username)->remote_followers){
+					follower_masters.push_back(entry.first);
+				}
+			}
+			if(!remove_user(username, former_followers)){
+				response->set_s_status(TNSService::server_status_IStatus_FAILURE_NOT_EXISTS);
+				return Status::OK;
 			}
+			// the users that followed them lost a followed user
+			for(int i = 0; i < former_followers.size(); i++){
+				refresh_suggestions_after_follow(former_followers.at(i));
+			}
+			// the other masters delete the user too, see anti_entropy.h
+			deleted = change_time_ns();
+			set_user_tombstone(username, deleted);
+			log_line(delete_log_line(username, deleted));
+		}
+		forget_post_tokens(username);
+		for(int i = 0; i < remote_following.size(); i++){
+			remote_follow_reply reply;
+			remote_follow(username, remote_following.at(i).first, false, remote_following.at(i).second, reply);
+		}
+		for(int i = 0; i < follower_masters.size(); i++){
+			remote_delete(username, deleted, follower_masters.at(i));
 		}
+		response->set_s_status(TNSService::server_status_IStatus_SUCCESS);
 		return Status::OK;
 	}
 
 	// this function will handle when a user requests a list
 	// the function will send a stream of messages that include users in all users and the user's followers
 	Status ListRequest(ServerContext* context, const current_user* request, ServerWriter<following_user_message>* writer) override {
-		std::string user_making_request = request->username();
-
-		// keep sending usernames from followers and all users
-		// if the end of either list is sent, send "END" as the value in the message
-		// all users should always be longer or equal than the followers of the user
-		// make check, if it fails send invalid status 
-		std::vector<std::string> user_followers = users_db.at(user_making_request)->followers;
-		if(!user_followers.empty()){
+		// a draining server takes no new streams, see drain_server
+		if(draining){
+			return Status(grpc::StatusCode::UNAVAILABLE, "server draining");
+		}
+		scoped_latency timer(list_latency);
+		// a replica that fell behind its primary sends the client back to it
+		if(replica_stale()){
+			return stale_replica_status();
+		}
+		return admit([&]() -> Status {
+			std::string user_making_request = request->username();
 
-			// all users should never be less than a user's followers list
-			if(all_users.size() < user_followers.size()){
-				
-				following_user_message return_info;
-				return_info.set_username("");
-				return_info.set_user_in_all_users("");
-				return_info.set_s_status(TNSService::following_user_message_IStatus_FAILURE_INVALID);
-				writer->Write(return_info);
+			// copy both lists so the lock isn't held while writing to the stream
+			std::unique_lock<std::mutex> lock(users_db_mutex);
+			if(users_db.find(user_making_request) == users_db.end()){
+				// on a replica the user may not have arrived from the primary yet
+				return is_replica() ? stale_replica_status() : Status(grpc::StatusCode::NOT_FOUND, "unknown user");
 			}
-			else{
-				// for each user that has connected to the database
-				for(int i = 0; i < all_users.size(); i++){
-
-					// when the end of the followers list is reached send a END username to the user
-					// still will return users in all users
-					if(i > user_followers.size() - 1){
-						following_user_message return_info;
-						return_info.set_username("END");
-						return_info.set_user_in_all_users(all_users.at(i));
-						return_info.set_s_status(TNSService::following_user_message_IStatus_SUCCESS);
-						writer->Write(return_info);
-					}
+			std::vector<std::string> user_followers = users_db.at(user_making_request)->followers;
+			std::vector<std::string> all_users = ::all_users;
+			lock.unlock();
 
-					// if all users and followers are the same length then send END messages
-					// for each username at the same time
-					else if(i == user_followers.size() -1 && i == all_users.size() -1){
-						following_user_message return_info;
-						return_info.set_username(user_followers.at(i));
-						return_info.set_user_in_all_users(all_users.at(i));
-						return_info.set_s_status(TNSService::following_user_message_IStatus_SUCCESS);
-						writer->Write(return_info);
-		
-						return_info.set_username("END");
-						return_info.set_user_in_all_users("END");
-						return_info.set_s_status(TNSService::following_user_message_IStatus_SUCCESS);
-						writer->Write(return_info);
-					}
-
-					// send the username of a user's follower and a user in all users
-					else{
-						following_user_message return_info;
-						return_info.set_username(user_followers.at(i));
-						return_info.set_user_in_all_users(all_users.at(i));
-						return_info.set_s_status(TNSService::following_user_message_IStatus_FAILURE_INVALID);
-						writer->Write(return_info);
-					}
-				}
-			}
+			// send the lists as a stream, see write_user_list in user_store.h
+			write_user_list(user_followers, all_users, writer);
 			return Status::OK;
-		}
-
-		// make sure each user in all users is sent to the user if the user doesn't have any followers
-		for(int i = 0; i < all_users.size(); i++){
-			following_user_message return_info;
-			return_info.set_username("END");
-			return_info.set_user_in_all_users(all_users.at(i));
-			return_info.set_s_status(TNSService::following_user_message_IStatus_SUCCESS);
-			writer->Write(return_info);
-		}
-		
-		
-		return Status::OK;
+		});
 	}
 
 	// this function will handle the user's requests when they enter timeline mode
 	Status TimelineRequest(ServerContext* context, ServerReaderWriter<post_info, post_info>* stream) override {
+		// a draining server takes no new streams, see drain_server
+		if(draining){
+			return Status(grpc::StatusCode::UNAVAILABLE, "server draining");
+		}
 		// read in from the stream for messages from users
 		// display the sent message to all sending user's followers
 		// this must be thread safe - multiple users may send requests at the same time
 
 		// read from the client's stream
+		stream_counter open_stream;
 		post_info received_info;
-		while(stream->Read(&received_info)) {
+		// Read fails once the client is gone, dead connections are found by keepalive (run_server)
+		while(!context->IsCancelled() && stream->Read(&received_info)) {
 			bool update_or_post = received_info.requesting_update();
 			// user is requesting to post to their timeline
 			if(!update_or_post){
+				if(is_replica()){
+					return read_only_status();
+				}
+				scoped_latency timer(post_latency);
+				uint64_t trace_id = received_info.trace_id();
+				trace_point(TRACE_RECEIVED, trace_id);
 				// add post to each followers timeline
 				// build a post with username, time, and content
 				// store in a vector
 				std::string requesting_user = received_info.username();
-				std::vector<std::string> user_followers = users_db.at(requesting_user)->followers;
+				// a post over the user's rate or sent while the server is overloaded isn't stored, the
+				// stream ends with RESOURCE_EXHAUSTED so the client learns it, see admission.h
+				if(!take_post_token(requesting_user)){
+					return posting_too_fast_status();
+				}
+				admission_ticket ticket;
+				if(!ticket.admitted()){
+					return overloaded_status();
+				}
+				uint64_t waiting = stats_now_ns();
+				std::unique_lock<std::mutex> lock(users_db_mutex);
+				record_lock_wait(stats_now_ns() - waiting);
+				// the user may have been deleted while their stream was open
+				if(users_db.find(requesting_user) == users_db.end()){
+					return Status(grpc::StatusCode::NOT_FOUND, "unknown user");
+				}
 				std::string post_time = received_info.time();
 				std::string post_content = received_info.content();
 				std::vector<std::string> post_info;
 				post_info.push_back(requesting_user);
 				post_info.push_back(post_time);
 				post_info.push_back(post_content);
-
-				// add the post to the user's posts list
-				users_db.at(requesting_user)->posts.push_back(post_info);
-				if(!user_followers.empty()){
-					// add the post to every followers timeline
-					for(int i = 0; i < user_followers.size(); i++){
-						// don't add the users post to their timeline, stored in user::posts
-						if(users_db.at(user_followers.at(i))->username != requesting_user){
-							// remove the oldest post from the timeline if the timeline is longer than 20
-							if(users_db.at(user_followers.at(i))->timeline.size() == 20){
-								users_db.at(user_followers.at(i))->timeline.pop();
-							}
-							//add post to the user's timeline
-							users_db.at(user_followers.at(i))->timeline.push(post_info);
-						}
-					}
+				if(trace_id != 0){
+					post_info.push_back(std::to_string(trace_id));
 				}
+
+				// add the post to the user's posts and every follower's timeline
+				record_metric(fan_out_size, fan_out_post(requesting_user, post_info));
+				// and once to every other master with followers of the user, see peer_fanout.h
+				forward_post(users_db.at(requesting_user), post_info);
+				trace_point(TRACE_FANNED_OUT, trace_id);
 				
 				//removing new lines
 				post_time.pop_back();
 				post_content.pop_back();
-				new_log_file << ("POST " + requesting_user + "|" + post_time + "|" + post_content + "\n");
+				log_line("POST " + requesting_user + "|" + post_time + "|" + post_content);
+				trace_point(TRACE_LOGGED, trace_id);
+				lock.unlock();
+				// only a stored post is counted, the trending sketches have their own lock, see trending.h
+				record_trending(received_info.content(), time(nullptr));
 				
 			}
 			// user is requesting an update to their timeline
 			else{
-				// loop until the user no longer has any outstanding posts in their timeline
-				while(!users_db.at(received_info.username())->timeline.empty()){
-					// build a post from the vector in the user's timeline
-					std::vector<std::string> timeline_info = users_db.at(received_info.username())
-												->timeline.front();
-					users_db.at(received_info.username())->timeline.pop();
-					post_info updated_post;
-					
-					// build the post object
-					updated_post.set_username(timeline_info.at(0));
-					updated_post.set_time(timeline_info.at(1));
-					updated_post.set_content(timeline_info.at(2));
-				
-					// user doesn't need to be returned their own messages
-					if(updated_post.username() != received_info.username()){
-						stream->Write(updated_post);
+				scoped_latency timer(update_latency);
+				if(replica_stale()){
+					return stale_replica_status();
+				}
+				// take every outstanding post from the user's timeline while holding the lock
+				// then write them to the stream after releasing it
+				std::queue<post_handle> outstanding;
+				{
+					std::lock_guard<std::mutex> lock(users_db_mutex);
+					if(users_db.find(received_info.username()) == users_db.end()){
+						return is_replica() ? stale_replica_status() : Status(grpc::StatusCode::NOT_FOUND, "unknown user");
 					}
-					
+					std::swap(outstanding, users_db.at(received_info.username())->timeline);
 				}
-				// tell the user the server is done sending posts
-				post_info end_post;
-				end_post.set_username("END");
-				stream->Write(end_post);
+				// write the posts and the END message, see write_timeline in user_store.h
+				// the watchdog cancels the stream if the client stops reading, see admission.h
+				watched_write watched(context);
+				write_timeline(outstanding, received_info.username(), stream);
 			}
 		}
 		
 		return Status::OK;
 	}
 
+	// this function returns a page of posts from the users the requesting user follows
+	// that are older than the cursor in the request, see timeline_page.h
+	Status TimelinePage(ServerContext* context, const page_request* request, page_reply* response) override {
+		scoped_latency timer(page_latency);
+		if(replica_stale()){
+			return stale_replica_status();
+		}
+		return admit([&]() -> Status {
+			page_cursor cursor;
+			if(!decode_cursor(request->before(), cursor)){
+				return Status(grpc::StatusCode::INVALID_ARGUMENT, "invalid cursor");
+			}
+			int page_size = request->page_size();
+			if(page_size <= 0 || page_size > MAX_PAGE_SIZE){
+				page_size = page_size <= 0 ? 20 : MAX_PAGE_SIZE;
+			}
+
+			std::vector<std::vector<std::string>> page;
+			page_cursor next;
+			bool more = false;
+			{
+				std::lock_guard<std::mutex> lock(users_db_mutex);
+				if(users_db.find(request->username()) == users_db.end()){
+					return Status(grpc::StatusCode::NOT_FOUND, "unknown user");
+				}
+				more = timeline_page(request->username(), cursor, page_size, page, next);
+			}
+			for(int i = 0; i < page.size(); i++){
+				post_info* post = response->add_posts();
+				post->set_username(page.at(i).at(0));
+				post->set_time(page.at(i).at(1));
+				post->set_content(post_body(page.at(i).at(2)));
+				post->set_trace_id(trace_id_of(page.at(i)));
+			}
+			response->set_next_before(encode_cursor(next));
+			response->set_more(more);
+			return Status::OK;
+		});
+	}
+
+	// this function returns a page of posts that contain every word of the query, newest first,
+	// see search_index.h
+	Status SearchPosts(ServerContext* context, const search_request* request, search_reply* response) override {
+		scoped_latency timer(search_latency);
+		if(replica_stale()){
+			return stale_replica_status();
+		}
+		return admit([&]() -> Status {
+			int page_size = request->page_size();
+			if(page_size <= 0 || page_size > MAX_PAGE_SIZE){
+				page_size = page_size <= 0 ? 20 : MAX_PAGE_SIZE;
+			}
+
+			std::vector<std::vector<std::string>> page;
+			uint64_t next_before = 0;
+			bool more = false;
+			{
+				std::lock_guard<std::mutex> lock(users_db_mutex);
+				more = search_posts(request->query(), request->before(), page_size, page, next_before);
+			}
+			for(int i = 0; i < page.size(); i++){
+				post_info* post = response->add_posts();
+				post->set_username(page.at(i).at(0));
+				post->set_time(page.at(i).at(1));
+				post->set_content(post_body(page.at(i).at(2)));
+				post->set_trace_id(trace_id_of(page.at(i)));
+			}
+			response->set_next_before(next_before);
+			response->set_more(more);
+			return Status::OK;
+		});
+	}
+
+	// this function returns the most frequent hashtags or words of the requested window
+	// with an interval it keeps sending them until the client cancels, see trending.h
+	Status GetTrending(ServerContext* context, const trending_request* request, ServerWriter<trending_reply>* writer) override {
+		// a draining server takes no new streams, see drain_server
+		if(draining){
+			return Status(grpc::StatusCode::UNAVAILABLE, "server draining");
+		}
+		if(replica_stale()){
+			return stale_replica_status();
+		}
+		// a subscription is shed when it starts, not while it waits between intervals
+		if(!admission_ticket().admitted()){
+			return overloaded_status();
+		}
+		stream_counter open_stream;
+		int count = request->count();
+		if(count <= 0 || count > TRENDING_CANDIDATES){
+			count = count <= 0 ? 10 : TRENDING_CANDIDATES;
+		}
+		while(!context->IsCancelled()){
+			trending_reply reply;
+			{
+				scoped_latency timer(trending_latency);
+				std::vector<trending_candidate> top;
+				uint64_t total = 0;
+				int64_t now = time(nullptr);
+				if(!top_trending(request->window(), request->hashtags(), count, now, top, total)){
+					return Status(grpc::StatusCode::INVALID_ARGUMENT, "window must be 5m, 1h or 24h");
+				}
+				reply.set_window(request->window());
+				reply.set_total(total);
+				reply.set_time(now);
+				for(int i = 0; i < top.size(); i++){
+					trending_term* term = reply.add_terms();
+					term->set_term(top.at(i).term);
+					term->set_count(top.at(i).count);
+				}
+			}
+			if(!writer->Write(reply) || request->interval_seconds() <= 0){
+				break;
+			}
+			if(!wait_for_call(context, request->interval_seconds() * 1000)){
+				break;
+			}
+		}
+		return Status::OK;
+	}
+
+	// this function returns the post counters of a user, or of the whole server for an empty username
+	Status GetPostCounts(ServerContext* context, const current_user* request, post_counts_reply* response) override {
+		scoped_latency timer(counts_latency);
+		if(replica_stale()){
+			return stale_replica_status();
+		}
+		return admit([&]() -> Status {
+			post_counters counters;
+			{
+				std::lock_guard<std::mutex> lock(users_db_mutex);
+				if(request->username() == ""){
+					counters = all_post_counters;
+				}
+				else if(users_db.find(request->username()) != users_db.end()){
+					counters = users_db.at(request->username())->counters;
+				}
+				else{
+					return Status(grpc::StatusCode::NOT_FOUND, "unknown user");
+				}
+			}
+			for(int hour = 0; hour < 24; hour++){
+				response->add_hours(counters.hours[hour]);
+			}
+			for(int day = 0; day < 7; day++){
+				response->add_weekdays(counters.weekdays[day]);
+			}
+			response->set_total(counters.total);
+			return Status::OK;
+		});
+	}
+
+	// this function returns the users that the requesting user follows and that follow them back
+	// and whether the requesting user and the other user in the request follow each other
+	// the sets come from the bitmap follow graph, see follow_graph.h
+	Status MutualFollows(ServerContext* context, const command_info* request, graph_reply* response) override {
+		scoped_latency timer(mutual_latency);
+		if(replica_stale()){
+			return stale_replica_status();
+		}
+		return admit([&]() -> Status {
+			std::vector<std::string> usernames;
+			std::lock_guard<std::mutex> lock(users_db_mutex);
+			if(users_db.find(request->username()) == users_db.end() ||
+					(request->username_other_user() != "" && users_db.find(request->username_other_user()) == users_db.end())){
+				return Status(grpc::StatusCode::NOT_FOUND, "unknown user");
+			}
+			uint32_t id = graph_id(request->username());
+			std::vector<uint32_t> mutual = set_intersection(social_graph.following.at(id), social_graph.followers.at(id));
+			for(int i = 0; i < mutual.size() && i < MAX_GRAPH_USERS; i++){
+				response->add_usernames(social_graph.names.at(mutual.at(i)));
+			}
+			response->set_count(mutual.size());
+			if(request->username_other_user() != ""){
+				uint32_t other = graph_id(request->username_other_user());
+				response->set_follows_other(set_contains(social_graph.following.at(id), other));
+				response->set_followed_by_other(set_contains(social_graph.followers.at(id), other));
+			}
+			return Status::OK;
+		});
+	}
+
+	// this function returns the users that every user in the request follows, or with followers
+	// set, the users that follow every one of them
+	Status CommonFollows(ServerContext* context, const graph_request* request, graph_reply* response) override {
+		scoped_latency timer(common_latency);
+		if(replica_stale()){
+			return stale_replica_status();
+		}
+		return admit([&]() -> Status {
+			int limit = request->limit();
+			if(limit <= 0 || limit > MAX_GRAPH_USERS){
+				limit = MAX_GRAPH_USERS;
+			}
+			std::lock_guard<std::mutex> lock(users_db_mutex);
+			std::vector<uint32_t> ids;
+			for(int i = 0; i < request->usernames_size(); i++){
+				if(users_db.find(request->usernames(i)) == users_db.end()){
+					return Status(grpc::StatusCode::NOT_FOUND, "unknown user " + request->usernames(i));
+				}
+				ids.push_back(graph_id(request->usernames(i)));
+			}
+			// graph_id() can grow the graph's vectors, the sets are looked up once every id exists
+			std::vector<const id_set*> sets;
+			for(int i = 0; i < ids.size(); i++){
+				sets.push_back(request->followers() ? &social_graph.followers.at(ids.at(i)) : &social_graph.following.at(ids.at(i)));
+			}
+			std::vector<uint32_t> common = sets_intersection(sets);
+			for(int i = 0; i < common.size() && i < limit; i++){
+				response->add_usernames(social_graph.names.at(common.at(i)));
+			}
+			response->set_count(common.size());
+			return Status::OK;
+		});
+	}
+
+	// this function returns who to follow for a user: users followed by the users they follow,
+	// with the most shared connections first, see suggest.h
+	Status SuggestFollows(ServerContext* context, const suggest_request* request, suggest_reply* response) override {
+		scoped_latency timer(suggest_latency);
+		if(replica_stale()){
+			return stale_replica_status();
+		}
+		return admit([&]() -> Status {
+			int count = request->count();
+			if(count <= 0 || count > MAX_SUGGESTIONS){
+				count = count <= 0 ? 10 : MAX_SUGGESTIONS;
+			}
+			std::lock_guard<std::mutex> lock(users_db_mutex);
+			if(users_db.find(request->username()) == users_db.end()){
+				return Status(grpc::StatusCode::NOT_FOUND, "unknown user");
+			}
+			std::vector<std::pair<std::string, uint32_t>> suggested = suggest_follows(request->username(), count);
+			for(int i = 0; i < suggested.size(); i++){
+				follow_suggestion* added = response->add_suggestions();
+				added->set_username(suggested.at(i).first);
+				added->set_shared(suggested.at(i).second);
+			}
+			return Status::OK;
+		});
+	}
+
+	// this function streams the server log to a read replica from the line it asks for,
+	// see replication.h
+	// replicas don't hold up a drain, they follow the primary again once it restarted
+	Status ReplicateLog(ServerContext* context, const replicate_request* request, ServerWriter<log_batch>* writer) override {
+		if(is_replica()){
+			return Status(grpc::StatusCode::FAILED_PRECONDITION, "replicas don't serve their log");
+		}
+		uint64_t flushed = 0;
+		{
+			// lines older than the window are read back from the file
+			std::lock_guard<std::mutex> lock(users_db_mutex);
+			new_log_file.flush();
+			flushed = replication.next_seq;
+		}
+		replication.streams++;
+		Status status = stream_log(context, request->from_seq(), flushed, writer);
+		replication.streams--;
+		return status;
+	}
+
+	// this function tells another master whether a user registered on this server, see peer_fanout.h
+	Status FindUser(ServerContext* context, const current_user* request, server_status* response) override {
+		if(is_replica()){
+			return read_only_status();
+		}
+		std::lock_guard<std::mutex> lock(users_db_mutex);
+		auto found = users_db.find(request->username());
+		if(found != users_db.end() && found->second->home == ""){
+			response->set_s_status(TNSService::server_status_IStatus_SUCCESS);
+		}
+		else{
+			response->set_s_status(TNSService::server_status_IStatus_FAILURE_NOT_EXISTS);
+		}
+		return Status::OK;
+	}
+
+	// this function records (or drops) a follower on another master of a user of this server, their
+	// posts are sent there from now on and the newest ones go back for the follower's timeline
+	Status RemoteFollow(ServerContext* context, const remote_follow_request* request, remote_follow_reply* response) override {
+		scoped_latency timer(remote_follow_latency);
+		if(is_replica()){
+			return read_only_status();
+		}
+		std::string follower = request->follower();
+		std::string followee = request->followee();
+		std::string server = request->follower_server();
+		std::lock_guard<std::mutex> lock(users_db_mutex);
+		auto found = users_db.find(followee);
+		// a user of the master that sent this was deleted there, their record here goes too
+		if(request->deleted() != 0){
+			std::vector<std::string> former_followers;
+			if(found != users_db.end() && found->second->home == server && remove_user(followee, former_followers)){
+				for(int i = 0; i < former_followers.size(); i++){
+					refresh_suggestions_after_follow(former_followers.at(i));
+				}
+				set_user_tombstone(followee, request->deleted());
+				log_line(delete_log_line(followee, request->deleted()));
+			}
+			response->mutable_status()->set_s_status(TNSService::server_status_IStatus_SUCCESS);
+			return Status::OK;
+		}
+		if(found == users_db.end() || found->second->home != ""){
+			response->mutable_status()->set_s_status(TNSService::server_status_IStatus_FAILURE_NOT_EXISTS);
+			return Status::OK;
+		}
+		if(request->follow()){
+			if(add_remote_follower(followee, follower, server)){
+				log_line("REMOTE_FOLLOW " + follower + "|" + followee + "|" + server);
+			}
+			std::vector<post_handle> newest = newest_posts(followee, 20);
+			for(int i = 0; i < newest.size(); i++){
+				post_info* post = response->add_posts();
+				post->set_username(followee);
+				post->mutable_time()->assign(newest.at(i)->field(1), newest.at(i)->lengths[1]);
+				post->set_content(post_body(newest.at(i)->field(2), newest.at(i)->lengths[2]));
+			}
+		}
+		else if(remove_remote_follower(followee, follower, server)){
+			log_line("REMOTE_UNFOLLOW " + follower + "|" + followee + "|" + server);
+		}
+		response->mutable_status()->set_s_status(TNSService::server_status_IStatus_SUCCESS);
+		return Status::OK;
+	}
+
+	// this function takes the batches of posts another master sends for the followers of its users
+	// on this server until the master closes the stream, see peer_fanout.h
+	Status ForwardPosts(ServerContext* context, ServerReader<post_batch>* reader, forward_reply* response) override {
+		if(is_replica()){
+			return read_only_status();
+		}
+		post_batch batch;
+		uint64_t received = 0;
+		while(reader->Read(&batch)){
+			std::vector<std::string> log_lines;
+			std::lock_guard<std::mutex> lock(users_db_mutex);
+			record_metric(fan_out_size, deliver_post_batch(batch, log_lines));
+			for(int i = 0; i < log_lines.size(); i++){
+				log_line(log_lines.at(i));
+			}
+			received += batch.posts_size();
+		}
+		response->set_received(received);
+		return Status::OK;
+	}
+
+	// these functions answer another master comparing its store with this one, see anti_entropy.h
+	Status SyncDigests(ServerContext* context, const sync_request* request, sync_reply* response) override {
+		if(is_replica()){
+			return read_only_status();
+		}
+		answer_sync_request(*request, response);
+		return Status::OK;
+	}
+
+	Status SyncPosts(ServerContext* context, const sync_posts_request* request, sync_posts_reply* response) override {
+		if(is_replica()){
+			return read_only_status();
+		}
+		answer_sync_posts(*request, response);
+		return Status::OK;
+	}
+
 	// function that will restore the server from the most previous server log
 	// will return a list of users that have been initailized in the past
 	std::vector<std::string> restore_server(){
@@ -399,103 +1004,7 @@ class TNSServiceImpl final : public user_services::Service{
 			
 			// execute restoration
 			while(getline(old_log_file, history)){
-				// parse the first word of the line for the command
-				if(history.substr(0,10) == "INITIALIZE"){
-					
-					// create a new user
-					user* new_user = new user();
-					
-					if(users_db.find(history.substr(11)) == users_db.end()){
-						// add to the database and all users list
-						users_db.insert(std::pair<std::string, user*>(history.substr(11), new_user));
-						all_users.push_back(history.substr(11));
-						
-						// add the user to their own followers and following
-						users_db.at(history.substr(11))->followers.push_back(history.substr(11));
-						users_db.at(history.substr(11))->following.push_back(history.substr(11));
-						
-						
-						// add to initialized users
-						initialized_users.push_back(history.substr(11));
-					}
-				}
-				else if(history.substr(0,6) == "FOLLOW"){
-					// get the user requesting the follow
-					// and the requested user
-					std::size_t index = history.find_first_of("|");
-					std::string requesting_user = history.substr(7,index - 7);
-					std::string requested_user = history.substr(index+1);
-				
-					// add the requested user to requesting's following
-					users_db.at(requesting_user)->following.push_back(requested_user);
-				
-					// add the requesting user to the requested's followers
-					users_db.at(requested_user)->followers.push_back(requesting_user);
-
-					// add requested user's posts to the requesting's timeline
-					if(!users_db.at(requested_user)->posts.empty()){
-						int i = 0;
-						int num_posts = users_db.at(requested_user)->posts.size();
-						while(i != num_posts){
-							if(users_db.at(requesting_user)->timeline.size() == 20){
-								users_db.at(requesting_user)->timeline.pop();
-							}
-							users_db.at(requesting_user)->timeline.push(
-									users_db.at(requested_user)->posts.at(num_posts - (i+1)));
-							i++;				
-						}
-					}
-				}
-				else if(history.substr(0,8) == "UNFOLLOW"){
-					// get the requesting and requested usernames
-					std::size_t index = history.find_first_of("|");
-					std::string requesting_user = history.substr(9,index - 9);
-					std::string requested_user = history.substr(index+1);
-				
-					// remove the requesting from the requested's followers
-					int position_to_remove1 = find_follower(users_db.at(requesting_user)->following, requested_user);
-					int position_to_remove2 = find_follower(users_db.at(requested_user)->followers, requesting_user);
-					users_db.at(requesting_user)->following.erase(users_db.at(requesting_user)->
-												following.begin() + position_to_remove1);
-					
-					users_db.at(requested_user)->followers.erase(users_db.at(requested_user)->
-												followers.begin() + position_to_remove2);
-
-				}
-				else if(history.substr(0,4) == "POST"){
-					// construct the post
-					std::vector<std::string> post_info;
-					std::size_t index_user = history.find_first_of("|");
-					std::string user = history.substr(5, index_user - 5);
-					std::string rest_of_post = history.substr(index_user+1);
-					std::size_t index_time = rest_of_post.find_first_of("|");
-					std::string time = rest_of_post.substr(0, index_time);
-					std::string content = rest_of_post.substr(index_time + 1);
-					post_info.push_back(user);
-					post_info.push_back(time);
-					post_info.push_back(content);
-					
-					// add this post to the user's timeline and posts
-					users_db.at(user)->timeline.push(post_info);
-					users_db.at(user)->posts.push_back(post_info);
-					
-					// add the post to all of the user's followers
-					std::vector<std::string> user_followers = users_db.at(user)->followers;
-					if(!user_followers.empty()){
-						for(int i = 0; i < user_followers.size(); i++){
-							// don't add the post to the user's timeline again
-							if(user_followers.at(i) != user){
-								// if the user has 20 posts in their timeline pop the oldest one
-								if(users_db.at(user_followers.at(i))->timeline.size() == 20){
-									users_db.at(user_followers.at(i))->timeline.pop();
-								}
-								// add post to the timeline
-								users_db.at(user_followers.at(i))->timeline.push(post_info);
-							}
-						}
-					}
-				
-				}
+				apply_log_line(history, initialized_users);
 			}
 		}
 		// clear the file to be written again
@@ -505,22 +1014,152 @@ class TNSServiceImpl final : public user_services::Service{
 
 	// service that will be used to track if a process (client or slave is online)
 	Status Ping(ServerContext* context, ServerReaderWriter<available_status, available_status>* stream) override {
+		stream_counter open_stream;
+		bool from_slave = context->client_metadata().count(SLAVE_METADATA) > 0;
+		if(!from_slave && draining){
+			return Status(grpc::StatusCode::UNAVAILABLE, "server draining");
+		}
+		slave_pings += from_slave;
 		available_status on;
 		on.set_available(1);
-		while(1) {
+		bool answered = true;
+		// the handler returns as soon as the caller is gone instead of waiting out a heartbeat
+		while(answered && !context->IsCancelled()) {
+			// a draining server tells the client where the router sends new clients now
+			if(draining && !from_slave){
+				std::lock_guard<std::mutex> lock(router_answer_mutex);
+				on.set_move_to_ip(router_available_ip);
+				on.set_move_to_port(router_available_port);
+			}
 			// write to the client or slave every 2 seconds
 			// notifying that this server is online
-			stream->Write(on);
-			sleep(2);
+			answered = stream->Write(on) && wait_for_call(context, 2000);
 			available_status received;
 			received.set_available(0);
-			stream->Read(&received);
-			// if no message was received from the slave process, restart a new slave
-			if(received.available() != 1){
-				new_slave();
-				break;
+			answered = answered && stream->Read(&received) && received.available() == 1;
+		}
+		slave_pings -= from_slave;
+		// if no message was received from the slave process, have a new slave started
+		// a tsc client that disconnected needs nothing, and neither does a server shutting down
+		if(from_slave && !draining){
+			std::lock_guard<std::mutex> lock(slave_mutex);
+			slave_missing = true;
+			slave_lost.notify_one();
+		}
+		return Status::OK;
+	}
+	
+	// this function reports the latency of every rpc and the size of the store
+	Status GetStats(ServerContext* context, const stats_request* request, stats_reply* response) override {
+		scoped_latency timer(stats_latency);
+		add_metrics(response);
+
+		// walk the store once to count follow edges and queued timeline posts
+		int64_t follow_edges = 0;
+		int64_t timeline_posts = 0;
+		int64_t timeline_depth_max = 0;
+		int64_t stored_posts = 0;
+		int64_t spilled_posts = 0;
+		int64_t segment_bytes = 0;
+		int64_t log_bytes = 0;
+		int64_t users = 0;
+		int64_t indexed_posts = 0;
+		int64_t index_terms = 0;
+		int64_t index_bytes = 0;
+		uint64_t user_blocks = 0;
+		uint64_t user_records = 0;
+		uint64_t post_blocks = 0;
+		uint64_t post_records = 0;
+		int64_t remote_users = 0;
+		int64_t remote_followers = 0;
+		{
+			std::lock_guard<std::mutex> lock(users_db_mutex);
+			users = users_db.size();
+			for(auto& entry : users_db){
+				user* u = entry.second;
+				// every user follows themselves, that edge isn't counted
+				follow_edges += u->following.size() > 0 ? u->following.size() - 1 : 0;
+				timeline_posts += u->timeline.size();
+				if((int64_t)u->timeline.size() > timeline_depth_max){
+					timeline_depth_max = u->timeline.size();
+				}
+				stored_posts += u->posts.size();
+				spilled_posts += u->spilled_posts;
+				remote_users += u->home != "";
+				for(auto& server : u->remote_followers){
+					remote_followers += server.second.size();
+				}
 			}
-			
+			log_bytes = is_replica() ? 0 : (int64_t)new_log_file.tellp();
+			segment_bytes = post_segment_bytes();
+			indexed_posts = post_search.posts.size();
+			index_terms = post_search.terms.size();
+			index_bytes = search_index_bytes();
+		}
+		slab_usage(user_pool, user_blocks, user_records);
+		post_pool_usage(post_blocks, post_records);
+		add_gauge(response, "users", users);
+		add_gauge(response, "follow_edges", follow_edges);
+		add_gauge(response, "stored_posts", stored_posts);
+		add_gauge(response, "spilled_posts", spilled_posts);
+		add_gauge(response, "post_segment_bytes", segment_bytes);
+		add_gauge(response, "timeline_posts", timeline_posts);
+		add_gauge(response, "timeline_depth_max", timeline_depth_max);
+		add_gauge(response, "indexed_posts", indexed_posts);
+		add_gauge(response, "index_terms", index_terms);
+		add_gauge(response, "index_bytes", index_bytes);
+		add_gauge(response, "log_bytes", log_bytes);
+		add_gauge(response, "user_records", user_records);
+		add_gauge(response, "user_slab_bytes", user_blocks * SLAB_BLOCK_BYTES);
+		add_gauge(response, "post_records", post_records);
+		add_gauge(response, "post_slab_bytes", post_blocks * SLAB_BLOCK_BYTES);
+		add_gauge(response, "active_streams", active_streams.load());
+		add_gauge(response, "draining", draining);
+		int64_t threads = 0;
+		int64_t rss_bytes = 0;
+		read_process_usage(threads, rss_bytes);
+		add_gauge(response, "threads", threads);
+		add_gauge(response, "rss_bytes", rss_bytes);
+		add_gauge(response, "requests_in_flight", admission.in_flight.load());
+		add_gauge(response, "lock_wait_us", recent_lock_wait_us());
+		add_gauge(response, "requests_shed", admission.shed.load());
+		add_gauge(response, "posts_throttled", admission.throttled.load());
+		add_gauge(response, "slow_streams_cancelled", admission.cancelled_writes.load());
+		add_gauge(response, "listeners", listener_count(tsd_config));
+		add_gauge(response, "post_bodies_compressed", post_compression.bodies.load());
+		add_gauge(response, "post_body_raw_bytes", post_compression.raw_bytes.load());
+		add_gauge(response, "post_body_stored_bytes", post_compression.stored_bytes.load());
+		add_gauge(response, "post_dictionaries", post_compression.dictionary_count.load());
+		add_gauge(response, "replication_seq", is_replica() ? replication.applied_seq.load() : replication.next_seq);
+		add_gauge(response, "replication_streams", replication.streams.load());
+		add_gauge(response, "remote_users", remote_users);
+		add_gauge(response, "remote_followers", remote_followers);
+		add_gauge(response, "peer_posts_forwarded", peer_fanout.forwarded.load());
+		add_gauge(response, "peer_batches_sent", peer_fanout.batches.load());
+		add_gauge(response, "peer_posts_queued", peer_queue_posts());
+		add_gauge(response, "peer_posts_dropped", peer_fanout.dropped.load());
+		add_gauge(response, "peer_posts_received", peer_fanout.delivered.load());
+		add_gauge(response, "peer_posts_duplicate", peer_fanout.duplicates.load());
+		add_gauge(response, "anti_entropy_rounds", anti_entropy.rounds.load());
+		add_gauge(response, "anti_entropy_bytes", anti_entropy.bytes.load());
+		add_gauge(response, "anti_entropy_differing_users", anti_entropy.differing_users.load());
+		add_gauge(response, "anti_entropy_users_taken", anti_entropy.users_taken.load());
+		add_gauge(response, "anti_entropy_deletes_taken", anti_entropy.deletes_taken.load());
+		add_gauge(response, "anti_entropy_follows_taken", anti_entropy.follows_taken.load());
+		add_gauge(response, "anti_entropy_posts_taken", anti_entropy.posts_taken.load());
+		add_gauge(response, "replica_lag_ms", is_replica() ? (int64_t)(stats_now_ns() - replication.caught_up_ns.load()) / 1000000 : 0);
+		build_exposition(response, "tsd");
+		return Status::OK;
+	}
+	
+	// this function turns the post tracer on or off and returns the recorded events
+	Status SetTracing(ServerContext* context, const trace_request* request, trace_reply* response) override {
+		tracing_enabled = request->enabled();
+		response->set_enabled(request->enabled());
+		if(request->dump()){
+			uint64_t events = 0;
+			response->set_chrome_trace(chrome_trace_json("tsd " + ipAddr + ":" + port, &events));
+			response->set_events(events);
 		}
 		return Status::OK;
 	}
@@ -529,47 +1168,184 @@ class TNSServiceImpl final : public user_services::Service{
 	// function that will build and run the server
 	// public because main needs to call this function
 	void run_server(std::string hostname, std::string port_no) {
+		// posts that don't fit in memory go to segment files of this server
+		if(!open_post_segments("post_segment_" + port_no)){
+			std::cout<<"could not open post segments:"<<std::endl;
+			std::exit(1);
+		}
+		// post bodies are compressed from the log replay on, with the dictionary of the last run
+		if(tsd_config.compress_posts){
+			enable_post_compression("post_dictionary_" + port_no + ".dat");
+		}
 		// Before building the server, restore the previous users
-		std::vector<std::string> initialized_users = restore_server();
-		
-		// add the initialized users as the first commands in the server log
-		new_log_file.open("new_server_log.txt");
-		if(!new_log_file.is_open()){
-			std::cout<<"could not open server log:"<<std::endl;
-			std::exit(0);
+		// a replica keeps no log of its own, it starts empty and applies its primary's
+		if(!is_replica()){
+			restore_server();
 		}
+		// who to follow suggestions are computed in the background from here on
+		start_suggestion_worker();
+		start_admission_watchdog();
 		
-		// add all initialized users to the log file so they can be maintained through
-		// future server logs
-		if(!initialized_users.empty()){
-			for(int i = 0; i < initialized_users.size(); i++){
-				new_log_file << "INITIALIZE " + initialized_users.at(i) + "\n";
+		if(is_replica()){
+			std::thread(follow_primary).detach();
+		}
+		else{
+			// the new log begins with a snapshot of the store the old one rebuilt (users, posts,
+			// follows), written next to it and moved over it once complete so a crash meanwhile
+			// leaves the old log, replicas start over from the snapshot (replication.h)
+			new_log_file.open("new_server_log.txt.new", std::ofstream::trunc);
+			if(!new_log_file.is_open()){
+				std::cout<<"could not open server log:"<<std::endl;
+				std::exit(1);
+			}
+			{
+				std::lock_guard<std::mutex> lock(users_db_mutex);
+				write_store_snapshot(log_line);
+				new_log_file.flush();
+				if(!new_log_file || rename("new_server_log.txt.new", "new_server_log.txt") != 0){
+					std::cout<<"could not write server log:"<<std::endl;
+					std::exit(1);
+				}
 			}
+			// the other masters are compared with from the first answer of a router on
+			start_anti_entropy(tsd_config.anti_entropy_seconds, log_line);
 		}
 		
-		// build and run the server on local host
-		ServerBuilder builder;
+		// build and run a server for every listener on local host, they share the port and the
+		// store, this one serves the first listener (server_config.h)
+		// under a supervisor the listeners take their connections from the inherited socket
 		std::string connection_name = hostname + ":" + port_no;
-	    	builder.AddListeningPort(connection_name, grpc::InsecureServerCredentials());
-	
-	    	
-	    	builder.RegisterService(this);
-	    	
-	    	// Finally we can assemble the server.
-	    	std::unique_ptr<Server> server(builder.BuildAndStart());
-	    	
-	    	// Wait for the server to shutdown.
-	    	server->Wait();
+		int listeners = listener_count(tsd_config);
+		std::vector<std::unique_ptr<TNSServiceImpl>> services;
+		std::vector<std::unique_ptr<Server>> servers;
+		std::vector<std::shared_ptr<grpc::experimental::ExternalConnectionAcceptor>> acceptors;
+		for(int i = 0; i < listeners; i++){
+			TNSServiceImpl* service = this;
+			if(i > 0){
+				services.push_back(std::unique_ptr<TNSServiceImpl>(new TNSServiceImpl()));
+				service = services.back().get();
+			}
+			ServerBuilder builder;
+			if(inherited_listener >= 0){
+				acceptors.push_back(builder.experimental().AddExternalConnectionAcceptor(
+					ServerBuilder::experimental_type::ExternalConnectionType::FROM_FD, grpc::InsecureServerCredentials()));
+			}
+			else{
+				builder.AddListeningPort(connection_name, grpc::InsecureServerCredentials());
+			}
+			apply_server_config(builder, tsd_config, i);
+			builder.RegisterService(service);
+			servers.push_back(builder.BuildAndStart());
+			if(servers.back() == nullptr){
+				std::cout<<"could not start listener "<<i<<" on "<<connection_name<<std::endl;
+				std::exit(1);
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(servers_mutex);
+			for(int i = 0; i < servers.size(); i++){
+				running_servers.push_back(servers.at(i).get());
+			}
+		}
+		if(inherited_listener >= 0){
+			// a draining server stops accepting, new clients wait for the next tsd
+			std::thread(accept_connections, inherited_listener, acceptors, std::cref(draining)).detach();
+		}
 		
+		// Wait for the servers to shutdown.
+		for(int i = 0; i < servers.size(); i++){
+			servers.at(i)->Wait();
+		}
 	}
 };
 
-// function that will catch ctrl C
-// will close log file
-void handle_server_close(int p){
+// function that keeps a heartbeat stream to one router, letting it know this server is online
+// every server talks to every router of the cluster (router_channel.h), a stream that breaks
+// because its router went away is opened again
+void contact_router(std::string router_address){
+	std::unique_ptr<user_services::Stub> router_stub(user_services::NewStub(grpc::CreateChannel(router_address, grpc::InsecureChannelCredentials())));
+	available_server on;
+	on.set_ip_addr(ipAddr);
+	on.set_port(port);
+	on.set_online(1);
+	// a replica is never elected, the router hands it to clients for reads
+	on.set_replica_of(replication.primary);
+	
+	while(1){
+		ClientContext context;
+		std::shared_ptr<ClientReaderWriter<available_server, available_server>> stream(
+			router_stub->UpdateRouter(&context));
+		while(1){
+			on.set_draining(draining);
+			if(!stream->Write(on)){
+				break;
+			}
+			// the router answers with the server it sends new clients to, which is where the
+			// clients of a draining server are told to move
+			available_server answer;
+			if(!stream->Read(&answer)){
+				break;
+			}
+			// and with the online masters, see peer_fanout.h
+			set_peer_masters(answer.masters());
+			{
+				std::lock_guard<std::mutex> lock(router_answer_mutex);
+				if(!(answer.ip_addr() == ipAddr && answer.port() == port) && answer.ip_addr() != "ERROR"){
+					router_available_ip = answer.ip_addr();
+					router_available_port = answer.port();
+				}
+				else{
+					router_available_ip = "";
+					router_available_port = "";
+				}
+			}
+			sleep(2);
+		}
+		context.TryCancel();
+		sleep(2);
+	}
+}
+
+// function that drains the server and exits, see drain_requested
+void drain_server(){
+	draining = true;
+	std::cout<<"draining server"<<std::endl;
+	uint64_t deadline = stats_now_ns() + (uint64_t)DRAIN_SECONDS * 1000000000;
+	// wait for the clients to move and for requests in progress (and their fan-out) to finish
+	while(stats_now_ns() < deadline && (active_streams - slave_pings > 0 || admission.in_flight > 0)){
+		usleep(100000);
+	}
+	// then for the posts queued for other masters to reach them, see peer_fanout.h
+	if(!flush_peer_links(deadline)){
+		std::cout<<"drain deadline passed with "<<peer_queue_posts()<<" posts queued for other masters"<<std::endl;
+	}
+	{
+		// the slave's Ping and anything still open is cancelled after a grace period
+		std::lock_guard<std::mutex> lock(servers_mutex);
+		auto deadline = std::chrono::system_clock::now() + std::chrono::seconds(2);
+		for(int i = 0; i < running_servers.size(); i++){
+			running_servers.at(i)->Shutdown(deadline);
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(users_db_mutex);
+		new_log_file.flush();
+		new_log_file.close();
+		close_post_segments();
+	}
 	std::cout<<"closing server"<<std::endl;
-	new_log_file.close();
-	std::exit(0);
+	// other threads are still running, static destructors mustn't run under them
+	_exit(0);
+}
+
+// a first SIGINT or SIGTERM drains the server, a second one closes it right away
+// only async signal safe calls are made here, so log lines not flushed yet are lost on a second signal
+void handle_server_close(int p){
+	if(!drain_requested){
+		drain_requested = true;
+		return;
+	}
+	_exit(0);
 }
 
 int main(int argc, char** argv) {
@@ -577,9 +1353,54 @@ int main(int argc, char** argv) {
 	bool router_exists = 0;
 	bool ip_exists = 0;
 	bool port_exists = 0;
+	bool slave_mode = 0;
 	// get port number from the user
-	while ((opt = getopt(argc, argv, "p:i:r:")) != -1){
+	std::string config_error;
+	bool supervisor_mode = 0;
+	while ((opt = getopt(argc, argv, "p:i:r:Sc:o:sL:P:")) != -1){
 		switch(opt) {
+		    case 's':{
+			// run tsd as a child and restart it when it exits, see supervisor.h
+			supervisor_mode = 1;
+			break;
+		    }
+		    case 'L':{
+			// started by the supervisor with its listening socket
+			inherited_listener = std::atoi(optarg);
+			break;
+		    }
+		    case 'c':{
+			// runtime settings file, see server_config.h
+			if(!load_server_config(optarg, tsd_config, config_error)){
+				std::cerr << config_error << std::endl;
+				return 1;
+			}
+			config_args.push_back("-c");
+			config_args.push_back(optarg);
+			break;
+		    }
+		    case 'o':{
+			// a single key=value setting, applied after the ones before it
+			if(!set_config_line(tsd_config, optarg, config_error)){
+				std::cerr << config_error << std::endl;
+				return 1;
+			}
+			config_args.push_back("-o");
+			config_args.push_back(optarg);
+			break;
+		    }
+		    case 'P':{
+			// a read replica of the primary at <ip>:<port>, see replication.h
+			replication.primary = optarg;
+			config_args.push_back("-P");
+			config_args.push_back(optarg);
+			break;
+		    }
+		    case 'S':{
+			// started by new_slave() as the slave of the master on this port
+			slave_mode = 1;
+			break;
+		    }
 		    case 'p':{
 			std::string temp_p(optarg);
 			port = temp_p;
@@ -613,77 +1434,66 @@ int main(int argc, char** argv) {
 		std::cin >> port;
 	}
 	if(!router_exists){
-		std::cout << "Please enter the router ip address and port number in the form <ip>:<port> (ie. ###.###.###.###:####)" << std::endl;
+		std::cout << "Please enter the router ip address and port number in the form <ip>:<port> (ie. ###.###.###.###:####), several routers separated by commas" << std::endl;
 		std::cin >> router;
 	}
 	
-	// create a new child/slave process
-	if(fork() == 0){
-		// use grpc to read and write messages to the master process
-		
-		// if the messages stop coming from master, restart program with exec
-		// the exec process will have the same pid as this slave
-		// while(Read) -> send message back
-		std::string connection_name= ipAddr + ":" + port;
-		
-		std::unique_ptr<user_services::Stub> slave_stub(user_services::NewStub(grpc::CreateChannel(connection_name, grpc::InsecureChannelCredentials())));
-		
-		ClientContext context;
-		// set up a Ping connection with the master process
-		std::shared_ptr<ClientReaderWriter<available_status, available_status>> stream(
-            slave_stub->Ping(&context));
-		signal(SIGINT, SIG_IGN);
-		available_status on;
-		on.set_available(1);
-		
-		while(1){
-			// write to the master process every 2 seconds
-			stream->Write(on);
-			sleep(2);
-			available_status received;
-			received.set_available(0);
-			stream->Read(&received);
-			// if no message was read from the master, start a new server
-			// exec will create a new server process in place of the slave process
-			if(received.available() != 1){
-				sleep(2);
-				execlp("./tsd","./tsd", "-i", ipAddr.c_str(), "-p", port.c_str(), "-r", router.c_str(), (char*) NULL);
-			}
+	if(slave_mode){
+		run_slave(true);
+		return 0;
+	}
+	
+	if(supervisor_mode){
+		std::string bind_error;
+		int listen_fd = bind_listener(ipAddr, port, bind_error);
+		if(listen_fd < 0){
+			std::cout << bind_error << std::endl;
+			return 1;
 		}
+		std::vector<std::string> args = tsd_arguments(false);
+		args.push_back("-L");
+		args.push_back(std::to_string(listen_fd));
+		return supervise(args);
+	}
+	
+	// create a new child/slave process, a supervised tsd has none
+	// nothing but this thread runs yet, so the child can go on as the slave without exec
+	if(inherited_listener < 0 && fork() == 0){
+		run_slave(false);
 	}
 	else{ // master process
 		
 		signal(SIGINT, handle_server_close);
+		signal(SIGTERM, handle_server_close);
+		// drains the server once a signal asked for it
+		std::thread drain_watch([]() {
+			while(!drain_requested){
+				usleep(100000);
+			}
+			drain_server();
+		});
+		drain_watch.detach();
+		// slaves that die are replaced from this thread, see watch_slave
+		if(inherited_listener < 0){
+			std::thread slave_watch(watch_slave);
+			slave_watch.detach();
+		}
+		// the other masters know this one by the address it gives the routers
+		peer_fanout.self = ipAddr + ":" + port;
 		// thread that will run the main server processes
 		std::thread master_server([]() {
 			TNSServiceImpl server;
 			server.run_server(ipAddr, port);
 		});
-		// thread that will provide contact to the router, letting it know it is online
-		std::thread router_contact([]() {
-			// act as a client and send requests to router server
-			// use grpc to read and write messages to the master process
-		
-			// if the messages stop coming from master, restart program with exec
-			// the exec process will have the same pid as this slave
-			// while(Read) -> send message back
-			std::unique_ptr<user_services::Stub> slave_stub(user_services::NewStub(grpc::CreateChannel(router, grpc::InsecureChannelCredentials())));
-		
-			ClientContext context;
-			std::shared_ptr<ClientReaderWriter<available_server, available_server>> stream(
-		    slave_stub->UpdateRouter(&context));
-		
-			available_server on;
-			on.set_ip_addr(ipAddr);
-			on.set_port(port);
-			on.set_online(1);
-			
-			while(1){
-				stream->Write(on);
-				sleep(2);
-			}
-		});
+		// threads that will provide contact to the routers, letting them know it is online
+		std::vector<std::string> routers = split_routers(router);
+		std::vector<std::thread> router_contacts;
+		for(int i = 0; i < routers.size(); i++){
+			router_contacts.push_back(std::thread(contact_router, routers.at(i)));
+		}
 		master_server.join();
-		router_contact.join();
+		for(int i = 0; i < router_contacts.size(); i++){
+			router_contacts.at(i).join();
+		}
 	}	
 }
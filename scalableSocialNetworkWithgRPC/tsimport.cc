@@ -0,0 +1,293 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+// bulk importer for the tweet dump described in hadoopMapReduce/README.txt
+// every tweet is three lines, T<tab>YYYY-MM-DD HH:MM:SS, U<tab>http://twitter.com/<username> and
+// W<tab><content>, the dump is mapped and split into one chunk per thread at tweet boundaries,
+// each thread scans its chunk line by line with memchr (vectorized in glibc) and writes the
+// POST lines of tsd's log to a part file, then the INITIALIZE line of every user is written to
+// the log followed by the part files in order
+// tsd replays the log on start, so the imported users and posts are loaded without any rpc, and
+// begins its new log with a snapshot of what it loaded (write_store_snapshot in user_store.h), so
+// they stay after later restarts; the post segment files are rebuilt from the log every start
+
+// every tweet's U line starts with this, the rest is the username
+const std::string USER_URL = "http://twitter.com/";
+
+// what one thread found in its chunk
+struct import_chunk {
+	const char* begin;
+	const char* end;
+	std::string part_file;
+	// users in the order their first post appears in the chunk
+	std::vector<std::string> users;
+	uint64_t posts = 0;
+	uint64_t skipped = 0;
+	bool failed = false;
+};
+
+// helper function that returns the first tweet at or after position, end if there is none
+// a tweet starts at a line that begins with T and a tab
+const char* next_tweet(const char* position, const char* begin, const char* end){
+	while(position < end){
+		if((position == begin || position[-1] == '\n') && end - position > 1 && position[0] == 'T' && position[1] == '\t'){
+			return position;
+		}
+		const char* newline = (const char*)std::memchr(position, '\n', end - position);
+		if(newline == nullptr){
+			return end;
+		}
+		position = newline + 1;
+	}
+	return end;
+}
+
+// helper function that converts the dump's time (YYYY-MM-DD HH:MM:SS) to the ctime() form tsc
+// sends and tsd logs (Mon Oct 19 10:00:00 2026), returns false if the time can't be read
+bool convert_time(const char* text, size_t length, char out[24]){
+	if(length < 19 || text[4] != '-' || text[7] != '-' || text[10] != ' ' || text[13] != ':' || text[16] != ':'){
+		return false;
+	}
+	const int starts[6] = {0, 5, 8, 11, 14, 17};
+	const int lengths[6] = {4, 2, 2, 2, 2, 2};
+	int fields[6] = {0, 0, 0, 0, 0, 0};
+	for(int f = 0; f < 6; f++){
+		for(int i = starts[f]; i < starts[f] + lengths[f]; i++){
+			if(text[i] < '0' || text[i] > '9'){
+				return false;
+			}
+			fields[f] = fields[f] * 10 + (text[i] - '0');
+		}
+	}
+	int month = fields[1] - 1;
+	if(month < 0 || month > 11 || fields[2] < 1 || fields[2] > 31){
+		return false;
+	}
+	// days since 1970-01-01 of the civil date (Howard Hinnant's days_from_civil), for the weekday
+	int64_t year = fields[0] - (month < 2 ? 1 : 0);
+	int64_t era = (year >= 0 ? year : year - 399) / 400;
+	int64_t year_of_era = year - era * 400;
+	int64_t day_of_year = (153 * (month + (month > 1 ? -2 : 10)) + 2) / 5 + fields[2] - 1;
+	int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+	int64_t days = era * 146097 + day_of_era - 719468;
+	// 1970-01-01 was a thursday
+	int weekday = ((days + 4) % 7 + 7) % 7;
+	static const char* weekdays = "SunMonTueWedThuFriSat";
+	static const char* months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	std::memcpy(out, weekdays + 3 * weekday, 3);
+	out[3] = ' ';
+	std::memcpy(out + 4, months + 3 * month, 3);
+	out[7] = ' ';
+	out[8] = fields[2] < 10 ? ' ' : '0' + fields[2] / 10;
+	out[9] = '0' + fields[2] % 10;
+	out[10] = ' ';
+	std::memcpy(out + 11, text + 11, 8);
+	out[19] = ' ';
+	std::memcpy(out + 20, text, 4);
+	return true;
+}
+
+// function that turns the tweets of a chunk into POST lines in the chunk's part file
+void import_chunk_posts(import_chunk& chunk){
+	std::ofstream part(chunk.part_file.c_str(), std::ios::binary | std::ios::trunc);
+	if(!part.is_open()){
+		chunk.failed = true;
+		return;
+	}
+	std::unordered_set<std::string> seen;
+	std::string line_out;
+	char time[24];
+	bool have_time = false;
+	std::string username;
+	const char* position = chunk.begin;
+	while(position < chunk.end){
+		const char* newline = (const char*)std::memchr(position, '\n', chunk.end - position);
+		const char* line_end = newline == nullptr ? chunk.end : newline;
+		size_t length = line_end - position;
+		// dumps written on windows end lines with \r\n
+		if(length > 0 && position[length - 1] == '\r'){
+			length--;
+		}
+		if(length >= 2 && position[1] == '\t'){
+			const char* field = position + 2;
+			size_t field_length = length - 2;
+			if(position[0] == 'T'){
+				have_time = convert_time(field, field_length, time);
+				username.clear();
+			}
+			else if(position[0] == 'U'){
+				username.clear();
+				if(field_length > USER_URL.size() && std::memcmp(field, USER_URL.data(), USER_URL.size()) == 0){
+					username.assign(field + USER_URL.size(), field_length - USER_URL.size());
+					// tsd's log separates the username from the rest of a line with | and
+					// usernames can't contain spaces
+					if(username.find_first_of("| \t") != std::string::npos){
+						username.clear();
+					}
+				}
+			}
+			else if(position[0] == 'W'){
+				if(have_time && !username.empty()){
+					line_out.assign("POST ");
+					line_out.append(username);
+					line_out.push_back('|');
+					line_out.append(time, 24);
+					line_out.push_back('|');
+					line_out.append(field, field_length);
+					line_out.push_back('\n');
+					part.write(line_out.data(), line_out.size());
+					if(seen.insert(username).second){
+						chunk.users.push_back(username);
+					}
+					chunk.posts++;
+				}
+				else{
+					chunk.skipped++;
+				}
+				have_time = false;
+				username.clear();
+			}
+		}
+		position = line_end + 1;
+	}
+	part.close();
+	chunk.failed = part.fail();
+}
+
+// helper function that appends a whole file to the output
+bool append_file(int output, const std::string& filename){
+	int input = open(filename.c_str(), O_RDONLY);
+	if(input < 0){
+		return false;
+	}
+	struct stat status;
+	bool ok = fstat(input, &status) == 0;
+	off_t offset = 0;
+	while(ok && offset < status.st_size){
+		ssize_t n = sendfile(output, input, &offset, status.st_size - offset);
+		ok = n > 0;
+	}
+	close(input);
+	return ok;
+}
+
+int main(int argc, char** argv){
+	std::string input_file = "";
+	std::string output_file = "new_server_log.txt";
+	int threads = std::thread::hardware_concurrency();
+	int opt = 0;
+	while((opt = getopt(argc, argv, "i:o:j:")) != -1){
+		switch(opt){
+			case 'i': input_file = optarg; break;
+			case 'o': output_file = optarg; break;
+			case 'j': threads = std::atoi(optarg); break;
+			default:
+				std::cerr << "Invalid Command Line Argument\n";
+		}
+	}
+	if(input_file == ""){
+		std::cerr << "usage: tsimport -i <tweet dump> [-o <server log, new_server_log.txt>] [-j <threads>]\n";
+		return 1;
+	}
+	if(threads <= 0){
+		threads = 1;
+	}
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+	int input = open(input_file.c_str(), O_RDONLY);
+	struct stat status;
+	if(input < 0 || fstat(input, &status) != 0){
+		std::cerr << "could not open " << input_file << std::endl;
+		return 1;
+	}
+	size_t size = status.st_size;
+	const char* data = nullptr;
+	if(size > 0){
+		void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, input, 0);
+		if(map == MAP_FAILED){
+			std::cerr << "could not map " << input_file << std::endl;
+			return 1;
+		}
+		madvise(map, size, MADV_SEQUENTIAL);
+		data = (const char*)map;
+	}
+
+	// split the dump into chunks that start at a tweet
+	std::vector<import_chunk> chunks(threads);
+	const char* begin = data;
+	for(int i = 0; i < threads; i++){
+		chunks.at(i).begin = begin;
+		const char* end = i + 1 == threads ? data + size : next_tweet(data + size / threads * (i + 1), data, data + size);
+		if(end < begin){
+			end = begin;
+		}
+		chunks.at(i).end = end;
+		chunks.at(i).part_file = output_file + ".part" + std::to_string(i);
+		begin = end;
+	}
+	std::vector<std::thread> workers;
+	for(int i = 0; i < threads; i++){
+		workers.push_back(std::thread(import_chunk_posts, std::ref(chunks.at(i))));
+	}
+	for(int i = 0; i < threads; i++){
+		workers.at(i).join();
+	}
+
+	// every user is initialized once, before any of the posts
+	int output = open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	bool ok = output >= 0;
+	std::unordered_set<std::string> users;
+	std::string initialize;
+	uint64_t posts = 0;
+	uint64_t skipped = 0;
+	for(int i = 0; i < threads && ok; i++){
+		ok = !chunks.at(i).failed;
+		for(int u = 0; u < chunks.at(i).users.size(); u++){
+			if(users.insert(chunks.at(i).users.at(u)).second){
+				initialize += "INITIALIZE " + chunks.at(i).users.at(u) + "\n";
+			}
+		}
+		posts += chunks.at(i).posts;
+		skipped += chunks.at(i).skipped;
+	}
+	size_t written = 0;
+	while(ok && written < initialize.size()){
+		ssize_t n = write(output, initialize.data() + written, initialize.size() - written);
+		ok = n > 0;
+		written += n > 0 ? n : 0;
+	}
+	for(int i = 0; i < threads && ok; i++){
+		ok = append_file(output, chunks.at(i).part_file);
+	}
+	for(int i = 0; i < threads; i++){
+		unlink(chunks.at(i).part_file.c_str());
+	}
+	if(output >= 0){
+		ok = close(output) == 0 && ok;
+	}
+	if(!ok){
+		std::cerr << "could not write " << output_file << std::endl;
+		return 1;
+	}
+
+	double seconds = std::chrono::duration_cast<std::chrono::duration<double>>(
+			std::chrono::steady_clock::now() - started).count();
+	std::printf("imported %llu posts from %zu users (%llu incomplete tweets skipped) into %s\n",
+			(unsigned long long)posts, users.size(), (unsigned long long)skipped, output_file.c_str());
+	std::printf("%.1f MB in %.2f s, %.1f MB/s with %d threads\n", size / 1e6, seconds,
+			seconds > 0 ? size / 1e6 / seconds : 0.0, threads);
+	return 0;
+}
@@ -0,0 +1,206 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <grpc++/grpc++.h>
+
+#include "TNSService.grpc.pb.h"
+
+using grpc::ClientContext;
+using grpc::Status;
+using TNSService::user_services;
+using TNSService::stats_request;
+using TNSService::stats_reply;
+using TNSService::trace_request;
+using TNSService::trace_reply;
+using TNSService::trending_request;
+using TNSService::trending_reply;
+using TNSService::current_user;
+using TNSService::post_counts_reply;
+
+// small client that fetches GetStats from a server or the router and prints the
+// prometheus text exposition, with -o the text is written to a file instead so a local
+// scraper (for example node_exporter's textfile collector) can pick it up
+// with -T it controls the post tracer of a server instead: on, off, or dump (turns tracing off
+// and writes the chrome trace json to the -o file)
+// with -g (hashtags) or -G (words) it prints what is trending in a window of a server, with -w
+// the server keeps sending the window every -w seconds
+// with -c it prints a server's posts per hour of the day and day of the week, for one user with -u
+// with -D it deletes a user from a server (the primary, a replica only takes reads)
+
+// helper function that sends a SetTracing request to the server
+int set_tracing(user_services::Stub* stub, const std::string& command, const std::string& output_file){
+	trace_request request;
+	trace_reply reply;
+	ClientContext context;
+	request.set_enabled(command == "on");
+	request.set_dump(command == "dump");
+	if(command != "on" && command != "off" && command != "dump"){
+		std::cerr << "-T must be on, off or dump\n";
+		return 1;
+	}
+	Status status = stub->SetTracing(&context, request, &reply);
+	if(!status.ok()){
+		std::cerr << "SetTracing failed: " << status.error_message() << std::endl;
+		return 1;
+	}
+	if(command == "dump"){
+		std::string filename = output_file == "" ? "tsd_trace.json" : output_file;
+		std::ofstream out(filename.c_str());
+		out << reply.chrome_trace();
+		std::cout << "wrote " << reply.events() << " events to " << filename << std::endl;
+	}
+	else{
+		std::cout << "tracing " << (reply.enabled() ? "on" : "off") << std::endl;
+	}
+	return 0;
+}
+
+// helper function that prints the trending terms of a window as the server sends them
+int show_trending(user_services::Stub* stub, const std::string& window, bool hashtags, int interval){
+	trending_request request;
+	trending_reply reply;
+	ClientContext context;
+	request.set_window(window);
+	request.set_hashtags(hashtags);
+	request.set_count(20);
+	request.set_interval_seconds(interval);
+	std::unique_ptr<grpc::ClientReader<trending_reply>> reader(stub->GetTrending(&context, request));
+	while(reader->Read(&reply)){
+		std::cout << "trending " << (hashtags ? "hashtags" : "words") << " in the last " << reply.window()
+			<< " (" << reply.total() << " counted)" << std::endl;
+		for(int i = 0; i < reply.terms_size(); i++){
+			std::printf("%3d %-32s %10llu\n", i + 1, reply.terms(i).term().c_str(),
+					(unsigned long long)reply.terms(i).count());
+		}
+		std::cout << std::flush;
+	}
+	Status status = reader->Finish();
+	if(!status.ok()){
+		std::cerr << "GetTrending failed: " << status.error_message() << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// helper function that prints the post counters of a user or of the whole server
+int show_post_counts(user_services::Stub* stub, const std::string& username){
+	current_user request;
+	post_counts_reply reply;
+	ClientContext context;
+	request.set_username(username);
+	Status status = stub->GetPostCounts(&context, request, &reply);
+	if(!status.ok()){
+		std::cerr << "GetPostCounts failed: " << status.error_message() << std::endl;
+		return 1;
+	}
+	static const char* days[7] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+	std::cout << "posts by " << (username == "" ? "every user" : username) << ": " << reply.total() << std::endl;
+	for(int hour = 0; hour < reply.hours_size(); hour++){
+		std::printf("%02d:00 %10llu\n", hour, (unsigned long long)reply.hours(hour));
+	}
+	for(int day = 0; day < reply.weekdays_size() && day < 7; day++){
+		std::printf("%s   %10llu\n", days[day], (unsigned long long)reply.weekdays(day));
+	}
+	return 0;
+}
+
+// helper function that sends a DeleteUser request to the server
+int delete_user(user_services::Stub* stub, const std::string& username){
+	current_user request;
+	TNSService::server_status reply;
+	ClientContext context;
+	request.set_username(username);
+	Status status = stub->DeleteUser(&context, request, &reply);
+	if(!status.ok()){
+		std::cerr << "DeleteUser failed: " << status.error_message() << std::endl;
+		return 1;
+	}
+	if(reply.s_status() == TNSService::server_status_IStatus_FAILURE_NOT_EXISTS){
+		std::cerr << "no user " << username << std::endl;
+		return 1;
+	}
+	std::cout << "deleted " << username << std::endl;
+	return 0;
+}
+
+int main(int argc, char** argv){
+	std::string target = "";
+	std::string output_file = "";
+	std::string trace_command = "";
+	std::string trending_window = "";
+	bool trending_hashtags = true;
+	bool post_counts = false;
+	std::string username = "";
+	std::string delete_username = "";
+	int interval = 0;
+	int opt = 0;
+	while((opt = getopt(argc, argv, "s:o:w:T:g:G:cu:D:")) != -1){
+		switch(opt){
+			case 's': target = optarg; break;
+			case 'o': output_file = optarg; break;
+			case 'w': interval = std::atoi(optarg); break;
+			case 'T': trace_command = optarg; break;
+			case 'g': trending_window = optarg; trending_hashtags = true; break;
+			case 'G': trending_window = optarg; trending_hashtags = false; break;
+			case 'c': post_counts = true; break;
+			case 'u': username = optarg; break;
+			case 'D': delete_username = optarg; break;
+			default:
+				std::cerr << "Invalid Command Line Argument\n";
+		}
+	}
+	if(target == ""){
+		std::cerr << "usage: tsstat -s <ip>:<port> [-w <seconds between scrapes>] [-o <file>]\n"
+			<< "       tsstat -s <ip>:<port> -T on|off|dump [-o <trace file>]\n"
+			<< "       tsstat -s <ip>:<port> -g|-G 5m|1h|24h [-w <seconds between updates>]\n"
+			<< "       tsstat -s <ip>:<port> -c [-u <username>]\n"
+			<< "       tsstat -s <ip>:<port> -D <username>\n";
+		return 1;
+	}
+
+	std::unique_ptr<user_services::Stub> stub(user_services::NewStub(
+			grpc::CreateChannel(target, grpc::InsecureChannelCredentials())));
+	if(trace_command != ""){
+		return set_tracing(stub.get(), trace_command, output_file);
+	}
+	if(delete_username != ""){
+		return delete_user(stub.get(), delete_username);
+	}
+	if(post_counts){
+		return show_post_counts(stub.get(), username);
+	}
+	if(trending_window != ""){
+		return show_trending(stub.get(), trending_window, trending_hashtags, interval);
+	}
+	while(1){
+		stats_request request;
+		stats_reply reply;
+		ClientContext context;
+		Status status = stub->GetStats(&context, request, &reply);
+		if(!status.ok()){
+			std::cerr << "GetStats failed: " << status.error_message() << std::endl;
+			if(interval == 0){
+				return 1;
+			}
+		}
+		else if(output_file == ""){
+			std::cout << reply.exposition() << std::flush;
+		}
+		else{
+			// write to a temporary file and rename it so a scraper never sees half a file
+			std::string temp_file = output_file + ".tmp";
+			std::ofstream out(temp_file.c_str());
+			out << reply.exposition();
+			out.close();
+			std::rename(temp_file.c_str(), output_file.c_str());
+		}
+		if(interval == 0){
+			return 0;
+		}
+		sleep(interval);
+	}
+}
@@ -0,0 +1,980 @@
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <queue>
+#include <deque>
+#include <utility>
+#include <algorithm>
+#include <ctime>
+#include <mutex>
+#include <cstdlib>
+#include <cstring>
+
+#include <google/protobuf/arena.h>
+
+#include "TNSService.pb.h"
+#include "trace.h"
+#include "post_segments.h"
+#include "search_index.h"
+#include "follow_graph.h"
+#include "post_compression.h"
+#include "slab_pool.h"
+#include "post_record.h"
+#include "store_digest.h"
+
+using TNSService::following_user_message;
+using TNSService::post_info;
+
+// the in memory store behind tsd
+// the rpc handlers in tsd.cc and the microbenchmarks in bench.cc both work on these functions,
+// callers are responsible for holding users_db_mutex
+
+// the newest posts of every user are kept in memory, older posts are moved to the post
+// segments on disk (post_segments.h), backfilling a timeline never needs more than 20
+const int POST_WINDOW = 32;
+
+// every POST_INDEX_STRIDE-th post moved to the segments is remembered in the user's post index
+// so paging through old posts (timeline_page.h) reads at most that many records to find a post
+const int POST_INDEX_STRIDE = 16;
+
+// entry of the post index, seq numbers a user's posts from 0 in the order they were posted
+struct post_mark {
+	int64_t time;
+	uint64_t seq;
+	uint64_t location;
+};
+
+// posts counted by the hour of the day and the day of the week (0 is sunday) of their time,
+// in the time zone of the posting client, kept for every user and for the whole server
+// replaces the offline hour of day job in hadoopMapReduce, the arrays are updated in place so
+// counting a post is a couple of increments
+struct post_counters {
+	uint32_t hours[24] = {};
+	uint32_t weekdays[7] = {};
+	uint64_t total = 0;
+};
+
+// user struct that contains essential information for each user
+struct user {
+
+	std::string username = "";
+	std::vector<std::string> followers;
+	std::vector<std::string> following;
+	std::queue<post_handle> timeline;
+	// the newest POST_WINDOW posts, oldest first, and the time of each of them
+	std::deque<post_handle> posts;
+	std::deque<int64_t> post_times;
+	// location of the newest post moved to the segments and how many posts were moved
+	uint64_t spilled_head = NO_POST_LOCATION;
+	uint64_t spilled_posts = 0;
+	// every POST_INDEX_STRIDE-th moved post, oldest first
+	std::vector<post_mark> post_index;
+	post_counters counters;
+	// the master (<ip>:<port>) of a user that registered on another master and is known here
+	// because users of this server follow them, empty for users that registered here
+	std::string home = "";
+	// followers on other masters, by their master (peer_fanout.h)
+	std::map<std::string, std::vector<std::string>> remote_followers;
+	// for the anti entropy between masters (store_digest.h): when the user registered again after a
+	// delete, the time of every follow (true) and unfollow (false) made while a server ran that has
+	// one, the sum of their post ids, the sum of the ids and the number of their posts by the range
+	// of the post's time, and the digest of their follows and their leaf digest (the one their own
+	// master has for a user of another master)
+	uint64_t registered_ns = 0;
+	std::unordered_map<std::string, std::pair<uint64_t, bool>> follow_versions;
+	uint64_t post_digest = 0;
+	std::map<int64_t, std::pair<uint64_t, uint32_t>> post_ranges;
+	uint64_t follow_digest = 0;
+	uint64_t leaf_digest = 0;
+};
+
+// users are allocated from a slab pool (slab_pool.h), create_user and remove_user are the only
+// places they come and go
+slab_pool user_pool("user", sizeof(user));
+
+// Hash map that will be used to store all user objects
+std::unordered_map<std::string, user*> users_db;
+
+// users by the bucket of their leaf digest, for the leaves another master asks for (anti_entropy.h)
+std::vector<user*> digest_bucket_users[SYNC_BUCKETS];
+
+// vector to contain the usernames of all users that have ever connected to the server
+std::vector<std::string> all_users;
+
+// counters of every post the server stored
+post_counters all_post_counters;
+
+// the server handles every rpc on its own thread, this mutex guards users_db,
+// all_users and the log file so concurrent clients don't corrupt them
+std::mutex users_db_mutex;
+
+// response messages built by the list and timeline handlers are allocated from an arena,
+// every handler thread gives its arena this block as the first block so building a
+// response normally doesn't touch the heap at all
+const int ARENA_BLOCK_SIZE = 8 * 1024;
+alignas(8) thread_local char arena_block[ARENA_BLOCK_SIZE];
+
+// function that returns the options for an arena that starts in the calling thread's block
+// only one arena per thread may use the block at a time
+google::protobuf::ArenaOptions response_arena_options(){
+	google::protobuf::ArenaOptions options;
+	options.initial_block = arena_block;
+	options.initial_block_size = ARENA_BLOCK_SIZE;
+	return options;
+}
+
+// function that will find the index of a username within a vector
+int find_follower(std::vector<std::string> v, std::string u){
+	for(int i = 0; i < v.size(); i++){
+		if(v.at(i) == u){
+			return i;
+		}
+	}
+	return -1;
+}
+
+// function that sets a user's leaf digest and moves their bucket by the difference
+void set_leaf_digest(user* u, uint64_t leaf){
+	store_digest.buckets[digest_bucket(u->username)] += leaf - u->leaf_digest;
+	u->leaf_digest = leaf;
+}
+
+// function that adds up a user's leaf digest again, a user of another master keeps the leaf the
+// anti entropy set for them (store_digest.h)
+void update_leaf_digest(user* u){
+	if(u->home == ""){
+		set_leaf_digest(u, u->follow_digest + digest_mix(u->post_digest ^ POSTS_SALT));
+	}
+}
+
+// function that adds up the digest of the users a user follows again, after any follow or unfollow
+void update_follow_digest(user* u){
+	uint64_t digest = digest_mix(digest_hash(u->username) + u->registered_ns);
+	for(int i = 0; i < u->following.size(); i++){
+		const std::string& followee = u->following.at(i);
+		auto version = u->follow_versions.find(followee);
+		uint64_t time = version == u->follow_versions.end() ? 0 : version->second.first;
+		digest += digest_mix((digest_hash(followee) ^ FOLLOW_SALT) + time);
+	}
+	for(auto& version : u->follow_versions){
+		if(!version.second.second){
+			digest += digest_mix((digest_hash(version.first) ^ UNFOLLOW_SALT) + version.second.first);
+		}
+	}
+	u->follow_digest = digest;
+	update_leaf_digest(u);
+}
+
+// function that adds a new user to the store, following themselves like every user does
+// returns nullptr if the username is taken
+user* create_user(const std::string& username){
+	if(users_db.find(username) != users_db.end()){
+		return nullptr;
+	}
+	user* new_user = slab_new<user>(user_pool);
+	new_user->username = username;
+	users_db.insert(std::pair<std::string, user*>(username, new_user));
+	all_users.push_back(username);
+	new_user->followers.push_back(username);
+	new_user->following.push_back(username);
+	digest_bucket_users[digest_bucket(username)].push_back(new_user);
+	update_follow_digest(new_user);
+	return new_user;
+}
+
+// helper function that takes username out of a list of usernames
+void remove_name(std::vector<std::string>& names, const std::string& username){
+	auto position = std::find(names.begin(), names.end(), username);
+	if(position != names.end()){
+		names.erase(position);
+	}
+}
+
+// function that adds a user that registered on the master home, their posts arrive from there
+// returns nullptr if the username is taken
+user* create_remote_user(const std::string& username, const std::string& home){
+	user* new_user = create_user(username);
+	if(new_user != nullptr){
+		new_user->home = home;
+		set_leaf_digest(new_user, 0);
+	}
+	return new_user;
+}
+
+// function that makes a user of another master a user of this server, when they registered here
+// too; their leaf is the one this server adds up from then on
+void claim_remote_user(user* u){
+	u->home = "";
+	update_follow_digest(u);
+}
+
+// functions that add and remove a follower on the master server of a user registered here
+// return false when there was nothing to change
+bool add_remote_follower(const std::string& username, const std::string& follower, const std::string& server){
+	std::vector<std::string>& followers = users_db.at(username)->remote_followers[server];
+	if(std::find(followers.begin(), followers.end(), follower) != followers.end()){
+		return false;
+	}
+	followers.push_back(follower);
+	return true;
+}
+
+bool remove_remote_follower(const std::string& username, const std::string& follower, const std::string& server){
+	std::map<std::string, std::vector<std::string>>& remote_followers = users_db.at(username)->remote_followers;
+	auto found = remote_followers.find(server);
+	if(found == remote_followers.end() || find_follower(found->second, follower) == -1){
+		return false;
+	}
+	remove_name(found->second, follower);
+	if(found->second.empty()){
+		remote_followers.erase(found);
+	}
+	return true;
+}
+
+// function that deletes a user: they leave the followers and following lists of everyone they
+// were connected to and the follow graph, their posts leave their followers' timelines and
+// are no longer found by searches, and the user's record and posts go back to their pools
+// posts already moved to the segments stay there unreferenced
+// returns the users that followed them, false if there is no such user
+bool remove_user(const std::string& username, std::vector<std::string>& former_followers){
+	auto found = users_db.find(username);
+	if(found == users_db.end()){
+		return false;
+	}
+	user* removed = found->second;
+	for(int i = 0; i < removed->followers.size(); i++){
+		const std::string& follower = removed->followers.at(i);
+		if(follower == username){
+			continue;
+		}
+		user* other = users_db.at(follower);
+		remove_name(other->following, username);
+		graph_unfollow(follower, username);
+		std::queue<post_handle> kept;
+		while(!other->timeline.empty()){
+			if(!field_equals(*other->timeline.front(), 0, username)){
+				kept.push(std::move(other->timeline.front()));
+			}
+			other->timeline.pop();
+		}
+		std::swap(other->timeline, kept);
+		update_follow_digest(other);
+		former_followers.push_back(follower);
+	}
+	for(int i = 0; i < removed->following.size(); i++){
+		const std::string& followee = removed->following.at(i);
+		if(followee == username){
+			continue;
+		}
+		remove_name(users_db.at(followee)->followers, username);
+		graph_unfollow(username, followee);
+	}
+	remove_name(all_users, username);
+	forget_indexed_user(username);
+	store_digest.buckets[digest_bucket(username)] -= removed->leaf_digest;
+	std::vector<user*>& bucket_users = digest_bucket_users[digest_bucket(username)];
+	bucket_users.erase(std::find(bucket_users.begin(), bucket_users.end(), removed));
+	users_db.erase(found);
+	slab_delete(removed);
+	return true;
+}
+
+// a post is stored as {username, time, content} with the trace id as a fourth entry
+// when the post arrived through TimelineRequest, posts replayed from the log have none
+uint64_t trace_id_of(const std::vector<std::string>& post_info){
+	if(post_info.size() < 4){
+		return 0;
+	}
+	return std::strtoull(post_info.at(3).c_str(), nullptr, 10);
+}
+
+uint64_t trace_id_of(const post_record& post){
+	uint64_t trace_id = 0;
+	if(post.fields < 4){
+		return 0;
+	}
+	const char* digits = post.field(3);
+	for(uint32_t i = 0; i < post.lengths[3] && digits[i] >= '0' && digits[i] <= '9'; i++){
+		trace_id = trace_id * 10 + (digits[i] - '0');
+	}
+	return trace_id;
+}
+
+// function that returns the time of a post in seconds
+// posts carry the ctime() string tsc sends (Mon Oct 19 10:00:00 2026), the seconds are only
+// compared with each other so the time zone doesn't matter, a time that can't be read is 0
+// the fixed layout is read by hand, strptime is slow enough to dominate a backfill
+int64_t post_time_of(const char* time, size_t size){
+	if(size < 24 || time[3] != ' ' || time[7] != ' ' || time[13] != ':' || time[16] != ':'){
+		return 0;
+	}
+	static const char* months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	int month = 0;
+	while(month < 12 && std::memcmp(time + 4, months + 3 * month, 3) != 0){
+		month++;
+	}
+	int fields[5] = {0, 0, 0, 0, 0};
+	// day, hour, minute, second and year start at these positions, the day may be space padded
+	const int starts[5] = {8, 11, 14, 17, 20};
+	const int lengths[5] = {2, 2, 2, 2, 4};
+	for(int f = 0; f < 5; f++){
+		for(int i = starts[f]; i < starts[f] + lengths[f]; i++){
+			if(time[i] == ' ' && f == 0){
+				continue;
+			}
+			if(time[i] < '0' || time[i] > '9'){
+				return 0;
+			}
+			fields[f] = fields[f] * 10 + (time[i] - '0');
+		}
+	}
+	if(month == 12){
+		return 0;
+	}
+	// days since 1970-01-01 of the civil date (Howard Hinnant's days_from_civil)
+	int64_t year = fields[4] - (month < 2 ? 1 : 0);
+	int64_t era = (year >= 0 ? year : year - 399) / 400;
+	int64_t year_of_era = year - era * 400;
+	int64_t day_of_year = (153 * (month + (month > 1 ? -2 : 10)) + 2) / 5 + fields[0] - 1;
+	int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+	int64_t days = era * 146097 + day_of_era - 719468;
+	return days * 86400 + fields[1] * 3600 + fields[2] * 60 + fields[3];
+}
+
+int64_t post_time_of(const std::vector<std::string>& post_info){
+	return post_time_of(post_info.at(1).data(), post_info.at(1).size());
+}
+
+int64_t post_time_of(const post_record& post){
+	return post_time_of(post.field(1), post.lengths[1]);
+}
+
+// function that counts a post with the given time (see post_time_of) in counters
+void count_post(post_counters& counters, int64_t time){
+	int64_t days = time >= 0 ? time / 86400 : (time - 86399) / 86400;
+	int64_t second_of_day = time - days * 86400;
+	counters.hours[second_of_day / 3600]++;
+	// 1970-01-01 was a thursday
+	counters.weekdays[((days + 4) % 7 + 7) % 7]++;
+	counters.total++;
+}
+
+// function that adds a post to a user's posts as a post record (post_record.h), its body is
+// stored compressed when post compression is on (post_compression.h), the stored post is the
+// user's newest in posts
+// a user's posts stay in order of their time for paging (timeline_page.h), a post older than the
+// user's newest (a client whose clock went back, a post taken late from another master) is ordered
+// with the newest, its own time still counts it and puts it in its range (store_digest.h)
+// when the window is full the oldest post in memory is moved to the user's shard, a post that
+// can't be written stays in memory
+void store_post(const std::string& username, const std::vector<std::string>& post_info){
+	user* poster = users_db.at(username);
+	if(post_compression.enabled){
+		std::string body = compress_post_body(post_info.at(2));
+		poster->posts.push_back(make_post_record(post_info, &body));
+	}
+	else{
+		poster->posts.push_back(make_post_record(post_info));
+	}
+	int64_t post_time = post_time_of(post_info);
+	int64_t order_time = poster->post_times.empty() ? post_time : std::max(post_time, poster->post_times.back());
+	poster->post_times.push_back(order_time);
+	uint64_t id = post_digest_id(post_info.at(0), post_info.at(1), post_info.at(2));
+	poster->post_digest += id;
+	std::pair<uint64_t, uint32_t>& range = poster->post_ranges[digest_range(post_time)];
+	range.first += id;
+	range.second++;
+	update_leaf_digest(poster);
+	// a time that can't be read isn't counted
+	if(post_time != 0){
+		count_post(poster->counters, post_time);
+		count_post(all_post_counters, post_time);
+	}
+	// posts from TimelineRequest and from the log both come through here so the index sees all of them
+	index_post(username, poster->spilled_posts + poster->posts.size() - 1, post_info.at(2));
+	if(poster->posts.size() > POST_WINDOW){
+		int64_t time = poster->post_times.front();
+		const post_record& oldest = *poster->posts.front();
+		uint64_t location = append_post_record(shard_of(username), poster->spilled_head, time,
+				oldest.text(), oldest.lengths, oldest.fields);
+		if(location != NO_POST_LOCATION){
+			if(poster->spilled_posts % POST_INDEX_STRIDE == 0){
+				post_mark mark;
+				mark.time = time;
+				mark.seq = poster->spilled_posts;
+				mark.location = location;
+				poster->post_index.push_back(mark);
+			}
+			poster->spilled_head = location;
+			poster->spilled_posts++;
+			poster->posts.pop_front();
+			poster->post_times.pop_front();
+		}
+	}
+}
+
+// function that returns up to count of a user's newest posts, newest first
+// posts that are no longer in memory are read back from the segments into new records
+std::vector<post_handle> newest_posts(const std::string& username, int count){
+	std::vector<post_handle> newest;
+	user* poster = users_db.at(username);
+	for(int i = poster->posts.size() - 1; i >= 0 && newest.size() < count; i--){
+		newest.push_back(poster->posts.at(i));
+	}
+	uint64_t location = poster->spilled_head;
+	int shard = shard_of(username);
+	std::vector<std::string> post_info;
+	while(location != NO_POST_LOCATION && newest.size() < count){
+		if(!read_post_record(shard, location, post_info, location)){
+			break;
+		}
+		newest.push_back(make_post_record(post_info));
+	}
+	return newest;
+}
+
+// function that returns the posts of a user ordered at or after since (see store_post), newest
+// first, they hold every post whose own time is at or after since
+// only the records ordered at or after since are read back from the segments
+std::vector<post_handle> posts_since(const std::string& username, int64_t since){
+	std::vector<post_handle> newer;
+	user* poster = users_db.at(username);
+	int i = poster->posts.size() - 1;
+	for(; i >= 0 && poster->post_times.at(i) >= since; i--){
+		newer.push_back(poster->posts.at(i));
+	}
+	if(i >= 0){
+		return newer;
+	}
+	uint64_t location = poster->spilled_head;
+	int shard = shard_of(username);
+	int64_t time = 0;
+	uint64_t previous = NO_POST_LOCATION;
+	std::vector<std::string> post_info;
+	while(location != NO_POST_LOCATION && read_post_header(shard, location, time, previous) && time >= since){
+		if(!read_post_record(shard, location, post_info, previous)){
+			break;
+		}
+		newer.push_back(make_post_record(post_info));
+		location = previous;
+	}
+	return newer;
+}
+
+// function that returns true if a post with the id (see post_digest_id) is one of the user's posts
+// in memory
+bool has_recent_post(const user* poster, uint64_t id){
+	for(int i = 0; i < poster->posts.size(); i++){
+		const post_record& post = *poster->posts.at(i);
+		const std::string& body = post_body(post.field(2), post.lengths[2]);
+		if(post_digest_id(post.field(0), post.lengths[0], post.field(1), post.lengths[1], body.data(), body.size()) == id){
+			return true;
+		}
+	}
+	return false;
+}
+
+// function that reads the post of a user with number seq (see post_mark), returns false if there
+// is no such post
+// older posts are found through the post index, at most POST_INDEX_STRIDE headers are read
+bool post_at(const std::string& username, uint64_t seq, std::vector<std::string>& post_info){
+	auto found = users_db.find(username);
+	if(found == users_db.end()){
+		return false;
+	}
+	user* poster = found->second;
+	if(seq >= poster->spilled_posts){
+		if(seq - poster->spilled_posts >= poster->posts.size()){
+			return false;
+		}
+		post_info = post_info_of(*poster->posts.at(seq - poster->spilled_posts));
+		return true;
+	}
+	// start at the first indexed post at or after seq, or the newest moved post
+	uint64_t mark = (seq + POST_INDEX_STRIDE - 1) / POST_INDEX_STRIDE;
+	uint64_t at = poster->spilled_posts - 1;
+	uint64_t location = poster->spilled_head;
+	if(mark < poster->post_index.size()){
+		at = poster->post_index.at(mark).seq;
+		location = poster->post_index.at(mark).location;
+	}
+	int shard = shard_of(username);
+	int64_t time = 0;
+	while(at > seq){
+		if(!read_post_header(shard, location, time, location)){
+			return false;
+		}
+		at--;
+	}
+	uint64_t previous = NO_POST_LOCATION;
+	return read_post_record(shard, location, post_info, previous);
+}
+
+// function that returns up to page_size posts containing every word of query, newest first,
+// with a post id below before (0 for the newest), next_before is set to the id of the last one
+// returns true if there are older matches after the page
+bool search_posts(const std::string& query, uint64_t before, int page_size,
+		std::vector<std::vector<std::string>>& page, uint64_t& next_before){
+	std::vector<uint64_t> ids;
+	bool more = search_index_query(query, before, page_size, ids);
+	next_before = before;
+	std::vector<std::string> post_info;
+	for(int i = 0; i < ids.size(); i++){
+		const post_ref& ref = post_search.posts.at(ids.at(i) - 1);
+		if(post_at(post_search.user_names.at(ref.user), ref.seq, post_info)){
+			page.push_back(post_info);
+		}
+		next_before = ids.at(i);
+	}
+	return more;
+}
+
+// function that adds a post to the posting user's posts and to every follower's timeline
+// returns the number of timelines the post was added to
+int fan_out_post(const std::string& requesting_user, const std::vector<std::string>& post_info){
+	int delivered = 0;
+	std::vector<std::string> user_followers = users_db.at(requesting_user)->followers;
+
+	// add the post to the user's posts list, the timelines get the post as it was stored
+	store_post(requesting_user, post_info);
+	const post_handle& stored = users_db.at(requesting_user)->posts.back();
+	if(!user_followers.empty()){
+		// add the post to every followers timeline
+		for(int i = 0; i < user_followers.size(); i++){
+			// don't add the users post to their timeline, stored in user::posts
+			if(users_db.at(user_followers.at(i))->username != requesting_user){
+				// remove the oldest post from the timeline if the timeline is longer than 20
+				if(users_db.at(user_followers.at(i))->timeline.size() == 20){
+					users_db.at(user_followers.at(i))->timeline.pop();
+				}
+				//add post to the user's timeline
+				users_db.at(user_followers.at(i))->timeline.push(stored);
+				delivered++;
+			}
+		}
+	}
+	return delivered;
+}
+
+// function that merges posts (newest first, like newest_posts returns them) into a timeline
+// by time and keeps the 20 newest, the timeline stays oldest first
+// posts with the same time keep the order they had, timeline posts before the merged ones,
+// and a post that is already in the timeline isn't added again
+void merge_into_timeline(std::queue<post_handle>& timeline, std::vector<post_handle>& posts){
+	std::vector<std::pair<int64_t, post_handle>> merged;
+	merged.reserve(timeline.size() + posts.size());
+	while(!timeline.empty()){
+		int64_t time = post_time_of(*timeline.front());
+		merged.push_back(std::make_pair(time, std::move(timeline.front())));
+		timeline.pop();
+	}
+	for(int i = posts.size() - 1; i >= 0; i--){
+		int64_t time = post_time_of(*posts.at(i));
+		merged.push_back(std::make_pair(time, std::move(posts.at(i))));
+	}
+	std::stable_sort(merged.begin(), merged.end(),
+			[](const std::pair<int64_t, post_handle>& a, const std::pair<int64_t, post_handle>& b){
+				return a.first < b.first;
+			});
+
+	// duplicates have the same time so they are in the same run of equal times
+	int kept = 0;
+	int run_start = 0;
+	for(int i = 0; i < merged.size(); i++){
+		if(kept > 0 && merged.at(kept - 1).first != merged.at(i).first){
+			run_start = kept;
+		}
+		bool duplicate = false;
+		for(int j = run_start; j < kept && !duplicate; j++){
+			duplicate = same_post(merged.at(j).second, merged.at(i).second);
+		}
+		if(!duplicate){
+			if(kept != i){
+				merged.at(kept) = std::move(merged.at(i));
+			}
+			kept++;
+		}
+	}
+	for(int i = kept > 20 ? kept - 20 : 0; i < kept; i++){
+		timeline.push(std::move(merged.at(i).second));
+	}
+}
+
+// function that adds the followed user's posts to the requesting user's timeline after a follow
+// the max size of a timeline is 20 posts so only the followed user's 20 newest posts are read,
+// FollowRequest and the log replay both use this so they build the same timeline
+void backfill_timeline(const std::string& requesting_user, const std::string& user_to_follow){
+	std::vector<post_handle> newest = newest_posts(user_to_follow, 20);
+	if(!newest.empty()){
+		merge_into_timeline(users_db.at(requesting_user)->timeline, newest);
+	}
+}
+
+// function that sends a user's followers and all users as a stream of messages
+// keep sending usernames from followers and all users
+// if the end of either list is sent, send "END" as the value in the message
+// all users should always be longer or equal than the followers of the user
+// make check, if it fails send invalid status
+// Writer is the grpc ServerWriter in tsd, anything with a Write(message) function works
+template <typename Writer>
+void write_user_list(const std::vector<std::string>& user_followers, const std::vector<std::string>& all_users, Writer* writer){
+	// one message from the arena is reused for every row of the response, setting a field
+	// reuses the string that is already there so the rows cost no allocations
+	google::protobuf::Arena arena(response_arena_options());
+	following_user_message* return_info = google::protobuf::Arena::CreateMessage<following_user_message>(&arena);
+	if(!user_followers.empty()){
+
+		// all users should never be less than a user's followers list
+		if(all_users.size() < user_followers.size()){
+
+			return_info->set_username("");
+			return_info->set_user_in_all_users("");
+			return_info->set_s_status(TNSService::following_user_message_IStatus_FAILURE_INVALID);
+			writer->Write(*return_info);
+		}
+		else{
+			// for each user that has connected to the database
+			for(int i = 0; i < all_users.size(); i++){
+
+				// when the end of the followers list is reached send a END username to the user
+				// still will return users in all users
+				if(i > user_followers.size() - 1){
+					return_info->set_username("END");
+					return_info->set_user_in_all_users(all_users.at(i));
+					return_info->set_s_status(TNSService::following_user_message_IStatus_SUCCESS);
+					writer->Write(*return_info);
+				}
+
+				// if all users and followers are the same length then send END messages
+				// for each username at the same time
+				else if(i == user_followers.size() -1 && i == all_users.size() -1){
+					return_info->set_username(user_followers.at(i));
+					return_info->set_user_in_all_users(all_users.at(i));
+					return_info->set_s_status(TNSService::following_user_message_IStatus_SUCCESS);
+					writer->Write(*return_info);
+
+					return_info->set_username("END");
+					return_info->set_user_in_all_users("END");
+					return_info->set_s_status(TNSService::following_user_message_IStatus_SUCCESS);
+					writer->Write(*return_info);
+				}
+
+				// send the username of a user's follower and a user in all users
+				else{
+					return_info->set_username(user_followers.at(i));
+					return_info->set_user_in_all_users(all_users.at(i));
+					return_info->set_s_status(TNSService::following_user_message_IStatus_FAILURE_INVALID);
+					writer->Write(*return_info);
+				}
+			}
+		}
+		return;
+	}
+
+	// make sure each user in all users is sent to the user if the user doesn't have any followers
+	for(int i = 0; i < all_users.size(); i++){
+		return_info->set_username("END");
+		return_info->set_user_in_all_users(all_users.at(i));
+		return_info->set_s_status(TNSService::following_user_message_IStatus_SUCCESS);
+		writer->Write(*return_info);
+	}
+}
+
+// function that writes the posts taken from a user's timeline to their stream
+// followed by an END message that tells the client the server is done sending posts
+// Writer is the grpc ServerReaderWriter in tsd, anything with a Write(message) function works
+template <typename Writer>
+void write_timeline(std::queue<post_handle>& outstanding, const std::string& username, Writer* stream){
+	// one message from the arena is reused for every post of the batch and for END
+	google::protobuf::Arena arena(response_arena_options());
+	post_info* updated_post = google::protobuf::Arena::CreateMessage<post_info>(&arena);
+	// loop until the user no longer has any outstanding posts in their timeline
+	while(!outstanding.empty()){
+		// build a post from the record in the user's timeline
+		const post_record& timeline_info = *outstanding.front();
+
+		// user doesn't need to be returned their own messages
+		if(!field_equals(timeline_info, 0, username)){
+			// build the post object, assign reuses the message's strings where set would make a
+			// temporary string of the record's bytes
+			updated_post->mutable_username()->assign(timeline_info.field(0), timeline_info.lengths[0]);
+			updated_post->mutable_time()->assign(timeline_info.field(1), timeline_info.lengths[1]);
+			updated_post->set_content(post_body(timeline_info.field(2), timeline_info.lengths[2]));
+			updated_post->set_trace_id(trace_id_of(timeline_info));
+			// a failed write means the stream is gone (or was cancelled as too slow, see admission.h)
+			if(!stream->Write(*updated_post)){
+				return;
+			}
+			trace_point(TRACE_WRITTEN, updated_post->trace_id());
+		}
+		outstanding.pop();
+	}
+	// tell the user the server is done sending posts
+	updated_post->Clear();
+	updated_post->set_username("END");
+	stream->Write(*updated_post);
+}
+
+// helper function that splits the arguments of a log line at '|', begin is where they start
+// the time of a change is the last argument of the lines that have one, see delete_log_line
+std::vector<std::string> log_arguments(const std::string& line, std::size_t begin){
+	std::vector<std::string> arguments;
+	while(begin <= line.size()){
+		std::size_t end = line.find('|', begin);
+		if(end == std::string::npos){
+			end = line.size();
+		}
+		arguments.push_back(line.substr(begin, end - begin));
+		begin = end + 1;
+	}
+	return arguments;
+}
+
+// helper function that returns the number (a time or a digest) at position of the arguments of a
+// log line, 0 if there is none
+uint64_t log_number(const std::vector<std::string>& arguments, int position){
+	return position < arguments.size() ? std::strtoull(arguments.at(position).c_str(), nullptr, 10) : 0;
+}
+
+// function that applies one line of the server log to the store
+// used by restore_server() when the server starts
+// users created by INITIALIZE lines are added to initialized_users
+void apply_log_line(const std::string& history, std::vector<std::string>& initialized_users){
+	// parse the first word of the line for the command
+	if(history.substr(0,10) == "INITIALIZE"){
+		// "INITIALIZE username", with the time of the registration when it has one
+		std::vector<std::string> arguments = log_arguments(history, 11);
+		const std::string& username = arguments.at(0);
+		uint64_t registered = log_number(arguments, 1);
+
+		// create a new user, they follow themselves
+		user* created = create_user(username);
+		if(created != nullptr){
+			// add to initialized users
+			initialized_users.push_back(username);
+			// registered again after a delete, see store_digest.h
+			uint64_t deleted = user_tombstone(username);
+			if(deleted != 0 && registered == 0){
+				registered = deleted + 1;
+			}
+			clear_user_tombstone(username);
+		}
+		// a user known from another master registered here after all
+		else if(users_db.at(username)->home != ""){
+			claim_remote_user(users_db.at(username));
+			initialized_users.push_back(username);
+		}
+		user* registered_user = users_db.at(username);
+		if(registered > registered_user->registered_ns){
+			registered_user->registered_ns = registered;
+			update_follow_digest(registered_user);
+		}
+	}
+	else if(history.substr(0,11) == "REMOTE_USER"){
+		// a user of another master known here, "REMOTE_USER username|master", a snapshot adds the
+		// leaf digest the anti entropy last saw for them
+		std::vector<std::string> arguments = log_arguments(history, 12);
+		user* created = create_remote_user(arguments.at(0), arguments.at(1));
+		if(created != nullptr && arguments.size() > 2){
+			set_leaf_digest(created, log_number(arguments, 2));
+		}
+	}
+	else if(history.substr(0,13) == "REMOTE_FOLLOW" || history.substr(0,15) == "REMOTE_UNFOLLOW"){
+		// a follower on another master of a user registered here, "REMOTE_FOLLOW follower|username|master"
+		std::size_t begin = history.find_first_of(" ") + 1;
+		std::size_t first = history.find_first_of("|");
+		std::size_t second = history.find_first_of("|", first + 1);
+		std::string follower = history.substr(begin, first - begin);
+		std::string username = history.substr(first + 1, second - first - 1);
+		std::string server = history.substr(second + 1);
+		if(users_db.find(username) != users_db.end()){
+			if(history.substr(0,13) == "REMOTE_FOLLOW"){
+				add_remote_follower(username, follower, server);
+			}
+			else{
+				remove_remote_follower(username, follower, server);
+			}
+		}
+	}
+	else if(history.substr(0,6) == "DELETE"){
+		// "DELETE username|time", a log written before deletes had a time gives the delete time 1,
+		// older than any change with a time and newer than the users replayed with it
+		std::vector<std::string> arguments = log_arguments(history, 7);
+		const std::string& username = arguments.at(0);
+		uint64_t deleted = arguments.size() > 1 ? log_number(arguments, 1) : 1;
+		// a deleted user isn't initialized again in the next log
+		std::vector<std::string> former_followers;
+		bool removed = remove_user(username, former_followers);
+		if(removed){
+			remove_name(initialized_users, username);
+		}
+		// a snapshot (write_store_snapshot) keeps the tombstones of users deleted before it
+		if(removed || arguments.size() > 1){
+			set_user_tombstone(username, deleted);
+		}
+	}
+	else if(history.substr(0,6) == "FOLLOW"){
+		// get the user requesting the follow
+		// and the requested user, and the time of the follow when it has one
+		std::vector<std::string> arguments = log_arguments(history, 7);
+		const std::string& requesting_user = arguments.at(0);
+		const std::string& requested_user = arguments.at(1);
+		uint64_t followed = log_number(arguments, 2);
+		if(followed != 0){
+			users_db.at(requesting_user)->follow_versions[requested_user] = std::make_pair(followed, true);
+		}
+		// logs written before duplicate follows were refused may hold the same follow twice
+		if(find_follower(users_db.at(requesting_user)->following, requested_user) != -1){
+			update_follow_digest(users_db.at(requesting_user));
+			return;
+		}
+
+		// add the requested user to requesting's following
+		users_db.at(requesting_user)->following.push_back(requested_user);
+
+		// add the requesting user to the requested's followers
+		users_db.at(requested_user)->followers.push_back(requesting_user);
+		graph_follow(requesting_user, requested_user);
+		update_follow_digest(users_db.at(requesting_user));
+
+		// add requested user's posts to the requesting's timeline the same way FollowRequest does
+		backfill_timeline(requesting_user, requested_user);
+	}
+	else if(history.substr(0,8) == "UNFOLLOW"){
+		// get the requesting and requested usernames, and the time of the unfollow when it has one
+		std::vector<std::string> arguments = log_arguments(history, 9);
+		const std::string& requesting_user = arguments.at(0);
+		const std::string& requested_user = arguments.at(1);
+		uint64_t unfollowed = log_number(arguments, 2);
+		if(unfollowed != 0){
+			users_db.at(requesting_user)->follow_versions[requested_user] = std::make_pair(unfollowed, false);
+		}
+
+		// remove the requesting from the requested's followers, a snapshot keeps unfollows of
+		// users that were deleted since
+		int position_to_remove1 = find_follower(users_db.at(requesting_user)->following, requested_user);
+		if(position_to_remove1 != -1){
+			users_db.at(requesting_user)->following.erase(users_db.at(requesting_user)->
+										following.begin() + position_to_remove1);
+			int position_to_remove2 = find_follower(users_db.at(requested_user)->followers, requesting_user);
+			users_db.at(requested_user)->followers.erase(users_db.at(requested_user)->
+										followers.begin() + position_to_remove2);
+			graph_unfollow(requesting_user, requested_user);
+		}
+		update_follow_digest(users_db.at(requesting_user));
+
+	}
+	else if(history.substr(0,4) == "POST"){
+		// construct the post
+		std::vector<std::string> post_info;
+		std::size_t index_user = history.find_first_of("|");
+		std::string user = history.substr(5, index_user - 5);
+		std::string rest_of_post = history.substr(index_user+1);
+		std::size_t index_time = rest_of_post.find_first_of("|");
+		std::string time = rest_of_post.substr(0, index_time);
+		std::string content = rest_of_post.substr(index_time + 1);
+		post_info.push_back(user);
+		post_info.push_back(time);
+		post_info.push_back(content);
+
+		// add this post to the user's posts and their followers' timelines the way TimelineRequest
+		// does, so a replayed log keeps the timelines at 20 posts
+		fan_out_post(user, post_info);
+	}
+}
+
+// function that returns the log line of a post, posts that came from a client end their time and
+// content with a new line, the log has none
+std::string post_log_line(const std::string& username, std::string time, std::string content){
+	if(!time.empty() && time.back() == '\n'){
+		time.pop_back();
+	}
+	if(!content.empty() && content.back() == '\n'){
+		content.pop_back();
+	}
+	return "POST " + username + "|" + time + "|" + content;
+}
+
+// functions that return the log lines of a registration, a delete and a follow or unfollow with the
+// time of the change (store_digest.h), so the versions the anti entropy compares outlive a restart
+// a registration or follow that has no time is logged without one
+std::string initialize_log_line(const user* u){
+	if(u->registered_ns == 0){
+		return "INITIALIZE " + u->username;
+	}
+	return "INITIALIZE " + u->username + "|" + std::to_string(u->registered_ns);
+}
+
+std::string delete_log_line(const std::string& username, uint64_t time){
+	return "DELETE " + username + "|" + std::to_string(time);
+}
+
+std::string follow_log_line(const user* u, const std::string& followee, bool follow){
+	std::string line = (follow ? "FOLLOW " : "UNFOLLOW ") + u->username + "|" + followee;
+	auto version = u->follow_versions.find(followee);
+	if(version != u->follow_versions.end() && version->second.second == follow){
+		line += "|" + std::to_string(version->second.first);
+	}
+	return line;
+}
+
+// function that calls emit with every line of a log that rebuilds the store as it is, a restarted
+// server begins its new log with these instead of the whole history it replayed
+// the tombstones of deleted users come first, then every user, then their posts oldest first,
+// then the follows, so the timelines are built by backfill_timeline as a follow builds them, then
+// the unfollows that have a time and the followers on other masters last
+// the caller holds users_db_mutex
+template<typename Emit>
+void write_store_snapshot(Emit emit){
+	for(auto& deleted : store_digest.deleted_users){
+		emit(delete_log_line(deleted.first, deleted.second));
+	}
+	for(int i = 0; i < all_users.size(); i++){
+		const user* u = users_db.at(all_users.at(i));
+		if(u->home == ""){
+			emit(initialize_log_line(u));
+		}
+		else{
+			emit("REMOTE_USER " + u->username + "|" + u->home + "|" + std::to_string(u->leaf_digest));
+		}
+	}
+	for(int i = 0; i < all_users.size(); i++){
+		const user* u = users_db.at(all_users.at(i));
+		std::vector<post_handle> posts = newest_posts(u->username, u->spilled_posts + u->posts.size());
+		for(int p = posts.size() - 1; p >= 0; p--){
+			std::string time(posts.at(p)->field(1), posts.at(p)->lengths[1]);
+			emit(post_log_line(u->username, time, post_body(posts.at(p)->field(2), posts.at(p)->lengths[2])));
+		}
+	}
+	for(int i = 0; i < all_users.size(); i++){
+		const user* u = users_db.at(all_users.at(i));
+		for(int f = 0; f < u->following.size(); f++){
+			if(u->following.at(f) != u->username){
+				emit(follow_log_line(u, u->following.at(f), true));
+			}
+		}
+	}
+	for(int i = 0; i < all_users.size(); i++){
+		const user* u = users_db.at(all_users.at(i));
+		for(auto& version : u->follow_versions){
+			if(!version.second.second){
+				emit(follow_log_line(u, version.first, false));
+			}
+		}
+	}
+	for(int i = 0; i < all_users.size(); i++){
+		const user* u = users_db.at(all_users.at(i));
+		for(auto& entry : u->remote_followers){
+			for(int f = 0; f < entry.second.size(); f++){
+				emit("REMOTE_FOLLOW " + entry.second.at(f) + "|" + u->username + "|" + entry.first);
+			}
+		}
+	}
+}
+
+#endif